@@ -0,0 +1,1018 @@
+/*
+ * Host benchmark for the gps2 driver and the minmea parser.
+ *
+ * Replays NMEA recordings through the real rx path (UART dispatcher, line
+ * framing, parsing and events) on top of the host stand-in for Mongoose OS,
+ * then times the parser on its own per sentence type and the RPC handlers
+ * against the state the replay left behind, and the PMTK command queue
+ * against a simulated receiver, and location batches that a handler resizes
+ * while they are delivered. With --ubx, also replays a UBX recording of
+ * the same track and compares the cost per location. Last, the fixes of the
+ * replay go into the delta compressed track history, which is checked against
+ * them and compared with keeping the raw structs, and, repeated to a million,
+ * into a binary fix log on disk that is read back memory mapped, then torn.
+ * Then they are simplified at several tolerances, and the points kept are
+ * checked to be within the tolerance of every fix.
+ *
+ * usage: gps2_bench [--repeat N] [--chunk BYTES] [--sentences RMC,GGA,...] [--sky] [--stats] [--devices N]
+ *                   [--ubx file.ubx] [file.nmea ...]
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mgos_host.h"
+#include "gps2.h"
+#include "gps2_commands.h"
+#include "gps2_log.h"
+#include "gps2_simplify.h"
+#include "gps2_track.h"
+#include "minmea.h"
+
+/* the global device's UART, from the host sys config */
+#define BENCH_UART_NO 1
+
+/* longer lines are cut, the parser rejects them anyway */
+#define GPS2_BENCH_MAX_LINE 256
+
+/* sentence types we report, indexed by minmea_sentence_id + 2 */
+#define BENCH_TYPE_SLOTS (MINMEA_SENTENCE_LAST + 3)
+
+/* in gps2.c, not part of the public API */
+void parseNmeaString(struct mg_str line, struct gps2 *gps_dev);
+enum mgos_init_result mgos_gps2_init(void);
+
+/* calls per RPC method */
+#define BENCH_RPC_CALLS 20000
+
+/* PMTK commands per pass */
+#define BENCH_PMTK_COMMANDS 20000
+
+/* random seeks into the track history per pass */
+#define BENCH_TRACK_SEEKS 20000
+
+/* fixes written to the fix log, the replay's over and over */
+#define BENCH_LOG_FIXES 1000000
+
+/* a kept point at least this often while simplifying */
+#define BENCH_SIMPLIFY_HEARTBEAT_MS 60000
+
+struct corpus {
+  char *data;
+  size_t len;
+};
+
+struct replay_counts {
+  uint64_t sentences[BENCH_TYPE_SLOTS];
+  uint64_t total_sentences;
+  uint64_t locations;
+  uint64_t fixes;
+  uint64_t sky_views;
+  uint64_t device_locations[GPS2_MAX_DEVICES]; /* by device id */
+};
+
+static struct replay_counts replay_counts;
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static const char *type_name(int slot) {
+  static char name[8];
+  switch (slot - 2) {
+    case MINMEA_SENTENCE_PROPRIETARY: return "PROP";
+    case MINMEA_INVALID: return "INVALID";
+    case MINMEA_UNKNOWN: return "UNKNOWN";
+    case MINMEA_SENTENCE_RMC: return "RMC";
+    case MINMEA_SENTENCE_GGA: return "GGA";
+    case MINMEA_SENTENCE_GSA: return "GSA";
+    case MINMEA_SENTENCE_GLL: return "GLL";
+    case MINMEA_SENTENCE_GST: return "GST";
+    case MINMEA_SENTENCE_GSV: return "GSV";
+    case MINMEA_SENTENCE_VTG: return "VTG";
+    case MINMEA_SENTENCE_ZDA: return "ZDA";
+    default:
+      snprintf(name, sizeof(name), "id %d", slot - 2);
+      return name;
+  }
+}
+
+static bool load_corpus(const char *path, struct corpus *corpus) {
+  FILE *fp = fopen(path, "rb");
+  char buf[65536];
+  size_t n;
+
+  if (fp == NULL) {
+    perror(path);
+    return false;
+  }
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    corpus->data = realloc(corpus->data, corpus->len + n);
+    memcpy(corpus->data + corpus->len, buf, n);
+    corpus->len += n;
+  }
+  fclose(fp);
+  return true;
+}
+
+/* ########################################################################### */
+/* driver replay */
+
+static void sentence_handler(int ev, void *ev_data, void *userdata) {
+  const struct mgos_gps_nmea_sentence *sentence = ev_data;
+  int slot = sentence->sentence_id + 2;
+  (void) ev;
+  (void) userdata;
+  if (slot >= 0 && slot < BENCH_TYPE_SLOTS) replay_counts.sentences[slot]++;
+  replay_counts.total_sentences++;
+}
+
+static void location_handler(int ev, void *ev_data, void *userdata) {
+  const struct mgos_gps_location *location = ev_data;
+  (void) ev;
+  (void) userdata;
+  replay_counts.locations++;
+  replay_counts.device_locations[gps2_get_device_id(location->dev)]++;
+}
+
+static void fix_handler(int ev, void *ev_data, void *userdata) {
+  (void) ev;
+  (void) ev_data;
+  (void) userdata;
+  replay_counts.fixes++;
+}
+
+static void sky_view_handler(int ev, void *ev_data, void *userdata) {
+  (void) ev;
+  (void) ev_data;
+  (void) userdata;
+  replay_counts.sky_views++;
+}
+
+/* UARTs with a device on them, BENCH_UART_NO first */
+static int bench_uarts[MGOS_HOST_UART_COUNT];
+static int bench_devices = 1;
+
+/* push the corpus onto the simulated wire of each device in UART FIFO sized
+   chunks, interleaved as if the receivers were running side by side */
+static void feed(const struct corpus *corpus, size_t chunk) {
+  size_t offset = 0;
+  size_t len;
+  size_t pushed;
+  int i;
+  while (offset < corpus->len) {
+    len = corpus->len - offset < chunk ? corpus->len - offset : chunk;
+    pushed = len;
+    for (i = 0; i < bench_devices; i++) {
+      pushed = mgos_host_uart_receive(bench_uarts[i], corpus->data + offset, len);
+    }
+    offset += pushed;
+  }
+}
+
+/* the line framing gps2_uart_rx_callback used before the receive ring, kept
+   here as the "before" reference: mbuf, mg_strstr from the start of the
+   buffer, a heap copy per line and mbuf_remove */
+static void legacy_feed(struct gps2 *dev, const struct corpus *corpus, size_t chunk) {
+  struct mbuf rx_buffer;
+  struct mg_str line_buffer;
+  struct mg_str line_buffer_nul;
+  const char *terminator_ptr;
+  const struct mg_str crlf = mg_mk_str("\r\n");
+  size_t offset = 0;
+  size_t len;
+  size_t line_length;
+
+  mbuf_init(&rx_buffer, 512);
+  while (offset < corpus->len) {
+    len = corpus->len - offset < chunk ? corpus->len - offset : chunk;
+    mbuf_append(&rx_buffer, corpus->data + offset, len);
+    offset += len;
+
+    line_buffer = mg_mk_str_n(rx_buffer.buf, rx_buffer.len);
+    terminator_ptr = mg_strstr(line_buffer, crlf);
+    while (terminator_ptr != NULL) {
+      line_length = crlf.len + (terminator_ptr - rx_buffer.buf);
+      line_buffer = mg_mk_str_n(rx_buffer.buf, line_length);
+      line_buffer_nul = mg_strdup_nul(line_buffer);
+      parseNmeaString(line_buffer_nul, dev);
+      mg_strfree(&line_buffer_nul);
+      mbuf_remove(&rx_buffer, line_length);
+      line_buffer = mg_mk_str_n(rx_buffer.buf, rx_buffer.len);
+      terminator_ptr = mg_strstr(line_buffer, crlf);
+    }
+  }
+  mbuf_free(&rx_buffer);
+}
+
+static void report_replay(const char *label, double elapsed, size_t bytes,
+                          const struct mgos_host_alloc_stats *allocs) {
+  printf("%-16s %8.2f MB/s %10.0f sentences/s %8.1f ns/sentence %6.3f allocs/sentence\n",
+         label, bytes / elapsed / 1e6, replay_counts.total_sentences / elapsed,
+         elapsed * 1e9 / replay_counts.total_sentences,
+         (double) allocs->allocs / replay_counts.total_sentences);
+}
+
+static void print_histogram(const char *label, const struct gps2_histogram *histogram) {
+  int i;
+
+  printf("  %-10s", label);
+  for (i = 0; i < GPS2_HISTOGRAM_BUCKETS; i++) {
+    if (histogram->buckets[i] > 0) {
+      printf(" <%uus %u", 1u << i, histogram->buckets[i]);
+    }
+  }
+  printf(", max %u us\n", histogram->max_us);
+}
+
+/* the device counters for the gps2 passes */
+static void report_stats(struct gps2 *dev) {
+  struct gps2_stats stats;
+  int id;
+
+  gps2_get_device_stats(dev, &stats);
+  printf("  rx %u bytes, %u overflows, high water %zu bytes, first good sentence after %d ms\n", stats.rx_bytes,
+         stats.rx_overflows, stats.rx_high_water, (int) stats.first_sentence_ms);
+  printf("  lines %u, dropped %u, filtered %u, unknown %u, proprietary %u, bad checksum %u\n", stats.lines,
+         stats.lines_dropped, stats.filtered_lines, stats.unknown_lines, stats.proprietary_lines,
+         stats.checksum_failures);
+  printf("  parse failures:");
+  for (id = MINMEA_SENTENCE_RMC; id < MINMEA_SENTENCE_USER; id++) {
+    if (stats.parse_failures[id] > 0) {
+      printf(" %s %u", type_name(id + 2), stats.parse_failures[id]);
+    }
+  }
+  printf("\n  ubx packets %u, bad checksum %u, dropped %u", stats.ubx_packets, stats.ubx_checksum_failures,
+         stats.ubx_dropped);
+  printf("\n  tx queued %u bytes, dropped %u bytes, pmtk commands %u, timeouts %u, events %u\n",
+         stats.tx_bytes_queued, stats.tx_bytes_dropped, stats.pmtk_commands, stats.pmtk_timeouts, stats.events);
+  print_histogram("dispatcher", &stats.dispatcher_us);
+  print_histogram("parse", &stats.parse_us);
+  print_histogram("handlers", &stats.handler_us);
+}
+
+static void bench_driver(struct gps2 *dev, const struct corpus *corpus, int repeat, size_t chunk, bool stats) {
+  struct mgos_host_alloc_stats allocs;
+  size_t baseline;
+  double start;
+  double elapsed;
+  int i;
+  int slot;
+
+  printf("\nDriver rx path, %zu byte chunks, %d passes\n", chunk, repeat);
+
+  memset(&replay_counts, 0, sizeof(replay_counts));
+  mgos_host_reset_alloc_stats();
+  start = now_seconds();
+  for (i = 0; i < repeat; i++) legacy_feed(dev, corpus, chunk);
+  elapsed = now_seconds() - start;
+  mgos_host_get_alloc_stats(&allocs);
+  report_replay("legacy framer", elapsed, corpus->len * repeat, &allocs);
+
+  memset(&replay_counts, 0, sizeof(replay_counts));
+  mgos_host_reset_alloc_stats();
+  mgos_host_get_alloc_stats(&allocs);
+  baseline = allocs.live_bytes;
+  gps2_reset_device_stats(dev);
+  start = now_seconds();
+  for (i = 0; i < repeat; i++) feed(corpus, chunk);
+  elapsed = now_seconds() - start;
+  mgos_host_get_alloc_stats(&allocs);
+  report_replay("gps2", elapsed, corpus->len * repeat * bench_devices, &allocs);
+
+  printf("  sentences per pass:");
+  for (slot = 0; slot < BENCH_TYPE_SLOTS; slot++) {
+    if (replay_counts.sentences[slot] > 0) {
+      printf(" %s %llu", type_name(slot), (unsigned long long) (replay_counts.sentences[slot] / repeat));
+    }
+  }
+  printf("\n  locations per pass: %llu, fixes per pass: %llu, sky views per pass: %llu\n",
+         (unsigned long long) (replay_counts.locations / repeat), (unsigned long long) (replay_counts.fixes / repeat),
+         (unsigned long long) (replay_counts.sky_views / repeat));
+  if (bench_devices > 1) {
+    printf("  locations per pass by device:");
+    for (slot = 0; slot < GPS2_MAX_DEVICES; slot++) {
+      if (gps2_get_device(slot) != NULL) {
+        printf(" %d: %llu", slot, (unsigned long long) (replay_counts.device_locations[slot] / repeat));
+      }
+    }
+    printf("\n");
+  }
+  printf("  peak buffered: uart %zu bytes, gps2 ring %zu bytes, heap growth %zu bytes\n",
+         mgos_host_uart_rx_peak(BENCH_UART_NO), gps2_get_device_rx_high_water(dev),
+         allocs.peak_live_bytes - baseline);
+  if (stats) report_stats(dev);
+}
+
+/* one pass of a recording through the gps2 rx path, per location */
+static void report_track(const char *label, const struct corpus *corpus, int repeat, size_t chunk) {
+  struct mgos_host_alloc_stats allocs;
+  double start;
+  double elapsed;
+  double locations;
+  int i;
+
+  memset(&replay_counts, 0, sizeof(replay_counts));
+  mgos_host_reset_alloc_stats();
+  start = now_seconds();
+  for (i = 0; i < repeat; i++) feed(corpus, chunk);
+  elapsed = now_seconds() - start;
+  mgos_host_get_alloc_stats(&allocs);
+  locations = (double) replay_counts.locations / bench_devices;
+  if (locations == 0) {
+    printf("%-6s no locations\n", label);
+    return;
+  }
+  printf("%-6s %8.2f MB/s %8.1f bytes/location %8.1f ns/location %6.3f allocs/location %llu locations per pass\n",
+         label, corpus->len * repeat * bench_devices / elapsed / 1e6, corpus->len * repeat / locations,
+         elapsed * 1e9 / (locations * bench_devices), (double) allocs.allocs / (locations * bench_devices),
+         (unsigned long long) (replay_counts.locations / repeat / bench_devices));
+}
+
+/* the same track as NMEA and as UBX NAV-PVT/NAV-SAT */
+static void bench_ubx(const struct corpus *nmea, const struct corpus *ubx, int repeat, size_t chunk) {
+  printf("\nNMEA vs UBX, %zu byte chunks, %d passes\n", chunk, repeat);
+  report_track("NMEA", nmea, repeat, chunk);
+  report_track("UBX", ubx, repeat, chunk);
+}
+
+/* ########################################################################### */
+/* parser on its own */
+
+struct line_set {
+  char **lines;
+  size_t count;
+  size_t capacity;
+};
+
+static void add_line(struct line_set *set, const char *p, size_t len) {
+  if (set->count == set->capacity) {
+    set->capacity = set->capacity ? set->capacity * 2 : 256;
+    set->lines = realloc(set->lines, set->capacity * sizeof(char *));
+  }
+  set->lines[set->count] = malloc(len + 1);
+  memcpy(set->lines[set->count], p, len);
+  set->lines[set->count][len] = '\0';
+  set->count++;
+}
+
+/* the minmea calls parseNmeaString made before the single pass parser */
+static bool two_pass_parse(const char *line) {
+  union {
+    struct minmea_sentence_rmc rmc;
+    struct minmea_sentence_gga gga;
+    struct minmea_sentence_gsa gsa;
+    struct minmea_sentence_gll gll;
+    struct minmea_sentence_gst gst;
+    struct minmea_sentence_gsv gsv;
+    struct minmea_sentence_vtg vtg;
+    struct minmea_sentence_zda zda;
+  } frame;
+
+  switch (minmea_sentence_id(line, false)) {
+    case MINMEA_SENTENCE_RMC: return minmea_parse_rmc(&frame.rmc, line);
+    case MINMEA_SENTENCE_GGA: return minmea_parse_gga(&frame.gga, line);
+    case MINMEA_SENTENCE_GSA: return minmea_parse_gsa(&frame.gsa, line);
+    case MINMEA_SENTENCE_GLL: return minmea_parse_gll(&frame.gll, line);
+    case MINMEA_SENTENCE_GST: return minmea_parse_gst(&frame.gst, line);
+    case MINMEA_SENTENCE_GSV: return minmea_parse_gsv(&frame.gsv, line);
+    case MINMEA_SENTENCE_VTG: return minmea_parse_vtg(&frame.vtg, line);
+    case MINMEA_SENTENCE_ZDA: return minmea_parse_zda(&frame.zda, line);
+    default: return false;
+  }
+}
+
+static void bench_parser(const struct corpus *corpus, int repeat) {
+  struct line_set sets[BENCH_TYPE_SLOTS];
+  struct minmea_frame frame;
+  const char *p = corpus->data;
+  const char *end = corpus->data + corpus->len;
+  const char *eol;
+  size_t len;
+  size_t i;
+  int slot;
+  int r;
+  double start;
+  double fused;
+  double two_pass;
+  volatile int sink = 0;
+
+  memset(sets, 0, sizeof(sets));
+
+  /* split into lines and group them by type */
+  while (p < end) {
+    eol = memchr(p, '\n', end - p);
+    if (eol == NULL) eol = end;
+    len = eol - p;
+    if (len > 0 && p[len - 1] == '\r') len--;
+    if (len > 0) {
+      char line[GPS2_BENCH_MAX_LINE];
+      if (len >= sizeof(line)) len = sizeof(line) - 1;
+      memcpy(line, p, len);
+      line[len] = '\0';
+      slot = minmea_peek_sentence_id(line) + 2;
+      add_line(&sets[slot], line, len);
+    }
+    p = eol + 1;
+  }
+
+  printf("\nParser, ns/sentence, %d passes\n", repeat);
+  printf("  %-8s %10s %12s %12s\n", "type", "count", "fused", "two-pass");
+  for (slot = 0; slot < BENCH_TYPE_SLOTS; slot++) {
+    if (sets[slot].count == 0) continue;
+
+    start = now_seconds();
+    for (r = 0; r < repeat; r++) {
+      for (i = 0; i < sets[slot].count; i++) sink += minmea_parse(&frame, sets[slot].lines[i], false);
+    }
+    fused = now_seconds() - start;
+
+    start = now_seconds();
+    for (r = 0; r < repeat; r++) {
+      for (i = 0; i < sets[slot].count; i++) sink += two_pass_parse(sets[slot].lines[i]);
+    }
+    two_pass = now_seconds() - start;
+
+    printf("  %-8s %10zu %12.1f %12.1f\n", type_name(slot), sets[slot].count,
+           fused * 1e9 / (sets[slot].count * repeat), two_pass * 1e9 / (sets[slot].count * repeat));
+
+    for (i = 0; i < sets[slot].count; i++) free(sets[slot].lines[i]);
+    free(sets[slot].lines);
+  }
+}
+
+/* ########################################################################### */
+
+/* a comma separated list of sentence types as a subscription mask */
+static bool parse_sentence_mask(const char *list, uint64_t *mask) {
+  char name[8];
+  size_t len;
+  int slot;
+
+  *mask = 0;
+  while (*list != '\0') {
+    len = strcspn(list, ",");
+    if (len >= sizeof(name)) return false;
+    memcpy(name, list, len);
+    name[len] = '\0';
+    for (slot = 0; slot < BENCH_TYPE_SLOTS; slot++) {
+      if (strcmp(type_name(slot), name) == 0) break;
+    }
+    if (slot == BENCH_TYPE_SLOTS) return false;
+    *mask |= GPS2_SENTENCE_BIT(slot - 2);
+    list += len;
+    if (*list == ',') list++;
+  }
+  return true;
+}
+
+/* ########################################################################### */
+/* PMTK command queue, against a receiver that acknowledges everything */
+
+static int pmtk_acked;
+
+static void pmtk_handler(struct gps2 *dev, int number, enum gps2_pmtk_result result, void *userdata) {
+  (void) dev;
+  (void) number;
+  (void) userdata;
+  if (result == GPS2_PMTK_OK) pmtk_acked++;
+}
+
+/* take what the driver has written to the UART and answer each PMTK command in it */
+static void pmtk_answer(void) {
+  static char tx[MGOS_HOST_UART_TX_SIZE + 1];
+  char body[24];
+  char ack[32];
+  const char *p;
+  size_t n;
+  int len;
+
+  n = mgos_host_uart_take_tx(BENCH_UART_NO, tx, MGOS_HOST_UART_TX_SIZE);
+  tx[n] = '\0';
+  for (p = strstr(tx, "$PMTK"); p != NULL; p = strstr(p + 1, "$PMTK")) {
+    snprintf(body, sizeof(body), "PMTK001,%d,3", atoi(p + 5));
+    len = snprintf(ack, sizeof(ack), "$%s*%02X\r\n", body, minmea_xor(body, strlen(body)));
+    mgos_host_uart_receive(BENCH_UART_NO, ack, len);
+  }
+}
+
+static void bench_pmtk(struct gps2 *dev, int repeat) {
+  struct mgos_host_alloc_stats allocs;
+  double start;
+  double elapsed;
+  int commands = BENCH_PMTK_COMMANDS * repeat;
+  int queued = 0;
+
+  pmtk_acked = 0;
+  mgos_host_reset_alloc_stats();
+  start = now_seconds();
+  while (queued < commands) {
+    if (gps2_send_device_pmtk(dev, GPS2_PMTK_UPDATE_1HZ, pmtk_handler, NULL)) {
+      queued++;
+    } else {
+      pmtk_answer();
+    }
+  }
+  while (gps2_get_device_pmtk_pending(dev) > 0) pmtk_answer();
+  elapsed = now_seconds() - start;
+  mgos_host_get_alloc_stats(&allocs);
+
+  printf("\nPMTK command queue, %d commands\n", commands);
+  printf("  %10.0f commands/s %8.1f ns/command %6.3f allocs/command, %d acknowledged\n", commands / elapsed,
+         elapsed * 1e9 / commands, (double) allocs.allocs / commands, pmtk_acked);
+}
+
+/* ########################################################################### */
+/* location batches resized from their own handler */
+
+static const int batch_sizes[] = {7, 1, 33, 12};
+static struct gps2 *batch_dev;
+static int batch_resizes;
+static uint64_t batch_fixes;
+static int64_t batch_sum;
+static bool batch_ok;
+
+static int64_t batch_checksum(const struct mgos_gps_location_batch *batch) {
+  int64_t sum = 0;
+  int i;
+  for (i = 0; i < batch->count; i++) sum += batch->locations[i].latitude_e7 + batch->locations[i].time;
+  return sum;
+}
+
+/* first in the chain: reads the batch, changes the size, and reads it again */
+static void batch_resize_handler(int ev, void *ev_data, void *userdata) {
+  const struct mgos_gps_location_batch *batch = ev_data;
+  (void) ev;
+  (void) userdata;
+  if (batch->dev != batch_dev) return;
+  batch_sum = batch_checksum(batch);
+  batch_fixes += batch->count;
+  batch_resizes++;
+  gps2_set_device_location_batch(batch_dev, batch_sizes[batch_resizes % 4], 0);
+  if (batch_checksum(batch) != batch_sum) batch_ok = false;
+}
+
+/* after it: the batch is still the one that was sent */
+static void batch_check_handler(int ev, void *ev_data, void *userdata) {
+  const struct mgos_gps_location_batch *batch = ev_data;
+  (void) ev;
+  (void) userdata;
+  if (batch->dev != batch_dev) return;
+  if (batch_checksum(batch) != batch_sum) batch_ok = false;
+}
+
+static void bench_batch(struct gps2 *dev, const struct corpus *corpus) {
+  batch_dev = dev;
+  batch_ok = true;
+  mgos_event_add_handler(MGOS_EV_GPS_LOCATION_BATCH, batch_resize_handler, NULL);
+  mgos_event_add_handler(MGOS_EV_GPS_LOCATION_BATCH, batch_check_handler, NULL);
+  gps2_set_device_location_batch(dev, batch_sizes[0], 0);
+  feed(corpus, 64);
+  gps2_flush_device_location_batch(dev);
+  gps2_set_device_location_batch(dev, 0, 0);
+  mgos_event_remove_handler(MGOS_EV_GPS_LOCATION_BATCH, batch_resize_handler, NULL);
+  mgos_event_remove_handler(MGOS_EV_GPS_LOCATION_BATCH, batch_check_handler, NULL);
+
+  printf("\nLocation batches resized by their handler: %d batches, %llu fixes, %s\n", batch_resizes,
+         (unsigned long long) batch_fixes, batch_ok ? "ok" : "FAILED");
+}
+
+/* ########################################################################### */
+/* track history, against the fixes of a replay */
+
+static struct gps2 *track_dev;
+static struct mgos_gps_location_fixed *track_fixes;
+static size_t track_fix_count;
+static size_t track_fix_capacity;
+
+static void track_fix_handler(int ev, void *ev_data, void *userdata) {
+  const struct mgos_gps_location_fixed *location = ev_data;
+  (void) ev;
+  (void) userdata;
+  if (location->dev != track_dev) return;
+  if (track_fix_count == track_fix_capacity) {
+    track_fix_capacity = track_fix_capacity > 0 ? track_fix_capacity * 2 : 4096;
+    track_fixes = realloc(track_fixes, track_fix_capacity * sizeof(struct mgos_gps_location_fixed));
+  }
+  track_fixes[track_fix_count++] = *location;
+}
+
+static bool track_point_matches(const struct gps2_track_point *point, const struct mgos_gps_location_fixed *fix) {
+  return point->time_ms == (int64_t) fix->time * 1000 + fix->microseconds / 1000
+         && point->latitude_e7 == fix->latitude_e7 && point->longitude_e7 == fix->longitude_e7
+         && point->speed_e3 == fix->speed_e3 && point->bearing_e2 == fix->bearing_e2;
+}
+
+static void bench_track(struct gps2 *dev, const struct corpus *corpus, int repeat) {
+  struct mgos_host_alloc_stats allocs;
+  struct gps2_track track;
+  struct gps2_track_iter iter;
+  struct gps2_track_point point;
+  size_t raw = sizeof(struct mgos_gps_location);
+  size_t matched = 0;
+  size_t i;
+  size_t bytes;
+  double start;
+  double add_s;
+  double iterate_s;
+  double seek_s;
+  int64_t first_ms;
+  int64_t span_ms;
+  uint32_t seed = 1;
+  int r;
+
+  /* the driver's own history, with room for everything, and the fixes it was built from */
+  track_dev = dev;
+  gps2_set_device_track_history(dev, corpus->len);
+  mgos_event_add_handler(MGOS_EV_GPS_LOCATION_FIXED, track_fix_handler, NULL);
+  feed(corpus, 64);
+  mgos_event_remove_handler(MGOS_EV_GPS_LOCATION_FIXED, track_fix_handler, NULL);
+  if (track_fix_count == 0) return;
+
+  gps2_track_iter_init(gps2_get_device_track(dev), &iter);
+  for (i = 0; i < track_fix_count && gps2_track_next(&iter, &point); i++) {
+    if (track_point_matches(&point, &track_fixes[i])) matched++;
+  }
+  gps2_set_device_track_history(dev, 0);
+
+  /* the same fixes in the memory the raw structs would take */
+  if (!gps2_track_init(&track, track_fix_count * raw)) return;
+  mgos_host_reset_alloc_stats();
+  start = now_seconds();
+  for (r = 0; r < repeat; r++) {
+    gps2_track_clear(&track);
+    for (i = 0; i < track_fix_count; i++) gps2_track_add(&track, &track_fixes[i]);
+  }
+  add_s = now_seconds() - start;
+  bytes = gps2_track_bytes(&track);
+
+  start = now_seconds();
+  for (r = 0; r < repeat; r++) {
+    gps2_track_iter_init(&track, &iter);
+    while (gps2_track_next(&iter, &point)) {
+    }
+  }
+  iterate_s = now_seconds() - start;
+
+  first_ms = (int64_t) track_fixes[0].time * 1000;
+  span_ms = (int64_t) (track_fixes[track_fix_count - 1].time - track_fixes[0].time) * 1000 + 1;
+  start = now_seconds();
+  for (r = 0; r < repeat * BENCH_TRACK_SEEKS; r++) {
+    seed = seed * 1103515245 + 12345;
+    gps2_track_seek(&track, &iter, first_ms + (int64_t) (seed >> 8) % span_ms);
+  }
+  seek_s = now_seconds() - start;
+  mgos_host_get_alloc_stats(&allocs);
+
+  printf("\nTrack history, %zu fixes, %zu of them read back unchanged from the driver's history\n", track_fix_count,
+         matched);
+  printf("  struct mgos_gps_location %6.2f bytes/point %8.1f points/KB\n", (double) raw, 1024.0 / raw);
+  printf("  delta compressed         %6.2f bytes/point %8.1f points/KB  %.1fx, %d blocks of %zu bytes\n",
+         (double) bytes / track.points, 1024.0 * track.points / bytes, (double) raw * track.points / bytes,
+         track.used, sizeof(struct gps2_track_block));
+  printf("  %8.1f ns/add %8.1f ns/point iterated %8.1f ns/seek %6.3f allocs/point\n",
+         add_s * 1e9 / (repeat * track_fix_count), iterate_s * 1e9 / (repeat * track_fix_count),
+         seek_s * 1e9 / (repeat * BENCH_TRACK_SEEKS), (double) allocs.allocs / (repeat * track_fix_count));
+
+  gps2_track_free(&track);
+}
+
+/* the fix log's blocks in a file, mapped. NULL if it is empty */
+static void *map_log(const char *path, size_t *length) {
+  struct stat st;
+  void *data;
+  int fd = open(path, O_RDONLY);
+
+  *length = 0;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+    if (fd >= 0) close(fd);
+    return NULL;
+  }
+  data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return NULL;
+  *length = (size_t) st.st_size;
+  return data;
+}
+
+/* the replay's fixes, lap after lap a span later, as the log's writer sees them */
+static void log_fix(size_t n, int64_t span_s, struct mgos_gps_location_fixed *fix) {
+  *fix = track_fixes[n % track_fix_count];
+  fix->time += (time_t) ((n / track_fix_count) * span_s);
+}
+
+static void bench_log(int repeat) {
+  char path[] = "/tmp/gps2_bench_log_XXXXXX";
+  struct mgos_host_alloc_stats allocs;
+  struct mgos_gps_location_fixed fix;
+  struct gps2_log log;
+  struct gps2_log_reader reader;
+  struct gps2_track_iter iter;
+  struct gps2_track_point point;
+  size_t raw = sizeof(struct mgos_gps_location);
+  size_t length;
+  size_t matched = 0;
+  size_t blocks;
+  size_t n;
+  uint64_t points;
+  uint32_t seed = 1;
+  int64_t span_s;
+  int64_t first_ms;
+  int64_t span_ms;
+  double start;
+  double write_s;
+  double read_s;
+  double seek_s;
+  void *data;
+  bool ok;
+  int fd;
+  int r;
+
+  if (track_fix_count == 0) return;
+  fd = mkstemp(path);
+  if (fd < 0) {
+    perror(path);
+    return;
+  }
+  close(fd);
+  span_s = track_fixes[track_fix_count - 1].time - track_fixes[0].time + 1;
+
+  mgos_host_reset_alloc_stats();
+  start = now_seconds();
+  if (!gps2_log_open(&log, path, 0)) {
+    perror(path);
+    unlink(path);
+    return;
+  }
+  for (n = 0; n < BENCH_LOG_FIXES; n++) {
+    log_fix(n, span_s, &fix);
+    gps2_log_add(&log, &fix);
+  }
+  gps2_log_close(&log);
+  write_s = now_seconds() - start;
+  mgos_host_get_alloc_stats(&allocs);
+
+  data = map_log(path, &length);
+  blocks = gps2_log_reader_init(&reader, data, length);
+  start = now_seconds();
+  for (r = 0; r < repeat; r++) {
+    gps2_log_iter_init(&reader, &iter);
+    for (n = 0; gps2_track_next(&iter, &point); n++) {
+    }
+  }
+  read_s = now_seconds() - start;
+
+  gps2_log_iter_init(&reader, &iter);
+  for (n = 0; n < BENCH_LOG_FIXES && gps2_track_next(&iter, &point); n++) {
+    log_fix(n, span_s, &fix);
+    if (track_point_matches(&point, &fix)) matched++;
+  }
+
+  first_ms = (int64_t) track_fixes[0].time * 1000;
+  span_ms = (int64_t) (BENCH_LOG_FIXES / track_fix_count + 1) * span_s * 1000;
+  start = now_seconds();
+  for (r = 0; r < repeat * BENCH_TRACK_SEEKS; r++) {
+    seed = seed * 1103515245 + 12345;
+    gps2_log_seek(&reader, &iter, first_ms + (int64_t) (seed >> 8) % span_ms);
+  }
+  seek_s = now_seconds() - start;
+  munmap(data, length);
+
+  printf("\nFix log, %d fixes in %zu blocks of %d bytes, %zu read back unchanged\n", BENCH_LOG_FIXES, blocks,
+         GPS2_LOG_BLOCK_SIZE, matched);
+  printf("  %6.2f bytes/fix, %.1fx smaller than struct mgos_gps_location, %zu bytes\n",
+         (double) length / BENCH_LOG_FIXES, (double) raw * BENCH_LOG_FIXES / length, length);
+  printf("  %8.1f ns/fix written %8.1f ns/fix read mapped %8.1f ns/seek %6.3f allocs/fix written\n",
+         write_s * 1e9 / BENCH_LOG_FIXES, read_s * 1e9 / ((double) repeat * BENCH_LOG_FIXES),
+         seek_s * 1e9 / (repeat * BENCH_TRACK_SEEKS), (double) allocs.allocs / BENCH_LOG_FIXES);
+
+  /* a power cut half way through writing the last block */
+  if (truncate(path, (off_t) (length - GPS2_LOG_BLOCK_SIZE / 2)) != 0) {
+    perror(path);
+    unlink(path);
+    return;
+  }
+  data = map_log(path, &length);
+  gps2_log_reader_init(&reader, data, length);
+  points = gps2_log_reader_points(&reader);
+  ok = reader.blocks == blocks - 1 && reader.torn == 1;
+  munmap(data, length);
+
+  /* carry on writing after it, the next lap */
+  gps2_log_open(&log, path, 0);
+  ok = ok && log.sequence == blocks - 1;
+  for (n = 0; n < track_fix_count; n++) {
+    log_fix(n + (BENCH_LOG_FIXES / track_fix_count + 1) * track_fix_count, span_s, &fix);
+    gps2_log_add(&log, &fix);
+  }
+  gps2_log_close(&log);
+  data = map_log(path, &length);
+  gps2_log_reader_init(&reader, data, length);
+  ok = ok && reader.torn == 0 && gps2_log_reader_points(&reader) == points + track_fix_count;
+  munmap(data, length);
+  unlink(path);
+
+  printf("  torn last block: %zu of %zu blocks kept, %llu fixes, reopened and appended after them: %s\n",
+         blocks - 1, blocks, (unsigned long long) points, ok ? "ok" : "FAILED");
+}
+
+/* metres from p to the line segment a b, on a local flat projection */
+static double simplify_error(const struct mgos_gps_location_fixed *a, const struct mgos_gps_location_fixed *b,
+                             const struct mgos_gps_location_fixed *p) {
+  double metres = 6371000.0 * M_PI / 180 / 1e7;
+  double east = metres * cos(a->latitude_e7 / 1e7 * M_PI / 180);
+  double bx = (b->longitude_e7 - a->longitude_e7) * east;
+  double by = (b->latitude_e7 - a->latitude_e7) * metres;
+  double px = (p->longitude_e7 - a->longitude_e7) * east;
+  double py = (p->latitude_e7 - a->latitude_e7) * metres;
+  double length2 = bx * bx + by * by;
+  double t = length2 > 0 ? (px * bx + py * by) / length2 : 0;
+
+  if (t < 0) t = 0;
+  if (t > 1) t = 1;
+  return hypot(px - t * bx, py - t * by);
+}
+
+static void bench_simplify(int repeat) {
+  static const int tolerances[] = {1, 3, 10, 30};
+  struct gps2_simplify simplify;
+  struct mgos_gps_location_fixed out;
+  struct mgos_gps_location_fixed *kept;
+  struct mgos_host_alloc_stats allocs;
+  size_t kept_count;
+  size_t i;
+  size_t k;
+  size_t t;
+  double start;
+  double elapsed;
+  double error;
+  double max_error;
+  int r;
+
+  if (track_fix_count == 0) return;
+  kept = malloc(track_fix_count * sizeof(struct mgos_gps_location_fixed));
+  if (kept == NULL) return;
+
+  printf("\nTrack simplification, %zu fixes, a point at least every %d s\n", track_fix_count,
+         BENCH_SIMPLIFY_HEARTBEAT_MS / 1000);
+  printf("  tolerance     kept   kept/fix  reduction     ns/fix  max error  allocs/fix\n");
+  for (t = 0; t < sizeof(tolerances) / sizeof(tolerances[0]); t++) {
+    mgos_host_reset_alloc_stats();
+    start = now_seconds();
+    for (r = 0; r < repeat; r++) {
+      gps2_simplify_init(&simplify, tolerances[t], BENCH_SIMPLIFY_HEARTBEAT_MS);
+      for (i = 0; i < track_fix_count; i++) gps2_simplify_add(&simplify, &track_fixes[i], &out);
+      gps2_simplify_flush(&simplify, &out);
+    }
+    elapsed = now_seconds() - start;
+    mgos_host_get_alloc_stats(&allocs);
+
+    /* every fix dropped lies near the line between the points kept either side of it */
+    gps2_simplify_init(&simplify, tolerances[t], BENCH_SIMPLIFY_HEARTBEAT_MS);
+    kept_count = 0;
+    for (i = 0; i < track_fix_count; i++) {
+      if (gps2_simplify_add(&simplify, &track_fixes[i], &out)) kept[kept_count++] = out;
+    }
+    if (gps2_simplify_flush(&simplify, &out)) kept[kept_count++] = out;
+    max_error = 0;
+    for (i = 0, k = 0; i < track_fix_count && k + 1 < kept_count; i++) {
+      while (k + 2 < kept_count && kept[k + 1].time <= track_fixes[i].time) k++;
+      error = simplify_error(&kept[k], &kept[k + 1], &track_fixes[i]);
+      if (error > max_error) max_error = error;
+    }
+
+    printf("  %7d m %8zu %10.4f %9.1fx %10.1f %8.2f m %11.3f\n", tolerances[t], kept_count,
+           (double) kept_count / track_fix_count, (double) track_fix_count / kept_count,
+           elapsed * 1e9 / (repeat * track_fix_count), max_error, (double) allocs.allocs / (repeat * track_fix_count));
+  }
+  free(kept);
+}
+
+/* ########################################################################### */
+/* RPC handlers, called through the host stand-in */
+
+static void bench_rpc(int repeat) {
+  static const char *methods[] = {"gps.navigation", "gps.fix", "gps.sky", "gps.stats"};
+  static char response[4096];
+  struct mgos_host_alloc_stats allocs;
+  double start;
+  double elapsed;
+  int calls = BENCH_RPC_CALLS * repeat;
+  int status = 0;
+  size_t m;
+  int i;
+
+  printf("\nRPC handlers, %d calls each\n", calls);
+  printf("  %-16s %12s %10s %8s %8s\n", "method", "calls/s", "ns/call", "allocs", "bytes");
+  for (m = 0; m < sizeof(methods) / sizeof(methods[0]); m++) {
+    mgos_host_reset_alloc_stats();
+    start = now_seconds();
+    for (i = 0; i < calls; i++) status = mgos_host_rpc_call(methods[m], "{}", response, sizeof(response));
+    elapsed = now_seconds() - start;
+    mgos_host_get_alloc_stats(&allocs);
+    if (status != 0) {
+      printf("  %-16s error %d: %s\n", methods[m], status, response);
+      continue;
+    }
+    printf("  %-16s %12.0f %10.1f %8llu %8zu\n", methods[m], calls / elapsed, elapsed * 1e9 / calls,
+           (unsigned long long) allocs.allocs, strlen(response));
+  }
+  mgos_host_rpc_call("gps.fix", "{}", response, sizeof(response));
+  printf("  gps.fix: %s\n", response);
+}
+
+int main(int argc, char **argv) {
+  struct corpus corpus = {NULL, 0};
+  struct corpus ubx = {NULL, 0};
+  struct mgos_uart_config ucfg;
+  struct gps2 *dev;
+  int uart_no;
+  int repeat = 5;
+  size_t chunk = 64;
+  int files = 0;
+  int i;
+  uint64_t sentence_mask = GPS2_SENTENCE_MASK_ALL;
+  bool sky_view = false;
+  bool stats = false;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--chunk") == 0 && i + 1 < argc) {
+      chunk = (size_t) atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--sentences") == 0 && i + 1 < argc) {
+      if (!parse_sentence_mask(argv[++i], &sentence_mask)) {
+        fprintf(stderr, "unknown sentence type in %s\n", argv[i]);
+        return 2;
+      }
+    } else if (strcmp(argv[i], "--sky") == 0) {
+      sky_view = true;
+    } else if (strcmp(argv[i], "--devices") == 0 && i + 1 < argc) {
+      bench_devices = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      stats = true;
+    } else if (strcmp(argv[i], "--ubx") == 0 && i + 1 < argc) {
+      if (!load_corpus(argv[++i], &ubx)) return 1;
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "usage: %s [--repeat N] [--chunk BYTES] [--sentences RMC,GGA,...] [--sky] [--stats] [--devices N] "
+              "[--ubx file.ubx] [file.nmea ...]\n", argv[0]);
+      return 2;
+    } else {
+      if (!load_corpus(argv[i], &corpus)) return 1;
+      files++;
+    }
+  }
+  if (files == 0 && !load_corpus("corpus/drive.nmea", &corpus)) return 1;
+  if (repeat < 1 || chunk < 1 || bench_devices < 1 || bench_devices > MGOS_HOST_UART_COUNT) return 2;
+
+  printf("Corpus: %zu bytes\n", corpus.len);
+
+  /* bring the driver up the way the firmware does, from sys config */
+  mgos_gps2_init();
+  dev = gps2_get_global_device();
+  if (dev == NULL) {
+    fprintf(stderr, "failed to create the gps2 device\n");
+    return 1;
+  }
+
+  mgos_event_add_handler(MGOS_EV_GPS_NMEA_SENTENCE, sentence_handler, NULL);
+  mgos_event_add_handler(MGOS_EV_GPS_LOCATION, location_handler, NULL);
+  mgos_event_add_handler(MGOS_EV_GPS_FIX, fix_handler, NULL);
+  mgos_event_add_handler(MGOS_EV_GPS_SKY_VIEW, sky_view_handler, NULL);
+
+  /* more receivers on the other UARTs */
+  bench_uarts[0] = BENCH_UART_NO;
+  for (i = 1, uart_no = 0; i < bench_devices; i++, uart_no++) {
+    if (uart_no == BENCH_UART_NO) uart_no++;
+    mgos_uart_config_set_defaults(uart_no, &ucfg);
+    ucfg.baud_rate = 9600;
+    if (gps2_create_uart(uart_no, &ucfg) == NULL) {
+      fprintf(stderr, "failed to create a gps2 device on UART%d\n", uart_no);
+      return 1;
+    }
+    bench_uarts[i] = uart_no;
+  }
+  for (i = 0; i < bench_devices; i++) {
+    gps2_set_device_sentence_mask(gps2_get_device_by_uart(bench_uarts[i]), sentence_mask);
+    gps2_set_device_sky_view(gps2_get_device_by_uart(bench_uarts[i]), sky_view);
+  }
+
+  bench_driver(dev, &corpus, repeat, chunk, stats);
+  if (ubx.len > 0) bench_ubx(&corpus, &ubx, repeat, chunk);
+  bench_parser(&corpus, repeat);
+  bench_rpc(repeat);
+  bench_pmtk(dev, repeat);
+  bench_batch(dev, &corpus);
+  bench_track(dev, &corpus, repeat);
+  bench_log(repeat);
+  bench_simplify(repeat);
+
+  free(track_fixes);
+  free(corpus.data);
+  free(ubx.data);
+  return 0;
+}
@@ -0,0 +1,207 @@
+#!/usr/bin/env python3
+"""Generate a synthetic NMEA recording of a drive for the host benchmarks.
+
+The track is a mix of straight roads, bends, junction turns and stops so that
+the location pipeline sees realistic variation. Every epoch has RMC, GGA, GSA,
+VTG and GST, with GSV bursts for GPS and GLONASS and a ZDA once a second. A few
+lines have corrupted checksums and there is the occasional PMTK sentence, as in
+real recordings.
+
+With --ubx, the same drive is also written as u-blox UBX, a NAV-PVT every epoch
+and a NAV-SAT once a second, to compare the two on the same track.
+
+usage: make_drive.py [--minutes N] [--rate HZ] [--seed S] [--ubx drive.ubx] > drive.nmea
+"""
+
+import argparse
+import datetime
+import math
+import random
+import struct
+import sys
+
+
+def checksum(body):
+    value = 0
+    for c in body:
+        value ^= ord(c)
+    return value
+
+
+def sentence(body):
+    return "$%s*%02X\r\n" % (body, checksum(body))
+
+
+def nmea_coord(value, is_latitude):
+    hemisphere = ("N" if value >= 0 else "S") if is_latitude else ("E" if value >= 0 else "W")
+    value = abs(value)
+    degrees = int(value)
+    minutes = (value - degrees) * 60
+    if is_latitude:
+        return "%02d%08.5f" % (degrees, minutes), hemisphere
+    return "%03d%08.5f" % (degrees, minutes), hemisphere
+
+
+def ubx(msg_class, msg_id, payload):
+    body = struct.pack("<BBH", msg_class, msg_id, len(payload)) + payload
+    ck_a = ck_b = 0
+    for b in body:
+        ck_a = (ck_a + b) & 0xFF
+        ck_b = (ck_b + ck_a) & 0xFF
+    return b"\xb5\x62" + body + bytes((ck_a, ck_b))
+
+
+def nav_pvt(when, drive, satellites, h_acc, v_acc):
+    itow = ((when.weekday() + 1) % 7 * 86400 + when.hour * 3600 + when.minute * 60 + when.second) * 1000 \
+        + when.microsecond // 1000
+    heading = math.radians(drive.heading)
+    payload = struct.pack(
+        "<IHBBBBBBIiBBBBiiiiIIiiiiiIIHBBBBBBiHH",
+        itow, when.year, when.month, when.day, when.hour, when.minute, when.second,
+        0x07,  # valid date, time, fully resolved
+        20, when.microsecond * 1000,
+        3, 0x01, 0, satellites,  # 3D, gnssFixOK
+        round(drive.longitude * 1e7), round(drive.latitude * 1e7),
+        round((drive.altitude + 47.0) * 1000), round(drive.altitude * 1000),
+        round(h_acc * 1000), round(v_acc * 1000),
+        round(drive.speed * math.cos(heading) * 1000), round(drive.speed * math.sin(heading) * 1000), 0,
+        round(drive.speed * 1000), round(drive.heading * 1e5),
+        300, 50000, 162,
+        0, 0, 0, 0, 0, 0,
+        round(drive.heading * 1e5), 0, 0)
+    return ubx(0x01, 0x07, payload)
+
+
+def nav_sat(when, sats):
+    """sats are (gnss_id, sv_id, elevation, azimuth, cno, used)"""
+    itow = ((when.weekday() + 1) % 7 * 86400 + when.hour * 3600 + when.minute * 60 + when.second) * 1000
+    payload = struct.pack("<IBBH", itow, 1, len(sats), 0)
+    for gnss_id, sv_id, elevation, azimuth, cno, used in sats:
+        payload += struct.pack("<BBBbhhI", gnss_id, sv_id, cno, elevation, azimuth, 0, 0x07 | (0x08 if used else 0))
+    return ubx(0x01, 0x35, payload)
+
+
+class Drive:
+    """Simple kinematic model: segments of constant turn rate and target speed."""
+
+    def __init__(self, rng):
+        self.rng = rng
+        self.latitude = 51.752021
+        self.longitude = -1.257726
+        self.altitude = 72.0
+        self.heading = 87.0
+        self.speed = 0.0  # m/s
+        self.segment_left = 0.0
+        self.turn_rate = 0.0
+        self.target_speed = 0.0
+
+    def new_segment(self):
+        kind = self.rng.random()
+        if kind < 0.45:
+            # straight road
+            self.turn_rate = 0.0
+            self.target_speed = self.rng.choice([13.4, 17.9, 22.4, 31.3])
+            self.segment_left = self.rng.uniform(20, 120)
+        elif kind < 0.75:
+            # gentle bend
+            self.turn_rate = self.rng.uniform(-4, 4)
+            self.target_speed = self.rng.choice([13.4, 17.9, 22.4])
+            self.segment_left = self.rng.uniform(8, 30)
+        elif kind < 0.9:
+            # junction turn
+            self.turn_rate = self.rng.choice([-1, 1]) * self.rng.uniform(12, 20)
+            self.target_speed = 6.0
+            self.segment_left = self.rng.uniform(4, 7)
+        else:
+            # stopped at lights
+            self.turn_rate = 0.0
+            self.target_speed = 0.0
+            self.segment_left = self.rng.uniform(10, 45)
+
+    def step(self, dt):
+        if self.segment_left <= 0:
+            self.new_segment()
+        self.segment_left -= dt
+        accel = max(-3.0, min(2.0, self.target_speed - self.speed))
+        self.speed = max(0.0, self.speed + accel * dt)
+        if self.speed > 0.5:
+            self.heading = (self.heading + self.turn_rate * dt) % 360
+        distance = self.speed * dt
+        self.latitude += distance * math.cos(math.radians(self.heading)) / 111320.0
+        self.longitude += distance * math.sin(math.radians(self.heading)) / (
+            111320.0 * math.cos(math.radians(self.latitude)))
+        self.altitude += self.rng.uniform(-0.05, 0.05) * distance
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--minutes", type=float, default=60)
+    parser.add_argument("--rate", type=int, default=1, help="fixes per second")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--ubx", help="also write the drive as UBX to this file")
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    drive = Drive(rng)
+    when = datetime.datetime(2020, 6, 5, 21, 47, 25)
+    dt = 1.0 / args.rate
+    out = sys.stdout
+    ubx_out = open(args.ubx, "wb") if args.ubx else None
+    gps_sats = [(2, 62, 128), (5, 45, 301), (6, 13, 35), (12, 71, 225), (13, 30, 95),
+                (15, 22, 160), (17, 8, 320), (19, 55, 50), (24, 40, 270), (25, 5, 190), (29, 18, 10)]
+    glonass_sats = [(65, 33, 88), (66, 58, 140), (72, 20, 300), (74, 47, 12), (75, 11, 230), (81, 66, 190)]
+
+    for epoch in range(int(args.minutes * 60 * args.rate)):
+        drive.step(dt)
+        hms = when.strftime("%H%M%S") + ".%02d" % (when.microsecond // 10000)
+        dmy = when.strftime("%d%m%y")
+        lat, ns = nmea_coord(drive.latitude, True)
+        lon, ew = nmea_coord(drive.longitude, False)
+        knots = drive.speed * 1.943844
+        used = [s[0] for s in gps_sats[:8]]
+        hdop = 0.9 + rng.uniform(-0.1, 0.2)
+        lines = [
+            sentence("GPRMC,%s,A,%s,%s,%s,%s,%.3f,%.2f,%s,,,A" % (hms, lat, ns, lon, ew, knots, drive.heading, dmy)),
+            sentence("GPVTG,%.2f,T,,M,%.3f,N,%.3f,K,A" % (drive.heading, knots, drive.speed * 3.6)),
+            sentence("GPGGA,%s,%s,%s,%s,%s,1,%02d,%.2f,%.1f,M,47.0,M,," % (hms, lat, ns, lon, ew, len(used), hdop, drive.altitude)),
+            sentence("GPGSA,A,3,%s,1.62,%.2f,1.29" % (",".join(["%02d" % s for s in used] + [""] * (12 - len(used))), hdop)),
+        ]
+        ubx_sats = []
+        if when.microsecond == 0:
+            for talker, sats in (("GP", gps_sats), ("GL", glonass_sats)):
+                total = (len(sats) + 3) // 4
+                for msg in range(total):
+                    chunk = sats[msg * 4:msg * 4 + 4]
+                    snrs = [rng.randint(18, 45) for _ in chunk]
+                    fields = ",".join("%02d,%02d,%03d,%02d" % (prn, el, az, snr) for (prn, el, az), snr in zip(chunk, snrs))
+                    lines.append(sentence("%sGSV,%d,%d,%02d,%s" % (talker, total, msg + 1, len(sats), fields)))
+                    for (prn, el, az), snr in zip(chunk, snrs):
+                        if talker == "GP":
+                            ubx_sats.append((0, prn, el, az, snr, prn in used))
+                        else:
+                            ubx_sats.append((6, prn - 64, el, az, snr, False))
+            lines.append(sentence("GPZDA,%s,%s,%s,%s,00,00" % (hms, when.strftime("%d"), when.strftime("%m"), when.strftime("%Y"))))
+        rms = rng.uniform(5, 15)
+        latitude_error = rng.uniform(1.5, 3)
+        longitude_error = rng.uniform(1.5, 3)
+        altitude_error = rng.uniform(2.5, 5)
+        lines.append(sentence("GPGST,%s,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f" % (
+            hms, rms, 2.1, 1.6, 88.0, latitude_error, longitude_error, altitude_error)))
+        if rng.random() < 0.002:
+            lines.append(sentence("PMTK001,314,3"))
+        for line in lines:
+            if rng.random() < 0.002:
+                # corrupted on the wire
+                line = line[:10] + chr(ord(line[10]) ^ 0x04) + line[11:]
+            out.write(line)
+        if ubx_out:
+            ubx_out.write(nav_pvt(when, drive, len(used), max(latitude_error, longitude_error), altitude_error))
+            if ubx_sats:
+                ubx_out.write(nav_sat(when, ubx_sats))
+        when += datetime.timedelta(seconds=dt)
+    if ubx_out:
+        ubx_out.close()
+
+
+if __name__ == "__main__":
+    main()
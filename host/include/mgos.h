@@ -0,0 +1,151 @@
+/*
+ * Host stand-in for the parts of the Mongoose OS API used by gps2. This is
+ * just enough to build src/gps2.c and src/minmea.c on a workstation for
+ * benchmarking and replay, see "Host build and benchmark" in README.md and
+ * host/Makefile. It is not part of the library.
+ */
+
+#ifndef GPS2_HOST_MGOS_H
+#define GPS2_HOST_MGOS_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* logging */
+
+enum cs_log_level {
+  LL_NONE = -1,
+  LL_ERROR = 0,
+  LL_WARN = 1,
+  LL_INFO = 2,
+  LL_DEBUG = 3,
+  LL_VERBOSE_DEBUG = 4
+};
+
+extern enum cs_log_level mgos_host_log_level;
+
+#define LOG(l, x)                          \
+  do {                                     \
+    if ((l) <= mgos_host_log_level) {      \
+      printf x;                            \
+      putchar('\n');                       \
+    }                                      \
+  } while (0)
+
+/* strings and buffers */
+
+struct mg_str {
+  const char *p;
+  size_t len;
+};
+
+struct mg_str mg_mk_str(const char *s);
+struct mg_str mg_mk_str_n(const char *s, size_t len);
+const char *mg_strstr(struct mg_str haystack, struct mg_str needle);
+struct mg_str mg_strdup_nul(struct mg_str s);
+void mg_strfree(struct mg_str *s);
+
+struct mbuf {
+  char *buf;
+  size_t size;
+  size_t len;
+};
+
+void mbuf_init(struct mbuf *mb, size_t initial_capacity);
+void mbuf_free(struct mbuf *mb);
+size_t mbuf_append(struct mbuf *mb, const void *data, size_t len);
+void mbuf_remove(struct mbuf *mb, size_t len);
+
+/* events */
+
+#define MGOS_EVENT_BASE(a, b, c) ((a) << 24 | (b) << 16 | (c) << 8)
+
+typedef void (*mgos_event_handler_t)(int ev, void *ev_data, void *userdata);
+
+bool mgos_event_register_base(int base_event_number, const char *name);
+bool mgos_event_add_handler(int ev, mgos_event_handler_t cb, void *userdata);
+bool mgos_event_remove_handler(int ev, mgos_event_handler_t cb, void *userdata);
+int mgos_event_trigger(int ev, void *ev_data);
+
+/* UART */
+
+enum mgos_uart_parity {
+  MGOS_UART_PARITY_NONE = 0,
+  MGOS_UART_PARITY_EVEN = 1,
+  MGOS_UART_PARITY_ODD = 2
+};
+
+enum mgos_uart_stop_bits {
+  MGOS_UART_STOP_BITS_1 = 1,
+  MGOS_UART_STOP_BITS_2 = 2,
+  MGOS_UART_STOP_BITS_1_5 = 3
+};
+
+struct mgos_uart_config {
+  int baud_rate;
+  int num_data_bits;
+  enum mgos_uart_parity parity;
+  enum mgos_uart_stop_bits stop_bits;
+  int rx_buf_size;
+  int tx_buf_size;
+};
+
+typedef void (*mgos_uart_dispatcher_t)(int uart_no, void *arg);
+
+void mgos_uart_config_set_defaults(int uart_no, struct mgos_uart_config *cfg);
+bool mgos_uart_configure(int uart_no, const struct mgos_uart_config *cfg);
+void mgos_uart_set_dispatcher(int uart_no, mgos_uart_dispatcher_t cb, void *arg);
+void mgos_uart_set_rx_enabled(int uart_no, bool enabled);
+size_t mgos_uart_read_avail(int uart_no);
+size_t mgos_uart_read(int uart_no, void *buf, size_t len);
+size_t mgos_uart_read_mbuf(int uart_no, struct mbuf *mb, size_t len);
+size_t mgos_uart_write_avail(int uart_no);
+size_t mgos_uart_write(int uart_no, const void *buf, size_t len);
+void mgos_uart_flush(int uart_no);
+void mgos_uart_schedule_dispatcher(int uart_no, bool from_isr);
+
+/* system configuration, see mos.yml */
+
+int mgos_sys_config_get_gps_uart_no(void);
+int mgos_sys_config_get_gps_uart_baud(void);
+int mgos_sys_config_get_gps_uart_autobaud(void);
+int mgos_sys_config_get_gps_uart_disconnect_timeout(void);
+int mgos_sys_config_get_gps_uart_rx_buffer_size(void);
+int mgos_sys_config_get_gps_uart_tx_buffer_size(void);
+
+/* time and timers */
+
+int64_t mgos_uptime_micros(void);
+double mgos_uptime(void);
+
+typedef uintptr_t mgos_timer_id;
+typedef void (*timer_callback)(void *param);
+
+#define MGOS_INVALID_TIMER_ID ((mgos_timer_id) 0)
+#define MGOS_TIMER_REPEAT 1
+
+mgos_timer_id mgos_set_timer(int msecs, int flags, timer_callback cb, void *cb_arg);
+void mgos_clear_timer(mgos_timer_id id);
+
+/* init */
+
+enum mgos_init_result {
+  MGOS_INIT_OK = 0,
+  MGOS_INIT_APP_INIT_FAILED = -2
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GPS2_HOST_MGOS_H */
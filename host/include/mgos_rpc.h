@@ -0,0 +1,47 @@
+/* Host stand-in, see mgos.h. Handlers are called directly by
+   mgos_host_rpc_call(), there is no transport. */
+
+#ifndef GPS2_HOST_MGOS_RPC_H
+#define GPS2_HOST_MGOS_RPC_H
+
+#include "mgos.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mg_rpc;
+
+struct mg_rpc_request_info {
+  struct mg_rpc *rpc;
+  struct mg_str method;
+
+  /* where the response goes, see mgos_host_rpc_call() */
+  char *response;
+  size_t response_size;
+  int error_code;
+  bool responded;
+};
+
+struct mg_rpc_frame_info {
+  const char *channel_type;
+  bool channel_is_trusted;
+};
+
+typedef void (*mg_handler_cb_t)(struct mg_rpc_request_info *ri, void *cb_arg, struct mg_rpc_frame_info *fi,
+                                struct mg_str args);
+
+struct mg_rpc *mgos_rpc_get_global(void);
+
+void mg_rpc_add_handler(struct mg_rpc *c, const char *method, const char *args_fmt, mg_handler_cb_t cb,
+                        void *cb_arg);
+
+/* printf formats only, not the json_printf extensions */
+bool mg_rpc_send_responsef(struct mg_rpc_request_info *ri, const char *result_json_fmt, ...);
+bool mg_rpc_send_errorf(struct mg_rpc_request_info *ri, int error_code, const char *error_msg_fmt, ...);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GPS2_HOST_MGOS_RPC_H */
@@ -0,0 +1,8 @@
+/* Host stand-in, see mgos.h. */
+
+#ifndef GPS2_HOST_MGOS_TIME_H
+#define GPS2_HOST_MGOS_TIME_H
+
+#include "mgos.h"
+
+#endif /* GPS2_HOST_MGOS_TIME_H */
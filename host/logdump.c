@@ -0,0 +1,123 @@
+/*
+ * Reads a binary fix log written by gps2_set_device_log or gps2_replay --log.
+ *
+ * The file is memory mapped and read in place with the gps2_log.h reader, so
+ * it takes no copy of the log however many fixes it holds. The fixes are
+ * written to stdout as CSV, from --from T (UTC seconds since the epoch) if
+ * given, and a summary of the blocks, including any torn at the end, to
+ * stderr. --summary skips the CSV.
+ *
+ * usage: gps2_logdump [--from T] [--summary] file.log
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mgos_host.h"
+#include "gps2_log.h"
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [--from T] [--summary] file.log\n", name);
+}
+
+static void print_point(const struct gps2_track_point *point) {
+  printf("%lld.%03d,%.7f,%.7f", (long long) (point->time_ms / 1000), (int) (point->time_ms % 1000),
+         point->latitude_e7 / 1e7, point->longitude_e7 / 1e7);
+  if (point->speed_e3 != MGOS_GPS_FIXED_UNKNOWN) {
+    printf(",%.3f", point->speed_e3 / 1e3);
+  } else {
+    printf(",");
+  }
+  if (point->bearing_e2 != MGOS_GPS_FIXED_UNKNOWN) {
+    printf(",%.2f\n", point->bearing_e2 / 1e2);
+  } else {
+    printf(",\n");
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *path = NULL;
+  bool have_from = false;
+  bool summary = false;
+  double from = 0;
+  struct stat st;
+  struct gps2_log_reader reader;
+  struct gps2_track_iter iter;
+  struct gps2_track_point point;
+  struct gps2_track_point first;
+  struct gps2_track_point last;
+  uint64_t printed = 0;
+  void *data = NULL;
+  int fd;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+      from = atof(argv[++i]);
+      have_from = true;
+    } else if (strcmp(argv[i], "--summary") == 0) {
+      summary = true;
+    } else if (argv[i][0] != '-' && path == NULL) {
+      path = argv[i];
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (path == NULL) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(path);
+    return 1;
+  }
+  if (st.st_size > 0) {
+    data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      perror(path);
+      return 1;
+    }
+    madvise(data, (size_t) st.st_size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  gps2_log_reader_init(&reader, data, (size_t) st.st_size);
+  fprintf(stderr, "%s: %zu blocks, %zu torn, %llu points", path, reader.blocks, reader.torn,
+          (unsigned long long) gps2_log_reader_points(&reader));
+
+  /* the ends of the log */
+  gps2_log_iter_init(&reader, &iter);
+  if (gps2_track_next(&iter, &first)) {
+    last = first;
+    while (gps2_track_next(&iter, &point)) {
+      last = point;
+    }
+    fprintf(stderr, ", %lld.%03d to %lld.%03d", (long long) (first.time_ms / 1000), (int) (first.time_ms % 1000),
+            (long long) (last.time_ms / 1000), (int) (last.time_ms % 1000));
+  }
+  fprintf(stderr, "\n");
+
+  if (!summary) {
+    if (have_from) {
+      gps2_log_seek(&reader, &iter, (int64_t) (from * 1000));
+    } else {
+      gps2_log_iter_init(&reader, &iter);
+    }
+    printf("time,latitude,longitude,speed_knots,bearing\n");
+    while (gps2_track_next(&iter, &point)) {
+      print_point(&point);
+      printed++;
+    }
+    fprintf(stderr, "%llu points written\n", (unsigned long long) printed);
+  }
+
+  if (data != NULL) {
+    munmap(data, (size_t) st.st_size);
+  }
+  return 0;
+}
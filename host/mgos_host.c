@@ -0,0 +1,529 @@
+/*
+ * Host stand-in for the parts of the Mongoose OS API used by gps2, see
+ * include/mgos.h and mgos_host.h.
+ */
+
+#include "mgos_host.h"
+#include "mgos_rpc.h"
+
+#include <malloc.h>
+#include <stdarg.h>
+
+enum cs_log_level mgos_host_log_level = LL_WARN;
+
+struct mgos_host_config mgos_host_config = {
+  .uart_no = 1,
+  .baud = 9600,
+  .autobaud = 0,
+  .disconnect_timeout = 0,
+  .rx_buffer_size = 512,
+  .tx_buffer_size = 128,
+};
+
+/* heap accounting. The linker sends the code under test to the __wrap_
+   functions, see the Makefile */
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static struct mgos_host_alloc_stats alloc_stats;
+
+static void count_alloc(void *ptr) {
+  if (ptr == NULL) return;
+  alloc_stats.allocs++;
+  alloc_stats.live_bytes += malloc_usable_size(ptr);
+  if (alloc_stats.live_bytes > alloc_stats.peak_live_bytes) {
+    alloc_stats.peak_live_bytes = alloc_stats.live_bytes;
+  }
+}
+
+static void count_free(void *ptr) {
+  if (ptr == NULL) return;
+  alloc_stats.frees++;
+  alloc_stats.live_bytes -= malloc_usable_size(ptr);
+}
+
+void *__wrap_malloc(size_t size) {
+  void *ptr = __real_malloc(size);
+  count_alloc(ptr);
+  return ptr;
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+  void *ptr = __real_calloc(nmemb, size);
+  count_alloc(ptr);
+  return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  void *new_ptr;
+  count_free(ptr);
+  new_ptr = __real_realloc(ptr, size);
+  count_alloc(new_ptr != NULL ? new_ptr : ptr);
+  return new_ptr;
+}
+
+void __wrap_free(void *ptr) {
+  count_free(ptr);
+  __real_free(ptr);
+}
+
+void mgos_host_get_alloc_stats(struct mgos_host_alloc_stats *stats) {
+  *stats = alloc_stats;
+}
+
+void mgos_host_reset_alloc_stats(void) {
+  size_t live_bytes = alloc_stats.live_bytes;
+  memset(&alloc_stats, 0, sizeof(alloc_stats));
+  alloc_stats.live_bytes = live_bytes;
+  alloc_stats.peak_live_bytes = live_bytes;
+}
+
+/* strings and buffers */
+
+struct mg_str mg_mk_str(const char *s) {
+  return mg_mk_str_n(s, s != NULL ? strlen(s) : 0);
+}
+
+struct mg_str mg_mk_str_n(const char *s, size_t len) {
+  struct mg_str str = {s, len};
+  return str;
+}
+
+const char *mg_strstr(struct mg_str haystack, struct mg_str needle) {
+  size_t i;
+  if (needle.len > haystack.len) return NULL;
+  for (i = 0; i <= haystack.len - needle.len; i++) {
+    if (memcmp(haystack.p + i, needle.p, needle.len) == 0) return haystack.p + i;
+  }
+  return NULL;
+}
+
+struct mg_str mg_strdup_nul(struct mg_str s) {
+  struct mg_str r = {NULL, 0};
+  char *copy = malloc(s.len + 1);
+  if (copy == NULL) return r;
+  memcpy(copy, s.p, s.len);
+  copy[s.len] = '\0';
+  r.p = copy;
+  r.len = s.len;
+  return r;
+}
+
+void mg_strfree(struct mg_str *s) {
+  free((void *) s->p);
+  s->p = NULL;
+  s->len = 0;
+}
+
+void mbuf_init(struct mbuf *mb, size_t initial_capacity) {
+  mb->buf = initial_capacity > 0 ? malloc(initial_capacity) : NULL;
+  mb->size = mb->buf != NULL ? initial_capacity : 0;
+  mb->len = 0;
+}
+
+void mbuf_free(struct mbuf *mb) {
+  free(mb->buf);
+  mb->buf = NULL;
+  mb->size = mb->len = 0;
+}
+
+size_t mbuf_append(struct mbuf *mb, const void *data, size_t len) {
+  if (mb->len + len > mb->size) {
+    size_t new_size = (mb->len + len) * 3 / 2;
+    char *p = realloc(mb->buf, new_size);
+    if (p == NULL) return 0;
+    mb->buf = p;
+    mb->size = new_size;
+  }
+  memcpy(mb->buf + mb->len, data, len);
+  mb->len += len;
+  return len;
+}
+
+void mbuf_remove(struct mbuf *mb, size_t len) {
+  if (len > mb->len) len = mb->len;
+  memmove(mb->buf, mb->buf + len, mb->len - len);
+  mb->len -= len;
+}
+
+/* events */
+
+#define MGOS_HOST_MAX_HANDLERS 64
+
+static struct {
+  int ev;
+  mgos_event_handler_t cb;
+  void *userdata;
+} event_handlers[MGOS_HOST_MAX_HANDLERS];
+
+static int event_handler_count;
+
+bool mgos_event_register_base(int base_event_number, const char *name) {
+  (void) base_event_number;
+  (void) name;
+  return true;
+}
+
+bool mgos_event_add_handler(int ev, mgos_event_handler_t cb, void *userdata) {
+  if (event_handler_count == MGOS_HOST_MAX_HANDLERS) return false;
+  event_handlers[event_handler_count].ev = ev;
+  event_handlers[event_handler_count].cb = cb;
+  event_handlers[event_handler_count].userdata = userdata;
+  event_handler_count++;
+  return true;
+}
+
+bool mgos_event_remove_handler(int ev, mgos_event_handler_t cb, void *userdata) {
+  int i;
+  for (i = 0; i < event_handler_count; i++) {
+    if (event_handlers[i].ev == ev && event_handlers[i].cb == cb &&
+        event_handlers[i].userdata == userdata) {
+      memmove(&event_handlers[i], &event_handlers[i + 1],
+              (event_handler_count - i - 1) * sizeof(event_handlers[0]));
+      event_handler_count--;
+      return true;
+    }
+  }
+  return false;
+}
+
+int mgos_event_trigger(int ev, void *ev_data) {
+  int i;
+  int count = 0;
+  for (i = 0; i < event_handler_count; i++) {
+    if (event_handlers[i].ev == ev) {
+      event_handlers[i].cb(ev, ev_data, event_handlers[i].userdata);
+      count++;
+    }
+  }
+  return count;
+}
+
+/* RPC */
+
+#define MGOS_HOST_MAX_RPC_HANDLERS 32
+
+static struct {
+  const char *method;
+  mg_handler_cb_t cb;
+  void *cb_arg;
+} rpc_handlers[MGOS_HOST_MAX_RPC_HANDLERS];
+
+static int rpc_handler_count;
+
+/* only ever compared with NULL */
+static struct mg_rpc *host_rpc = (struct mg_rpc *) &rpc_handlers;
+
+struct mg_rpc *mgos_rpc_get_global(void) {
+  return host_rpc;
+}
+
+void mg_rpc_add_handler(struct mg_rpc *c, const char *method, const char *args_fmt, mg_handler_cb_t cb,
+                        void *cb_arg) {
+  (void) c;
+  (void) args_fmt;
+  if (rpc_handler_count == MGOS_HOST_MAX_RPC_HANDLERS) return;
+  rpc_handlers[rpc_handler_count].method = method;
+  rpc_handlers[rpc_handler_count].cb = cb;
+  rpc_handlers[rpc_handler_count].cb_arg = cb_arg;
+  rpc_handler_count++;
+}
+
+static bool rpc_vrespond(struct mg_rpc_request_info *ri, int error_code, const char *fmt, va_list ap) {
+  if (ri->responded) return false;
+  ri->responded = true;
+  ri->error_code = error_code;
+  if (ri->response_size > 0) vsnprintf(ri->response, ri->response_size, fmt, ap);
+  return true;
+}
+
+bool mg_rpc_send_responsef(struct mg_rpc_request_info *ri, const char *result_json_fmt, ...) {
+  va_list ap;
+  bool ret;
+  va_start(ap, result_json_fmt);
+  ret = rpc_vrespond(ri, 0, result_json_fmt, ap);
+  va_end(ap);
+  return ret;
+}
+
+bool mg_rpc_send_errorf(struct mg_rpc_request_info *ri, int error_code, const char *error_msg_fmt, ...) {
+  va_list ap;
+  bool ret;
+  va_start(ap, error_msg_fmt);
+  ret = rpc_vrespond(ri, error_code, error_msg_fmt, ap);
+  va_end(ap);
+  return ret;
+}
+
+int mgos_host_rpc_call(const char *method, const char *args, char *response, size_t size) {
+  struct mg_rpc_request_info ri;
+  struct mg_rpc_frame_info fi = {"host", true};
+  int i;
+
+  for (i = 0; i < rpc_handler_count; i++) {
+    if (strcmp(rpc_handlers[i].method, method) == 0) break;
+  }
+  if (i == rpc_handler_count) return 404;
+
+  memset(&ri, 0, sizeof(ri));
+  ri.rpc = host_rpc;
+  ri.method = mg_mk_str(method);
+  ri.response = response;
+  ri.response_size = size;
+  rpc_handlers[i].cb(&ri, rpc_handlers[i].cb_arg, &fi, mg_mk_str(args != NULL ? args : ""));
+  return ri.responded ? ri.error_code : 500;
+}
+
+/* UART. Each UART has fixed rx and tx buffers standing in for the driver's
+   hardware buffers */
+
+struct host_uart {
+  struct mgos_uart_config config;
+  mgos_uart_dispatcher_t dispatcher;
+  void *dispatcher_arg;
+  bool rx_enabled;
+  bool in_dispatcher;
+  int line_baud;
+  uint32_t noise; /* garbles bytes at the wrong baud rate */
+
+  char rx[MGOS_HOST_UART_RX_SIZE];
+  size_t rx_head;
+  size_t rx_len;
+  size_t rx_peak;
+
+  char tx[MGOS_HOST_UART_TX_SIZE];
+  size_t tx_len;
+};
+
+static struct host_uart uarts[MGOS_HOST_UART_COUNT];
+
+static struct host_uart *get_uart(int uart_no) {
+  assert(uart_no >= 0 && uart_no < MGOS_HOST_UART_COUNT);
+  return &uarts[uart_no];
+}
+
+void mgos_uart_config_set_defaults(int uart_no, struct mgos_uart_config *cfg) {
+  (void) uart_no;
+  memset(cfg, 0, sizeof(*cfg));
+  cfg->baud_rate = 115200;
+  cfg->num_data_bits = 8;
+  cfg->parity = MGOS_UART_PARITY_NONE;
+  cfg->stop_bits = MGOS_UART_STOP_BITS_1;
+  cfg->rx_buf_size = 256;
+  cfg->tx_buf_size = 256;
+}
+
+bool mgos_uart_configure(int uart_no, const struct mgos_uart_config *cfg) {
+  if (uart_no < 0 || uart_no >= MGOS_HOST_UART_COUNT || cfg->baud_rate <= 0) return false;
+  get_uart(uart_no)->config = *cfg;
+  return true;
+}
+
+const struct mgos_uart_config *mgos_host_uart_config(int uart_no) {
+  return &get_uart(uart_no)->config;
+}
+
+void mgos_uart_set_dispatcher(int uart_no, mgos_uart_dispatcher_t cb, void *arg) {
+  struct host_uart *uart = get_uart(uart_no);
+  uart->dispatcher = cb;
+  uart->dispatcher_arg = arg;
+}
+
+void mgos_uart_set_rx_enabled(int uart_no, bool enabled) {
+  get_uart(uart_no)->rx_enabled = enabled;
+}
+
+size_t mgos_uart_read_avail(int uart_no) {
+  return get_uart(uart_no)->rx_len;
+}
+
+size_t mgos_uart_read(int uart_no, void *buf, size_t len) {
+  struct host_uart *uart = get_uart(uart_no);
+  size_t i;
+  if (len > uart->rx_len) len = uart->rx_len;
+  for (i = 0; i < len; i++) {
+    ((char *) buf)[i] = uart->rx[(uart->rx_head + i) % MGOS_HOST_UART_RX_SIZE];
+  }
+  uart->rx_head = (uart->rx_head + len) % MGOS_HOST_UART_RX_SIZE;
+  uart->rx_len -= len;
+  return len;
+}
+
+size_t mgos_uart_read_mbuf(int uart_no, struct mbuf *mb, size_t len) {
+  char buf[256];
+  size_t total = 0;
+  size_t n;
+  while (total < len) {
+    n = mgos_uart_read(uart_no, buf, len - total < sizeof(buf) ? len - total : sizeof(buf));
+    if (n == 0) break;
+    mbuf_append(mb, buf, n);
+    total += n;
+  }
+  return total;
+}
+
+size_t mgos_uart_write_avail(int uart_no) {
+  return MGOS_HOST_UART_TX_SIZE - get_uart(uart_no)->tx_len;
+}
+
+size_t mgos_uart_write(int uart_no, const void *buf, size_t len) {
+  struct host_uart *uart = get_uart(uart_no);
+  if (len > MGOS_HOST_UART_TX_SIZE - uart->tx_len) len = MGOS_HOST_UART_TX_SIZE - uart->tx_len;
+  memcpy(uart->tx + uart->tx_len, buf, len);
+  uart->tx_len += len;
+  return len;
+}
+
+void mgos_uart_flush(int uart_no) {
+  (void) uart_no;
+}
+
+static void run_dispatcher(struct host_uart *uart, int uart_no) {
+  /* the real dispatcher is never re-entered */
+  if (uart->dispatcher == NULL || uart->in_dispatcher) return;
+  uart->in_dispatcher = true;
+  uart->dispatcher(uart_no, uart->dispatcher_arg);
+  uart->in_dispatcher = false;
+}
+
+void mgos_uart_schedule_dispatcher(int uart_no, bool from_isr) {
+  (void) from_isr;
+  run_dispatcher(get_uart(uart_no), uart_no);
+}
+
+void mgos_host_uart_set_line_baud(int uart_no, int baud) {
+  get_uart(uart_no)->line_baud = baud;
+}
+
+int mgos_host_uart_line_baud(int uart_no) {
+  return get_uart(uart_no)->line_baud;
+}
+
+size_t mgos_host_uart_receive(int uart_no, const void *data, size_t len) {
+  struct host_uart *uart = get_uart(uart_no);
+  bool garbled = uart->line_baud != 0 && uart->line_baud != uart->config.baud_rate;
+  char c;
+  size_t i;
+  if (!uart->rx_enabled) return len;
+  if (len > MGOS_HOST_UART_RX_SIZE - uart->rx_len) len = MGOS_HOST_UART_RX_SIZE - uart->rx_len;
+  for (i = 0; i < len; i++) {
+    c = ((const char *) data)[i];
+    if (garbled) {
+      uart->noise = uart->noise * 1103515245 + 12345;
+      c ^= (char) (uart->noise >> 16);
+    }
+    uart->rx[(uart->rx_head + uart->rx_len + i) % MGOS_HOST_UART_RX_SIZE] = c;
+  }
+  uart->rx_len += len;
+  if (uart->rx_len > uart->rx_peak) uart->rx_peak = uart->rx_len;
+  run_dispatcher(uart, uart_no);
+  return len;
+}
+
+size_t mgos_host_uart_rx_peak(int uart_no) {
+  return get_uart(uart_no)->rx_peak;
+}
+
+size_t mgos_host_uart_take_tx(int uart_no, void *buf, size_t len) {
+  struct host_uart *uart = get_uart(uart_no);
+  if (len > uart->tx_len) len = uart->tx_len;
+  memcpy(buf, uart->tx, len);
+  memmove(uart->tx, uart->tx + len, uart->tx_len - len);
+  uart->tx_len -= len;
+  if (len > 0) run_dispatcher(uart, uart_no);
+  return len;
+}
+
+/* system configuration */
+
+int mgos_sys_config_get_gps_uart_no(void) {
+  return mgos_host_config.uart_no;
+}
+
+int mgos_sys_config_get_gps_uart_baud(void) {
+  return mgos_host_config.baud;
+}
+
+int mgos_sys_config_get_gps_uart_autobaud(void) {
+  return mgos_host_config.autobaud;
+}
+
+int mgos_sys_config_get_gps_uart_disconnect_timeout(void) {
+  return mgos_host_config.disconnect_timeout;
+}
+
+int mgos_sys_config_get_gps_uart_rx_buffer_size(void) {
+  return mgos_host_config.rx_buffer_size;
+}
+
+int mgos_sys_config_get_gps_uart_tx_buffer_size(void) {
+  return mgos_host_config.tx_buffer_size;
+}
+
+/* time and timers */
+
+int64_t mgos_uptime_micros(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+double mgos_uptime(void) {
+  return mgos_uptime_micros() / 1000000.0;
+}
+
+#define MGOS_HOST_MAX_TIMERS 32
+
+static struct {
+  mgos_timer_id id;
+  int64_t due;
+  int period_ms; /* 0 for a one shot timer */
+  timer_callback cb;
+  void *cb_arg;
+} timers[MGOS_HOST_MAX_TIMERS];
+
+static mgos_timer_id next_timer_id = 1;
+
+mgos_timer_id mgos_set_timer(int msecs, int flags, timer_callback cb, void *cb_arg) {
+  int i;
+  for (i = 0; i < MGOS_HOST_MAX_TIMERS; i++) {
+    if (timers[i].id == MGOS_INVALID_TIMER_ID) {
+      timers[i].id = next_timer_id++;
+      timers[i].due = mgos_uptime_micros() + (int64_t) msecs * 1000;
+      timers[i].period_ms = (flags & MGOS_TIMER_REPEAT) ? msecs : 0;
+      timers[i].cb = cb;
+      timers[i].cb_arg = cb_arg;
+      return timers[i].id;
+    }
+  }
+  return MGOS_INVALID_TIMER_ID;
+}
+
+void mgos_clear_timer(mgos_timer_id id) {
+  int i;
+  if (id == MGOS_INVALID_TIMER_ID) return;
+  for (i = 0; i < MGOS_HOST_MAX_TIMERS; i++) {
+    if (timers[i].id == id) timers[i].id = MGOS_INVALID_TIMER_ID;
+  }
+}
+
+void mgos_host_run_timers(void) {
+  int64_t now = mgos_uptime_micros();
+  timer_callback cb;
+  void *cb_arg;
+  int i;
+  for (i = 0; i < MGOS_HOST_MAX_TIMERS; i++) {
+    if (timers[i].id == MGOS_INVALID_TIMER_ID || timers[i].due > now) continue;
+    cb = timers[i].cb;
+    cb_arg = timers[i].cb_arg;
+    if (timers[i].period_ms > 0) {
+      timers[i].due += (int64_t) timers[i].period_ms * 1000;
+    } else {
+      timers[i].id = MGOS_INVALID_TIMER_ID;
+    }
+    cb(cb_arg);
+  }
+}
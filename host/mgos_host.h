@@ -0,0 +1,68 @@
+/*
+ * Controls for the host stand-in of the Mongoose OS API, used by the
+ * benchmark and replay tools in this directory.
+ */
+
+#ifndef GPS2_HOST_MGOS_HOST_H
+#define GPS2_HOST_MGOS_HOST_H
+
+#include "mgos.h"
+
+#define MGOS_HOST_UART_COUNT 4
+
+/* size of the simulated UART hardware buffers */
+#define MGOS_HOST_UART_RX_SIZE 4096
+#define MGOS_HOST_UART_TX_SIZE 4096
+
+/* values returned by mgos_sys_config_get_gps_uart_*() */
+struct mgos_host_config {
+  int uart_no;
+  int baud;
+  int autobaud;
+  int disconnect_timeout;
+  int rx_buffer_size;
+  int tx_buffer_size;
+};
+
+extern struct mgos_host_config mgos_host_config;
+
+/* bytes received "on the wire". Appends what fits in the simulated rx buffer,
+   runs the UART dispatcher and returns the number of bytes accepted */
+size_t mgos_host_uart_receive(int uart_no, const void *data, size_t len);
+
+/* the baud rate the other end of the wire runs at. While the UART is configured
+   for a different rate, received bytes arrive garbled as they would on real
+   hardware. 0, the default, always matches */
+void mgos_host_uart_set_line_baud(int uart_no, int baud);
+int mgos_host_uart_line_baud(int uart_no);
+
+/* most bytes that have been waiting in the simulated rx buffer */
+size_t mgos_host_uart_rx_peak(int uart_no);
+
+/* take up to len bytes the driver has written to the UART. Returns the number of bytes */
+size_t mgos_host_uart_take_tx(int uart_no, void *buf, size_t len);
+
+/* current UART configuration, e.g. to check the baud rate */
+const struct mgos_uart_config *mgos_host_uart_config(int uart_no);
+
+/* run any timers which are due */
+void mgos_host_run_timers(void);
+
+/* call an RPC handler, as if the request came in with args as its JSON
+   arguments. The result or the error message is written to response, NUL
+   terminated. Returns 0, the handler's error code, or 404 for an unknown method */
+int mgos_host_rpc_call(const char *method, const char *args, char *response, size_t size);
+
+/* heap use by the code under test. Counted by wrapping malloc and friends
+   at link time, see the Makefile */
+struct mgos_host_alloc_stats {
+  uint64_t allocs;
+  uint64_t frees;
+  size_t live_bytes;
+  size_t peak_live_bytes;
+};
+
+void mgos_host_get_alloc_stats(struct mgos_host_alloc_stats *stats);
+void mgos_host_reset_alloc_stats(void);
+
+#endif /* GPS2_HOST_MGOS_HOST_H */
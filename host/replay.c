@@ -0,0 +1,522 @@
+/*
+ * Replays a recorded NMEA log through the gps2 rx path as if it came from
+ * the receiver.
+ *
+ * The file is memory mapped and pushed onto the simulated UART, so it goes
+ * through the UART dispatcher, gps2_uart_rx_callback, the line framing and
+ * the parser exactly like live data. Delivery is paced by the time tags in
+ * the log (RMC and ZDA), sped up by --speed, or as fast as possible with
+ * --fast. At the end it reports throughput and the latency from a sentence
+ * being due on the wire to its event.
+ *
+ * --line-baud runs the simulated receiver at a baud rate of its own, so that
+ * the log arrives garbled until the UART matches it, and the receiver obeys
+ * PMTK251 commands. --autobaud then has the driver find the receiver and move
+ * it to a new rate, and the report includes the time to the first good
+ * sentence.
+ *
+ * --disconnect-timeout watches the link, and --outage S,LEN cuts the wire for
+ * LEN seconds of the log from S seconds in. The receiver comes back at its
+ * --line-baud rate, as after a power cycle, so the driver has to find it
+ * again. Link events are written to stderr as they happen.
+ *
+ * --log appends every fix to a binary fix log, see gps2_log.h, for reading
+ * back with gps2_logdump. --simplify M[,S] drops the fixes within M metres of
+ * a straight line, sending a point at least every S seconds, before the
+ * events and the log.
+ *
+ * usage: gps2_replay [--speed X | --fast] [--chunk BYTES] [--loop N] [--batch N [--batch-ms T]] [--events]
+ *                    [--line-baud B [--autobaud B]] [--disconnect-timeout MS [--outage S,LEN]]
+ *                    [--log PATH [--log-flush-ms T]] [--simplify M[,S]] file.nmea
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mgos_host.h"
+#include "gps2.h"
+#include "gps2_commands.h"
+#include "gps2_log.h"
+#include "gps2_simplify.h"
+#include "minmea.h"
+
+/* a jump between time tags larger than this is a gap in the recording or a
+   new recording appended to the file. Pacing restarts from the new tag */
+#define REPLAY_MAX_GAP_MICROS (60 * 1000000LL)
+
+/* longest sleep between timer runs while waiting for the next epoch */
+#define REPLAY_TIMER_PERIOD_MICROS 10000
+
+/* in gps2.c, called by Mongoose OS at boot */
+enum mgos_init_result mgos_gps2_init(void);
+
+/* the simulated receiver's command buffer */
+#define REPLAY_RX_COMMAND_SIZE 256
+
+struct replay {
+  const char *data;
+  size_t len;
+  double speed; /* 0 is as fast as possible */
+  size_t chunk;
+  bool print_events;
+
+  /* pacing: a log time tag of base_tag is due at wall clock base_wall */
+  bool paced;
+  bool synced;
+  int64_t base_tag;
+  int64_t base_wall;
+  int64_t last_tag;
+
+  /* when the bytes being pushed were due on the wire */
+  int64_t due;
+
+  /* results */
+  uint64_t bytes;
+  uint64_t sentences;
+  uint64_t locations;
+  uint64_t batches;
+  uint64_t epochs;
+  uint32_t *latencies; /* micros, one per sentence event */
+  size_t latency_count;
+  size_t latency_capacity;
+
+  /* MGOS_EV_GPS_BAUD_RATE */
+  bool have_baud_rate;
+  struct mgos_gps_baud_rate baud_rate;
+
+  /* --outage, in micros of log time from the first tag */
+  int line_baud;
+  int64_t first_tag;
+  int64_t outage_start;
+  int64_t outage_length;
+  bool in_outage;
+  uint64_t outage_bytes;
+
+  /* link events, and reconnect commands the receiver heard */
+  int64_t start;
+  uint32_t link_events;
+  uint32_t reconfigured;
+};
+
+/* sent by the driver when the link comes back, checked for by the receiver */
+static const char reconnect_commands[] = GPS2_PMTK_OUTPUT_FIX;
+
+static struct replay replay;
+
+static void sentence_handler(int ev, void *ev_data, void *userdata) {
+  int64_t latency = mgos_uptime_micros() - replay.due;
+  (void) ev;
+  (void) ev_data;
+  (void) userdata;
+  replay.sentences++;
+  if (replay.latency_count < replay.latency_capacity) {
+    replay.latencies[replay.latency_count++] = latency > 0 ? (uint32_t) latency : 0;
+  }
+}
+
+static void location_handler(int ev, void *ev_data, void *userdata) {
+  const struct mgos_gps_location *location = ev_data;
+  (void) ev;
+  (void) userdata;
+  replay.locations++;
+  if (replay.print_events) {
+    printf("%lld.%06d,%.6f,%.6f,%.2f,%.1f\n", (long long) location->time, location->microseconds,
+           location->latitude, location->longitude, location->speed, location->bearing);
+  }
+}
+
+static void baud_rate_handler(int ev, void *ev_data, void *userdata) {
+  (void) ev;
+  (void) userdata;
+  replay.baud_rate = *(const struct mgos_gps_baud_rate *) ev_data;
+  replay.have_baud_rate = true;
+}
+
+static void link_handler(int ev, void *ev_data, void *userdata) {
+  const struct mgos_gps_link *link = ev_data;
+  const char *name = ev == MGOS_EV_GPS_CONNECTED ? "connected"
+                     : ev == MGOS_EV_GPS_DISCONNECTED ? "disconnected"
+                     : ev == MGOS_EV_GPS_FIX_ACQUIRED ? "fix acquired" : "fix lost";
+  (void) userdata;
+  replay.link_events++;
+  fprintf(stderr, "%9.3f s  %s", (mgos_uptime_micros() - replay.start) / 1e6, name);
+  if (ev == MGOS_EV_GPS_CONNECTED || ev == MGOS_EV_GPS_DISCONNECTED) fprintf(stderr, ", down %d ms", link->down_ms);
+  fprintf(stderr, "\n");
+}
+
+/* the receiver's side of the wire: read what the driver sent, if it was sent
+   at the receiver's rate, and follow PMTK251 */
+static void receiver_commands(void) {
+  static char commands[REPLAY_RX_COMMAND_SIZE + 1];
+  int uart_no = mgos_sys_config_get_gps_uart_no();
+  int line_baud = mgos_host_uart_line_baud(uart_no);
+  const char *p;
+  size_t n;
+
+  /* a line rate of 0 always matches the UART */
+  n = mgos_host_uart_take_tx(uart_no, commands, REPLAY_RX_COMMAND_SIZE);
+  if (n == 0 || (line_baud != 0 && mgos_host_uart_config(uart_no)->baud_rate != line_baud)) return;
+  commands[n] = '\0';
+  if (strstr(commands, reconnect_commands) != NULL) replay.reconfigured++;
+  p = strstr(commands, "$PMTK251,");
+  if (p != NULL && atoi(p + 9) > 0 && line_baud != 0) mgos_host_uart_set_line_baud(uart_no, atoi(p + 9));
+}
+
+static void location_batch_handler(int ev, void *ev_data, void *userdata) {
+  const struct mgos_gps_location_batch *batch = ev_data;
+  struct mgos_gps_location location;
+  int i;
+
+  replay.batches++;
+  for (i = 0; i < batch->count; i++) {
+    gps2_location_from_fixed(&batch->locations[i], &location);
+    location_handler(ev, &location, userdata);
+  }
+}
+
+/* the time tag of an RMC or ZDA line in micros, or -1 */
+static int64_t time_tag(const char *line, size_t len) {
+  char sentence[MINMEA_MAX_LENGTH + 1];
+  struct minmea_frame frame;
+  struct timespec ts;
+  int rc = -1;
+
+  if (len > MINMEA_MAX_LENGTH) return -1;
+  memcpy(sentence, line, len);
+  sentence[len] = '\0';
+
+  switch (minmea_peek_sentence_id(sentence)) {
+    case MINMEA_SENTENCE_RMC:
+      if (minmea_parse(&frame, sentence, false)) {
+        rc = minmea_gettime(&ts, &frame.data.rmc.date, &frame.data.rmc.time);
+      }
+      break;
+    case MINMEA_SENTENCE_ZDA:
+      if (minmea_parse(&frame, sentence, false)) {
+        rc = minmea_gettime(&ts, &frame.data.zda.date, &frame.data.zda.time);
+      }
+      break;
+    default:
+      break;
+  }
+  return rc == 0 ? (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000 : -1;
+}
+
+static void wait_until(int64_t wall) {
+  int64_t now;
+  int64_t delay;
+  struct timespec ts;
+
+  for (;;) {
+    mgos_host_run_timers();
+    receiver_commands();
+    now = mgos_uptime_micros();
+    if (now >= wall) return;
+    delay = wall - now < REPLAY_TIMER_PERIOD_MICROS ? wall - now : REPLAY_TIMER_PERIOD_MICROS;
+    ts.tv_sec = 0;
+    ts.tv_nsec = delay * 1000;
+    nanosleep(&ts, NULL);
+  }
+}
+
+/* push bytes onto the wire in chunks of at most replay.chunk */
+static void push(const char *from, const char *to) {
+  size_t len;
+  while (from < to) {
+    len = (size_t) (to - from) < replay.chunk ? (size_t) (to - from) : replay.chunk;
+    if (!replay.paced) replay.due = mgos_uptime_micros();
+    len = mgos_host_uart_receive(mgos_sys_config_get_gps_uart_no(), from, len);
+    from += len;
+    replay.bytes += len;
+  }
+  mgos_host_run_timers();
+  receiver_commands();
+}
+
+static bool outage(int64_t tag) {
+  int64_t t = tag - replay.first_tag;
+  return replay.outage_length > 0 && replay.first_tag > 0 && t >= replay.outage_start
+         && t < replay.outage_start + replay.outage_length;
+}
+
+/* push an epoch, unless it falls in the outage. The receiver comes back from
+   the outage at its own rate, as after a power cycle */
+static void deliver(const char *from, const char *to, int64_t tag) {
+  if (outage(tag)) {
+    replay.in_outage = true;
+    replay.outage_bytes += to - from;
+    mgos_host_run_timers();
+    return;
+  }
+  if (replay.in_outage) {
+    replay.in_outage = false;
+    mgos_host_uart_set_line_baud(mgos_sys_config_get_gps_uart_no(), replay.line_baud);
+  }
+  push(from, to);
+}
+
+/* a time tag has been read. Returns the wall clock time it is due, or 0 if
+   it is in the current epoch and the replay carries on without waiting */
+static int64_t schedule(int64_t tag) {
+  int64_t step = tag - replay.last_tag;
+
+  if (replay.synced && step <= 0 && step >= -REPLAY_MAX_GAP_MICROS) {
+    /* same epoch, or a stray earlier tag */
+    return 0;
+  }
+  if (!replay.synced || step > REPLAY_MAX_GAP_MICROS || step < -REPLAY_MAX_GAP_MICROS) {
+    replay.base_tag = tag;
+    replay.base_wall = mgos_uptime_micros();
+    replay.synced = true;
+  }
+  if (replay.first_tag == 0) replay.first_tag = tag;
+  replay.epochs++;
+  replay.last_tag = tag;
+  return replay.base_wall + (int64_t) ((tag - replay.base_tag) / replay.speed);
+}
+
+static void run(void) {
+  const char *p = replay.data;
+  const char *end = replay.data + replay.len;
+  const char *pending = p;
+  const char *eol;
+  size_t len;
+  int64_t tag;
+  int64_t epoch;
+  int64_t due;
+
+  /* the log starts again, wait for its first time tag */
+  replay.synced = false;
+  replay.due = mgos_uptime_micros();
+
+  while (p < end) {
+    eol = memchr(p, '\n', end - p);
+    eol = eol != NULL ? eol + 1 : end;
+
+    if (replay.paced) {
+      len = eol - p;
+      while (len > 0 && (p[len - 1] == '\n' || p[len - 1] == '\r')) len--;
+      tag = time_tag(p, len);
+      epoch = replay.last_tag;
+      if (tag >= 0 && (due = schedule(tag)) != 0) {
+        /* everything before this line belongs to the previous epoch */
+        deliver(pending, p, epoch);
+        pending = p;
+        wait_until(due);
+        replay.due = due;
+      }
+    }
+    p = eol;
+  }
+  deliver(pending, end, replay.last_tag);
+}
+
+static int compare_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *) a;
+  uint32_t y = *(const uint32_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+static void report(double elapsed) {
+  FILE *out = stderr;
+  size_t n = replay.latency_count;
+  struct gps2_stats stats;
+  struct mgos_gps_link link;
+  const struct gps2_log *log;
+  const struct gps2_simplify *simplify;
+
+  fprintf(out, "Replayed %llu bytes in %.3f s", (unsigned long long) replay.bytes, elapsed);
+  if (replay.paced) fprintf(out, " at %gx, %llu epochs", replay.speed, (unsigned long long) replay.epochs);
+  fprintf(out, "\n");
+  fprintf(out, "  %.2f MB/s, %.0f sentences/s, %llu sentences, %llu locations",
+          replay.bytes / elapsed / 1e6, replay.sentences / elapsed,
+          (unsigned long long) replay.sentences, (unsigned long long) replay.locations);
+  if (replay.batches > 0) fprintf(out, " in %llu batches", (unsigned long long) replay.batches);
+  fprintf(out, "\n");
+  if (n > 0) {
+    qsort(replay.latencies, n, sizeof(uint32_t), compare_u32);
+    fprintf(out, "  latency due to event: p50 %u us, p99 %u us, max %u us\n",
+            replay.latencies[n / 2], replay.latencies[n * 99 / 100], replay.latencies[n - 1]);
+  }
+  fprintf(out, "  peak buffered: uart %zu bytes, gps2 ring %zu bytes\n",
+          mgos_host_uart_rx_peak(mgos_sys_config_get_gps_uart_no()),
+          gps2_get_device_rx_high_water(gps2_get_global_device()));
+  gps2_get_device_stats(gps2_get_global_device(), &stats);
+  fprintf(out, "  first good sentence after %d ms\n", (int) stats.first_sentence_ms);
+  if (replay.have_baud_rate) {
+    fprintf(out, "  autobaud: receiver found at %d, now at %d, after %d ms\n", replay.baud_rate.detected_baud_rate,
+            replay.baud_rate.baud_rate, replay.baud_rate.elapsed_ms);
+  }
+  gps2_get_device_link(gps2_get_global_device(), &link);
+  fprintf(out, "  link: %s, %s, %u events", link.connected ? "connected" : "down", link.fix ? "fix" : "no fix",
+          replay.link_events);
+  if (mgos_host_config.disconnect_timeout > 0) {
+    fprintf(out, ", %u disconnects, %u recoveries, reconfigured %u times", link.disconnects, link.recoveries,
+            replay.reconfigured);
+  }
+  if (replay.outage_bytes > 0) fprintf(out, ", %llu bytes lost", (unsigned long long) replay.outage_bytes);
+  fprintf(out, "\n");
+  log = gps2_get_device_log(gps2_get_global_device());
+  if (log != NULL) {
+    fprintf(out, "  log: %u points in %u blocks, %u rejected, %u write errors\n", log->points,
+            log->blocks_written, log->rejected, log->write_errors);
+  }
+  simplify = gps2_get_device_simplify(gps2_get_global_device());
+  if (simplify != NULL && simplify->fixes > 0) {
+    fprintf(out, "  simplify: %u of %u fixes sent, %.1fx fewer\n", simplify->sent, simplify->fixes,
+            (double) simplify->fixes / simplify->sent);
+  }
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [--speed X | --fast] [--chunk BYTES] [--loop N] [--batch N [--batch-ms T]] [--events]\n"
+          "       [--line-baud B [--autobaud B]] [--disconnect-timeout MS [--outage S,LEN]]\n"
+          "       [--log PATH [--log-flush-ms T]] [--simplify M[,S]] file.nmea\n", name);
+}
+
+int main(int argc, char **argv) {
+  const char *path = NULL;
+  struct stat st;
+  int loops = 1;
+  int batch_size = 0;
+  int batch_ms = 0;
+  int line_baud = 0;
+  double outage_start = 0;
+  double outage_length = 0;
+  const char *log_path = NULL;
+  int log_flush_ms = 0;
+  int simplify_m = 0;
+  double simplify_s = 0;
+  int fd;
+  int i;
+  int64_t start;
+  const char *p;
+
+  replay.speed = 1;
+  replay.chunk = 64;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+      replay.speed = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--fast") == 0) {
+      replay.speed = 0;
+    } else if (strcmp(argv[i], "--chunk") == 0 && i + 1 < argc) {
+      replay.chunk = (size_t) atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--loop") == 0 && i + 1 < argc) {
+      loops = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      batch_size = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--batch-ms") == 0 && i + 1 < argc) {
+      batch_ms = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--events") == 0) {
+      replay.print_events = true;
+    } else if (strcmp(argv[i], "--line-baud") == 0 && i + 1 < argc) {
+      line_baud = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--autobaud") == 0 && i + 1 < argc) {
+      mgos_host_config.autobaud = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--disconnect-timeout") == 0 && i + 1 < argc) {
+      mgos_host_config.disconnect_timeout = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--outage") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%lf,%lf", &outage_start, &outage_length) != 2) {
+        usage(argv[0]);
+        return 2;
+      }
+    } else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+      log_path = argv[++i];
+    } else if (strcmp(argv[i], "--log-flush-ms") == 0 && i + 1 < argc) {
+      log_flush_ms = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--simplify") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%d,%lf", &simplify_m, &simplify_s) < 1) {
+        usage(argv[0]);
+        return 2;
+      }
+    } else if (argv[i][0] != '-' && path == NULL) {
+      path = argv[i];
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (path == NULL || replay.speed < 0 || replay.chunk < 1 || loops < 1) {
+    usage(argv[0]);
+    return 2;
+  }
+  replay.paced = replay.speed > 0;
+  if (outage_length > 0 && !replay.paced) {
+    fprintf(stderr, "--outage needs a paced replay\n");
+    return 2;
+  }
+  replay.outage_start = (int64_t) (outage_start * 1e6);
+  replay.outage_length = (int64_t) (outage_length * 1e6);
+  replay.line_baud = line_baud;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(path);
+    return 1;
+  }
+  replay.len = (size_t) st.st_size;
+  if (replay.len == 0) {
+    fprintf(stderr, "%s: empty\n", path);
+    return 1;
+  }
+  replay.data = mmap(NULL, replay.len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (replay.data == MAP_FAILED) {
+    perror(path);
+    return 1;
+  }
+  madvise((void *) replay.data, replay.len, MADV_SEQUENTIAL);
+  close(fd);
+
+  /* at most one event per line */
+  for (p = replay.data; (p = memchr(p, '\n', replay.data + replay.len - p)) != NULL; p++) {
+    replay.latency_capacity++;
+  }
+  replay.latency_capacity = (replay.latency_capacity + 1) * loops;
+  replay.latencies = malloc(replay.latency_capacity * sizeof(uint32_t));
+
+  mgos_host_uart_set_line_baud(mgos_sys_config_get_gps_uart_no(), line_baud);
+
+  /* bring the driver up the way the firmware does, from sys config */
+  mgos_event_add_handler(MGOS_EV_GPS_BAUD_RATE, baud_rate_handler, NULL);
+  mgos_event_add_handler(MGOS_EV_GPS_CONNECTED, link_handler, NULL);
+  mgos_event_add_handler(MGOS_EV_GPS_DISCONNECTED, link_handler, NULL);
+  mgos_event_add_handler(MGOS_EV_GPS_FIX_ACQUIRED, link_handler, NULL);
+  mgos_event_add_handler(MGOS_EV_GPS_FIX_LOST, link_handler, NULL);
+  replay.start = mgos_uptime_micros();
+  mgos_gps2_init();
+  if (gps2_get_global_device() == NULL) {
+    fprintf(stderr, "failed to create the gps2 device\n");
+    return 1;
+  }
+  mgos_event_add_handler(MGOS_EV_GPS_NMEA_SENTENCE, sentence_handler, NULL);
+  mgos_event_add_handler(MGOS_EV_GPS_LOCATION, location_handler, NULL);
+  mgos_event_add_handler(MGOS_EV_GPS_LOCATION_BATCH, location_batch_handler, NULL);
+  gps2_set_device_reconnect_commands(gps2_get_global_device(), reconnect_commands, sizeof(reconnect_commands) - 1);
+  if (!gps2_set_device_location_batch(gps2_get_global_device(), batch_size, batch_ms)) {
+    fprintf(stderr, "bad batch size %d\n", batch_size);
+    return 2;
+  }
+  if (!gps2_set_device_simplify(gps2_get_global_device(), simplify_m, (int) (simplify_s * 1000))) {
+    fprintf(stderr, "bad simplify tolerance %d\n", simplify_m);
+    return 2;
+  }
+  if (log_path != NULL && !gps2_set_device_log(gps2_get_global_device(), log_path, log_flush_ms)) {
+    perror(log_path);
+    return 1;
+  }
+
+  start = mgos_uptime_micros();
+  for (i = 0; i < loops; i++) run();
+  gps2_flush_device_simplify(gps2_get_global_device());
+  gps2_flush_device_location_batch(gps2_get_global_device());
+  gps2_flush_device_log(gps2_get_global_device());
+  report((mgos_uptime_micros() - start) / 1e6);
+  gps2_set_device_log(gps2_get_global_device(), NULL, 0);
+
+  munmap((void *) replay.data, replay.len);
+  free(replay.latencies);
+  return 0;
+}
@@ -14,9 +14,13 @@
 * https://github.com/mongoose-os-libs/fingerprint
 */
 
+#ifndef GPS2_H
+#define GPS2_H
+
 #include "mgos.h"
 #include "minmea.h"
 
+struct gps2;
 
 #define MGOS_EV_GPS_BASE MGOS_EVENT_BASE('G','P','S')
 
@@ -24,13 +28,23 @@ enum mgos_gps_event {
   MGOS_EV_GPS_LOCATION =
     MGOS_EV_GPS_BASE, /* event_data: strict mgos_gps_location */
   MGOS_EV_GPS_NMEA_SENTENCE, /* event_data: strict mgos_gps_nmea_sentence */
-  MGOS_EV_GPS_NMEA_STRING
+  MGOS_EV_GPS_NMEA_STRING,
+  MGOS_EV_GPS_LOCATION_FIXED, /* event_data: struct mgos_gps_location_fixed */
+  MGOS_EV_GPS_FIX, /* event_data: struct mgos_gps_fix */
+  MGOS_EV_GPS_SKY_VIEW, /* event_data: struct mgos_gps_sky_view */
+  MGOS_EV_GPS_LOCATION_BATCH, /* event_data: struct mgos_gps_location_batch */
+  MGOS_EV_GPS_BAUD_RATE, /* event_data: struct mgos_gps_baud_rate */
+  MGOS_EV_GPS_CONNECTED, /* event_data: struct mgos_gps_link */
+  MGOS_EV_GPS_DISCONNECTED, /* event_data: struct mgos_gps_link */
+  MGOS_EV_GPS_FIX_ACQUIRED, /* event_data: struct mgos_gps_link */
+  MGOS_EV_GPS_FIX_LOST /* event_data: struct mgos_gps_link */
   
 };
 
 /* mgos_gps_locatoin built from RMC*/
 
 struct mgos_gps_location {
+  struct gps2 *dev; /* the device it came from */
   float latitude;
   float longitude;
   float bearing;
@@ -42,10 +56,186 @@ struct mgos_gps_location {
 
 };
 
+/* the same location in integers, for targets without an FPU. It is built from the
+RMC fields without any floating point, and converted to struct mgos_gps_location
+only when a consumer asks for floats */
+
+#define MGOS_GPS_FIXED_UNKNOWN INT32_MIN /* the field was empty in the sentence */
+
+struct mgos_gps_location_fixed {
+  struct gps2 *dev; /* the device it came from */
+  int32_t latitude_e7; /* degrees * 10^7 */
+  int32_t longitude_e7;
+  int32_t bearing_e2; /* degrees * 100 */
+  int32_t speed_e3; /* knots * 1000 */
+  int32_t variation_e2; /* degrees * 100 */
+  time_t time;
+  int microseconds;
+  int64_t elapsed_time;
+};
+
+/* set to 0 in cdefs to stop MGOS_EV_GPS_LOCATION, so that nothing is converted to
+   float unless a getter is asked for a float location */
+#ifndef GPS2_LOCATION_FLOAT
+#define GPS2_LOCATION_FLOAT 1
+#endif
+
+/* a minmea value as an integer in units of 1/scale, MGOS_GPS_FIXED_UNKNOWN if the field was empty */
+static inline int32_t gps2_fixed(const struct minmea_float *f, int_least32_t scale) {
+  if (f->scale == 0) {
+    return MGOS_GPS_FIXED_UNKNOWN;
+  }
+  return minmea_rescale(f, scale);
+}
+
+/* a minmea coordinate in degrees * 10^7 */
+static inline int32_t gps2_fixed_coord(const struct minmea_float *f) {
+  if (f->scale == 0) {
+    return MGOS_GPS_FIXED_UNKNOWN;
+  }
+  return minmea_tocoord_e7(f);
+}
+
+void gps2_location_from_fixed(const struct mgos_gps_location_fixed *fixed, struct mgos_gps_location *location);
+
+
+/* sentence types as bits in a subscription mask, e.g.
+   GPS2_SENTENCE_BIT(MINMEA_SENTENCE_RMC) | GPS2_SENTENCE_BIT(MINMEA_SENTENCE_GGA) */
+#define GPS2_SENTENCE_BIT(id) ((uint64_t) 1 << ((id) - MINMEA_SENTENCE_PROPRIETARY))
+#define GPS2_SENTENCE_MASK_ALL (~(uint64_t) 0)
+
+/* one fix per epoch, merged from the RMC, GGA, GSA, VTG and GST sentences with the
+same time tag. Fields that no sentence in the epoch gave are MGOS_GPS_FIXED_UNKNOWN */
+
+struct mgos_gps_fix {
+  struct gps2 *dev; /* the device it came from */
+  uint64_t sentences; /* GPS2_SENTENCE_BIT of each sentence type merged */
+  time_t time; /* UTC, needs an RMC for the date */
+  int microseconds;
+  int64_t elapsed_time; /* uptime when the epoch was complete */
+  bool valid; /* RMC status A, or GGA fix quality above 0 */
+
+  int32_t latitude_e7; /* degrees * 10^7, from RMC or else GGA */
+  int32_t longitude_e7;
+  int32_t altitude_e3; /* metres above mean sea level * 1000, GGA */
+  int32_t geoid_separation_e3; /* metres * 1000, GGA */
+  int32_t bearing_e2; /* degrees * 100, from RMC or else VTG */
+  int32_t speed_e3; /* knots * 1000, from RMC or else VTG */
+  int32_t variation_e2; /* degrees * 100, RMC */
+
+  int32_t fix_quality; /* GGA: 0 invalid, 1 GPS, 2 DGPS, 4 RTK fixed ... */
+  int32_t fix_type; /* GSA: 1 none, 2 2D, 3 3D */
+  int32_t satellites_used; /* GGA */
+  int32_t pdop_e2; /* GSA */
+  int32_t hdop_e2; /* GSA or else GGA */
+  int32_t vdop_e2; /* GSA */
+
+  int32_t latitude_error_e3; /* GST 1 sigma, metres * 1000 */
+  int32_t longitude_error_e3;
+  int32_t altitude_error_e3;
+};
+
+/* fixes in batch mode, sent instead of a location event per fix */
+struct mgos_gps_location_batch {
+  struct gps2 *dev;
+  int count;
+  const struct mgos_gps_location_fixed *locations; /* oldest first. Only valid during the event */
+};
+
+#define GPS2_LOCATION_BATCH_MAX 256
+
+/* the outcome of gps2_start_device_autobaud */
+struct mgos_gps_baud_rate {
+  struct gps2 *dev;
+  int baud_rate; /* the UART's baud rate now, 0 if the receiver wasn't heard at any rate */
+  int detected_baud_rate; /* where the receiver was found */
+  int elapsed_ms;
+};
+
+/* the link to the receiver, see gps2_set_device_disconnect_timeout */
+struct mgos_gps_link {
+  struct gps2 *dev;
+  bool connected; /* a good sentence or packet since the start or the last disconnect */
+  bool fix; /* the last RMC or NAV-PVT had a valid fix */
+  uint32_t disconnects; /* since the device was created */
+  uint32_t recoveries; /* autobaud runs started because the link was down */
+  int down_ms; /* how long the link has been down, on MGOS_EV_GPS_CONNECTED how long it was */
+};
+
+
+/* a satellite in view, in 6 bytes */
+struct mgos_gps_satellite {
+  uint8_t prn;
+  int8_t elevation; /* degrees */
+  uint8_t snr; /* dB-Hz, 0 if not tracked */
+  uint8_t used; /* 1 if it is in the fix, from GSA */
+  uint16_t azimuth; /* degrees from true north */
+};
+
+/* GSV has at most 9 messages of 4 satellites */
+#define MGOS_GPS_SKY_MAX_SATELLITES 36
+
+/* every satellite one constellation has in view, from a complete cycle of GSV messages */
+struct mgos_gps_sky_view {
+  struct gps2 *dev; /* the device it came from */
+  char talker[3]; /* GP GPS, GL GLONASS, GA Galileo, GB or BD BeiDou ... */
+  uint8_t count;
+  uint8_t used_count;
+  struct mgos_gps_satellite satellites[MGOS_GPS_SKY_MAX_SATELLITES];
+};
+
+
+/* bucket 0 counts times under 1us, bucket i from 2^(i-1) up to 2^i us. The
+   last bucket also holds everything longer */
+#define GPS2_HISTOGRAM_BUCKETS 16
+
+struct gps2_histogram {
+  uint32_t buckets[GPS2_HISTOGRAM_BUCKETS];
+  uint32_t max_us;
+};
+
+/* per device counters, since the device was created or last reset. Counting
+   is a handful of increments per line, compile it out with GPS2_STATS 0.
+   The histograms time one in GPS2_STATS_SAMPLE lines and dispatcher runs,
+   so their counts and max_us are of those samples */
+struct gps2_stats {
+  uint32_t rx_bytes;
+  uint32_t rx_overflows; /* times the receive ring filled without a line end */
+  size_t rx_high_water; /* the most bytes waiting in the receive ring */
+
+  uint32_t lines; /* framed and handed to the parser */
+  uint32_t lines_dropped; /* empty or too long to be NMEA */
+  uint32_t filtered_lines; /* dropped on the header, nobody wanted them */
+  uint32_t unknown_lines;
+  uint32_t proprietary_lines;
+  uint32_t checksum_failures; /* bad checksum or characters */
+  uint32_t parse_failures[MINMEA_SENTENCE_USER]; /* by enum minmea_sentence_id */
+
+  uint32_t ubx_packets; /* framed, whatever their checksum */
+  uint32_t ubx_checksum_failures;
+  uint32_t ubx_dropped; /* too long to frame */
+
+  uint32_t tx_bytes_queued;
+  uint32_t tx_bytes_dropped; /* whole commands that didn't fit in the tx ring */
+
+  uint32_t pmtk_commands; /* sent from the command queue */
+  uint32_t pmtk_timeouts; /* no PMTK001 in GPS2_PMTK_TIMEOUT_MS */
+
+  int32_t first_sentence_ms; /* from creating the device to the first good sentence, -1 until then. Not reset */
+
+  uint32_t events; /* triggered by the device */
+  uint32_t dispatcher_runs;
+
+  struct gps2_histogram dispatcher_us; /* each run of the UART dispatcher */
+  struct gps2_histogram parse_us; /* each minmea_parse */
+  struct gps2_histogram handler_us; /* each event, all its handlers */
+};
+
 
 struct mgos_gps_nmea_sentence {
+  struct gps2 *dev; /* the device it came from */
   enum minmea_sentence_id sentence_id;
-  const char *nmea_string; 
+  const char *nmea_string; /* NUL terminated, without the CR LF. Only valid during the event */
 };
 
 void mgos_gps_get_latest_location(struct mgos_gps_location *location);
@@ -91,8 +281,26 @@ struct gps2;
 
 struct gps2 *gps2_create_uart(uint8_t uart_no, struct mgos_uart_config *ucfg);
 
+/* stop the UART dispatcher and free the device */
 void gps2_destroy_device(struct gps2 *dev);
 
+/* most devices that can exist at once, and UART numbers they can use */
+#ifndef GPS2_MAX_DEVICES
+#define GPS2_MAX_DEVICES 4
+#endif
+#ifndef GPS2_MAX_UARTS
+#define GPS2_MAX_UARTS 8
+#endif
+
+/* a small number from 0 to GPS2_MAX_DEVICES - 1, fixed for the life of the device.
+   Every event carries its device, so handlers can keep per device state in an
+   array indexed by this */
+int gps2_get_device_id(struct gps2 *dev);
+
+/* the device with an id, or on a UART. NULL if there isn't one */
+struct gps2 *gps2_get_device(int id);
+struct gps2 *gps2_get_device_by_uart(int uart_no);
+
 
 /* set the UART baud after initialisation */
 bool gps2_set_device_uart_baud(struct gps2 *dev, int baud_rate);
@@ -100,11 +308,148 @@ bool gps2_set_device_uart_baud(struct gps2 *dev, int baud_rate);
 /* set the UART baud after initialisation on the global device*/
 bool gps2_set_uart_baud(int baud_rate);
 
+/* find the receiver's baud rate and move it to baud_rate. The UART is tried at
+   its configured rate and then each of GPS2_AUTOBAUD_RATES until good sentences
+   or UBX packets come in. The receiver is then sent PMTK251 and a UBX CFG-PRT
+   for baud_rate and the UART follows it. If nothing good arrives at the new rate
+   the UART goes back to the one that worked. MGOS_EV_GPS_BAUD_RATE reports the
+   outcome. baud_rate 0 only finds the current rate. false if it is already running */
+bool gps2_start_device_autobaud(struct gps2 *dev, int baud_rate);
+
+/* watch the link. MGOS_EV_GPS_DISCONNECTED is sent when nothing good has arrived
+   for timeout_ms, preceded by MGOS_EV_GPS_FIX_LOST if there was a fix, and
+   MGOS_EV_GPS_CONNECTED and MGOS_EV_GPS_FIX_ACQUIRED when they come back. Events
+   are only sent on a change. While the link is down the driver looks for the
+   receiver with gps2_start_device_autobaud, at the last rate asked of it, and
+   tries again at growing intervals up to GPS2_LINK_RECOVERY_MAX_MS. The rx path
+   only counts good sentences; a timer runs GPS2_LINK_TICKS times per timeout.
+   0 turns it off: the link is never taken down and MGOS_EV_GPS_DISCONNECTED is
+   never sent, but the connected and fix state and their other events still
+   follow the receiver. gps.uart.disconnect_timeout sets it on the global device */
+bool gps2_set_device_disconnect_timeout(struct gps2 *dev, int timeout_ms);
+
+/* sent to the receiver each time the link comes back after a disconnect, to
+   put back configuration a power cycle may have lost. Whole sentences and
+   packets, e.g. from gps2_commands.h:
+
+     static const char commands[] = GPS2_PMTK_OUTPUT_FIX GPS2_PMTK_UPDATE_5HZ;
+     gps2_set_device_reconnect_commands(dev, commands, sizeof(commands) - 1);
+
+   Not copied, so commands must stay valid. NULL for none. false if they are
+   longer than the tx ring */
+bool gps2_set_device_reconnect_commands(struct gps2 *dev, const void *commands, size_t length);
+
+/* the state of the link. Cheap, so it can be checked before trusting the latest location */
+void gps2_get_device_link(struct gps2 *dev, struct mgos_gps_link *link);
+
 
 
 void mgos_gps_device_get_latest_location(struct gps2 *dev, struct mgos_gps_location *location);
 
+/* copy the latest location without blocking the UART, from any task. Returns the
+   sequence number of the fix, which counts up from 1. Returns 0 and a zeroed location
+   if there hasn't been a fix yet */
+uint32_t gps2_get_device_location(struct gps2 *dev, struct mgos_gps_location *location);
+
+/* true if there is a newer fix than the one with sequence number seq. Cheap
+   enough to poll, so pollers only copy when something has changed */
+bool gps2_device_location_changed(struct gps2 *dev, uint32_t seq);
+
+/* the latest location as integers, see gps2_get_device_location */
+uint32_t gps2_get_device_location_fixed(struct gps2 *dev, struct mgos_gps_location_fixed *location);
+
+/* milliseconds since the location was received, from elapsed_time */
+int64_t gps2_location_age_ms(const struct mgos_gps_location *location);
+
+/* the most bytes that have been waiting in the receive ring for a complete line */
+size_t gps2_get_device_rx_high_water(struct gps2 *dev);
+
+/* copy the device counters and histograms */
+void gps2_get_device_stats(struct gps2 *dev, struct gps2_stats *stats);
+
+/* zero them, including the receive ring high water */
+void gps2_reset_device_stats(struct gps2 *dev);
+
+
+
+/* subscribe to MGOS_EV_GPS_NMEA_SENTENCE for the sentence types in mask only.
+   Until the first handler is added this way, every sentence is parsed and sent. 
+   After that, devices only parse and send the types some handler has asked for,
+   and drop the rest on the sentence header. Handlers added directly with
+   mgos_event_add_handler only see those types too */
+bool gps2_add_sentence_handler(uint64_t mask, mgos_event_handler_t cb, void *userdata);
+
+/* set the sentence types the device sends MGOS_EV_GPS_NMEA_SENTENCE for, instead of
+   taking them from gps2_add_sentence_handler. Other types are dropped on the header,
+   except the ones the driver needs for the location */
+void gps2_set_device_sentence_mask(struct gps2 *dev, uint64_t mask);
+
+uint64_t gps2_get_device_sentence_mask(struct gps2 *dev);
+
+/* the sentence types merged into MGOS_EV_GPS_FIX, by default RMC, GGA, GSA, VTG
+   and GST. The types are parsed for the fix whatever the sentence mask is. 0 turns
+   the fix event off */
+void gps2_set_device_fix_sentences(struct gps2 *dev, uint64_t mask);
 
+/* copy the last MGOS_EV_GPS_FIX. false if there hasn't been one */
+bool gps2_get_device_fix(struct gps2 *dev, struct mgos_gps_fix *fix);
+
+/* batch mode. Instead of MGOS_EV_GPS_LOCATION and MGOS_EV_GPS_LOCATION_FIXED for
+   every fix, the device collects fixes and sends them in one MGOS_EV_GPS_LOCATION_BATCH
+   when it has size of them, or timeout_ms after the first of them (0 for no timeout).
+   The buffer is allocated here, not per fix. size 0 turns batching off. Returns false
+   if size is above GPS2_LOCATION_BATCH_MAX or there is no memory */
+bool gps2_set_device_location_batch(struct gps2 *dev, int size, int timeout_ms);
+
+/* send the fixes collected so far now */
+void gps2_flush_device_location_batch(struct gps2 *dev);
+
+/* keep every fix in bytes of RAM, delta compressed, newest replacing oldest, for
+   upload after a gap in connectivity. See gps2_track.h. The memory is allocated
+   here, 0 frees it. false if there is no memory */
+bool gps2_set_device_track_history(struct gps2 *dev, size_t bytes);
+
+/* the history, for gps2_track_seek and gps2_track_next. NULL if it is off. Read
+   it from the Mongoose OS task, e.g. in an event handler, as the UART dispatcher
+   adds to it */
+struct gps2_track;
+const struct gps2_track *gps2_get_device_track(struct gps2 *dev);
+
+/* append every fix to the binary log at path, e.g. in flash, carrying on from
+   what is there. See gps2_log.h. A block of points is written when it is full
+   or when its first point is flush_ms old, 0 for only when full. NULL closes
+   the log. false if the file can't be opened */
+bool gps2_set_device_log(struct gps2 *dev, const char *path, int flush_ms);
+
+/* write the points not yet in the log, e.g. before a planned power off */
+bool gps2_flush_device_log(struct gps2 *dev);
+
+/* the log's counters. NULL if it is off */
+struct gps2_log;
+const struct gps2_log *gps2_get_device_log(struct gps2 *dev);
+
+/* drop the fixes that lie within tolerance_m of a straight line between the
+   ones kept, so that only corners, and a point at least every heartbeat_ms (0
+   for none), go to the location events, the batch, the history and the log.
+   A kept point may be sent a few fixes late, with its own time. The latest
+   location and gps.fix still see every fix. See gps2_simplify.h. 0 turns it
+   off. false if there is no memory */
+bool gps2_set_device_simplify(struct gps2 *dev, int tolerance_m, int heartbeat_ms);
+
+/* send the fix being held back now. It is sent anyway when the fix is lost */
+void gps2_flush_device_simplify(struct gps2 *dev);
+
+/* the counts of fixes in and points sent. NULL if it is off */
+struct gps2_simplify;
+const struct gps2_simplify *gps2_get_device_simplify(struct gps2 *dev);
+
+/* assemble GSV cycles into MGOS_EV_GPS_SKY_VIEW, one event per constellation per
+   cycle. Off by default, as GSV is the bulk of what receivers send */
+void gps2_set_device_sky_view(struct gps2 *dev, bool enable);
+
+/* copy the last complete sky view of the index'th constellation seen, from 0.
+   false past the last one, or if sky views are off */
+bool gps2_get_device_sky_view(struct gps2 *dev, int index, struct mgos_gps_sky_view *view);
 
 
 /* send a proprietary string command_string to the global GPS */
@@ -113,5 +458,39 @@ int gps2_send_command(struct mg_str command_string);
 
 void gps2_send_device_command(struct gps2 *gps_dev, struct mg_str command_string);
 
+/* queue bytes for the receiver as they are, e.g. a UBX packet. The UART
+   dispatcher writes them out as the UART has room. false, with nothing queued,
+   if they don't all fit in the GPS2_TX_RING_SIZE ring */
+bool gps2_send_device_bytes(struct gps2 *gps_dev, const void *data, size_t length);
+
+/* send one of the commands in gps2_commands.h, checksum and all */
+#define gps2_send_device_template(dev, command) gps2_send_device_bytes((dev), (command), sizeof(command) - 1)
+
+/* the flag of the receiver's PMTK001, or what happened instead */
+enum gps2_pmtk_result {
+  GPS2_PMTK_INVALID = 0, /* invalid command */
+  GPS2_PMTK_UNSUPPORTED = 1,
+  GPS2_PMTK_FAILED = 2, /* valid, but the action failed */
+  GPS2_PMTK_OK = 3,
+  GPS2_PMTK_TIMEOUT, /* no acknowledgement */
+  GPS2_PMTK_CANCELLED /* the device was destroyed first */
+};
+
+/* called once per queued command, number being its nnn */
+typedef void (*gps2_pmtk_cb)(struct gps2 *dev, int number, enum gps2_pmtk_result result, void *userdata);
+
+/* queue a PMTK command such as "PMTK220,100" for the device. The checksum and CRLF
+   are added here, unless it is one of the whole sentences in gps2_commands.h. Commands are sent one at a time, each after the one before it is
+   acknowledged or has timed out, and cb (which may be NULL) is called with the
+   result. Returns false, without calling cb, if the queue is full or command isn't
+   a PMTK command that fits in GPS2_PMTK_MAX_COMMAND */
+bool gps2_send_device_pmtk(struct gps2 *dev, const char *command, gps2_pmtk_cb cb, void *userdata);
+
+/* the same on the global device */
+bool gps2_send_pmtk(const char *command, gps2_pmtk_cb cb, void *userdata);
+
+/* commands queued or waiting for their acknowledgement */
+int gps2_get_device_pmtk_pending(struct gps2 *dev);
 
 
+#endif /* GPS2_H */
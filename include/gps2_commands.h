@@ -0,0 +1,66 @@
+/*
+* Receiver commands as string literals, with their checksums worked out by
+* tools/gen_commands.py. Generated, edit the script rather than this file.
+*
+*   gps2_send_device_template(dev, GPS2_PMTK_UPDATE_10HZ);
+*   gps2_send_device_pmtk(dev, GPS2_PMTK_UPDATE_10HZ, cb, userdata);
+*
+* The PMTK ones can also go through the PMTK queue to wait for their
+* acknowledgement.
+*/
+
+#ifndef GPS2_COMMANDS_H
+#define GPS2_COMMANDS_H
+
+/* MediaTek */
+
+/* restart using everything in memory */
+#define GPS2_PMTK_HOT_START "$PMTK101*32\r\n"
+/* restart without the ephemeris */
+#define GPS2_PMTK_WARM_START "$PMTK102*31\r\n"
+/* restart without time, position or almanac */
+#define GPS2_PMTK_COLD_START "$PMTK103*30\r\n"
+/* standby until the next byte */
+#define GPS2_PMTK_STANDBY "$PMTK161,0*28\r\n"
+/* one fix a second */
+#define GPS2_PMTK_UPDATE_1HZ "$PMTK220,1000*1F\r\n"
+#define GPS2_PMTK_UPDATE_5HZ "$PMTK220,200*2C\r\n"
+#define GPS2_PMTK_UPDATE_10HZ "$PMTK220,100*2F\r\n"
+/* UART rate. The receiver switches straight away */
+#define GPS2_PMTK_BAUD_9600 "$PMTK251,9600*17\r\n"
+#define GPS2_PMTK_BAUD_38400 "$PMTK251,38400*27\r\n"
+#define GPS2_PMTK_BAUD_57600 "$PMTK251,57600*2C\r\n"
+#define GPS2_PMTK_BAUD_115200 "$PMTK251,115200*1F\r\n"
+/* SBAS satellites, and use them for DGPS */
+#define GPS2_PMTK_SBAS_ON "$PMTK313,1*2E\r\n"
+#define GPS2_PMTK_DGPS_SBAS "$PMTK301,2*2E\r\n"
+/* sentences sent each fix */
+#define GPS2_PMTK_OUTPUT_RMC "$PMTK314,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0*29\r\n"
+#define GPS2_PMTK_OUTPUT_RMC_GGA "$PMTK314,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0*28\r\n"
+/* what MGOS_EV_GPS_FIX merges, without GSV */
+#define GPS2_PMTK_OUTPUT_FIX "$PMTK314,0,1,1,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0*28\r\n"
+/* and GSV every fifth fix */
+#define GPS2_PMTK_OUTPUT_SKY "$PMTK314,0,1,1,1,1,5,0,0,0,0,0,0,0,0,0,0,0,0,0*2D\r\n"
+/* the receiver's own default */
+#define GPS2_PMTK_OUTPUT_DEFAULT "$PMTK314,-1*04\r\n"
+/* answered with PMTK705 */
+#define GPS2_PMTK_QUERY_RELEASE "$PMTK605*31\r\n"
+
+/* u-blox */
+
+/* CFG-RATE, fixes per second */
+#define GPS2_UBX_RATE_1HZ "\xB5\x62\x06\x08\x06\x00\xE8\x03\x01\x00\x01\x00\x01\x39"
+#define GPS2_UBX_RATE_5HZ "\xB5\x62\x06\x08\x06\x00\xC8\x00\x01\x00\x01\x00\xDE\x6A"
+#define GPS2_UBX_RATE_10HZ "\xB5\x62\x06\x08\x06\x00\x64\x00\x01\x00\x01\x00\x7A\x12"
+/* CFG-MSG, NAV-PVT every fix */
+#define GPS2_UBX_NAV_PVT_ON "\xB5\x62\x06\x01\x03\x00\x01\x07\x01\x13\x51"
+#define GPS2_UBX_NAV_PVT_OFF "\xB5\x62\x06\x01\x03\x00\x01\x07\x00\x12\x50"
+/* NAV-SAT every fifth fix */
+#define GPS2_UBX_NAV_SAT_ON "\xB5\x62\x06\x01\x03\x00\x01\x35\x05\x45\xB1"
+#define GPS2_UBX_NAV_SAT_OFF "\xB5\x62\x06\x01\x03\x00\x01\x35\x00\x40\xAC"
+/* stop NMEA GSV, the bulk of the output */
+#define GPS2_UBX_NMEA_GSV_OFF "\xB5\x62\x06\x01\x03\x00\xF0\x03\x00\xFD\x15"
+#define GPS2_UBX_NMEA_GSV_ON "\xB5\x62\x06\x01\x03\x00\xF0\x03\x01\xFE\x16"
+#define GPS2_UBX_NMEA_GLL_OFF "\xB5\x62\x06\x01\x03\x00\xF0\x01\x00\xFB\x11"
+
+#endif /* GPS2_COMMANDS_H */
@@ -0,0 +1,49 @@
+/*
+* Epoch aggregator. Groups the sentences a receiver sends for one fix by their
+* UTC time tag and merges them into a single struct mgos_gps_fix.
+*
+* Receivers send the sentences of an epoch back to back, some with a time tag
+* (RMC, GGA, GST) and some without (GSA, VTG). An epoch ends when a time tag
+* changes, or as soon as every sentence type seen in the last two epochs has
+* arrived, so the fix doesn't wait for the next second.
+*/
+
+#ifndef GPS2_EPOCH_H
+#define GPS2_EPOCH_H
+
+#include "gps2.h"
+
+/* the sentence types the aggregator merges */
+#define GPS2_EPOCH_SENTENCES                                      \
+  (GPS2_SENTENCE_BIT(MINMEA_SENTENCE_RMC) |                       \
+   GPS2_SENTENCE_BIT(MINMEA_SENTENCE_GGA) |                       \
+   GPS2_SENTENCE_BIT(MINMEA_SENTENCE_GSA) |                       \
+   GPS2_SENTENCE_BIT(MINMEA_SENTENCE_VTG) |                       \
+   GPS2_SENTENCE_BIT(MINMEA_SENTENCE_GST))
+
+struct gps2_epoch {
+  struct mgos_gps_fix fix; /* being merged */
+  bool open; /* fix has at least one sentence */
+  bool timed; /* time and time_key are set */
+  int64_t time_key; /* time of day in microseconds */
+  struct minmea_time time;
+  enum minmea_sentence_id last_id; /* the last sentence merged */
+
+  /* the last date from an RMC */
+  struct minmea_date date;
+
+  int64_t closed_key; /* time of the last epoch we closed */
+  uint64_t closed_sentences; /* and what was in it */
+  uint64_t expected; /* sentence types that complete an epoch */
+};
+
+/* called with each complete epoch. The time fields of fix are left for the caller,
+   from epoch->date and epoch->time */
+typedef void (*gps2_epoch_cb)(const struct gps2_epoch *epoch, struct mgos_gps_fix *fix, void *arg);
+
+void gps2_epoch_init(struct gps2_epoch *epoch);
+
+/* merge a parsed sentence. cb is called for the epoch it completes, if any */
+void gps2_epoch_add(struct gps2_epoch *epoch, const struct minmea_frame *frame, gps2_epoch_cb cb, void *arg);
+
+#endif /* GPS2_EPOCH_H */
@@ -0,0 +1,85 @@
+/*
+* Append-only binary fix log, for keeping fixes in flash.
+*
+* The file is a sequence of GPS2_LOG_BLOCK_SIZE byte blocks, each written
+* whole at a block boundary:
+*
+*   0   "G2LG"
+*   4   sequence number, counting up from 0 with each block in the file
+*   8   bytes of points in the block
+*   10  points in the block
+*   12  CRC-32 of bytes 0 to 12 and of the points
+*   16  points, encoded as a gps2_track block: a keyframe and then deltas
+*
+* Integers are little endian. A block is only written once it is full, when
+* its first point is flush_ms older than the newest, or on gps2_log_flush, so
+* the writer costs one block of RAM and one write per block.
+*
+* After a power cut the last block may be torn. Readers stop at the first
+* block with a bad CRC or out of sequence, and gps2_log_open writes over it, so
+* at most the points not yet written are lost.
+*
+* The reader works on the whole file in memory, e.g. memory mapped, without
+* copying or allocating, with the gps2_track iterator: gps2_log_seek finds a
+* time with a binary search over the blocks' keyframes.
+*/
+
+#ifndef GPS2_LOG_H
+#define GPS2_LOG_H
+
+#include "gps2_track.h"
+
+#define GPS2_LOG_HEADER_SIZE 16
+#define GPS2_LOG_BLOCK_SIZE (GPS2_LOG_HEADER_SIZE + GPS2_TRACK_BLOCK_SIZE)
+
+struct gps2_log {
+  int fd;
+  long offset; /* where the block being filled goes */
+  uint32_t sequence; /* of the block being filled */
+  int flush_ms; /* 0 to only write full blocks */
+  struct gps2_track_block block; /* being filled */
+  struct gps2_track_cursor cursor; /* the newest point */
+  bool have_point;
+
+  uint32_t blocks_written;
+  uint32_t points; /* added since the log was opened */
+  uint32_t rejected; /* older than the newest point */
+  uint32_t write_errors;
+};
+
+/* the blocks of a log in memory, up to the first bad one */
+struct gps2_log_reader {
+  const uint8_t *data;
+  size_t blocks;
+  size_t torn; /* blocks after them, from a power cut or a different log */
+};
+
+/* open path for appending, creating it if need be. A torn block at the end is
+   written over, and sequence numbers and the time order carry on from the
+   last good block. false if the file can't be opened */
+bool gps2_log_open(struct gps2_log *log, const char *path, int flush_ms);
+
+/* add a fix, writing the block before it if it is full or old enough. false if
+   it is older than the newest point or a write failed */
+bool gps2_log_add(struct gps2_log *log, const struct mgos_gps_location_fixed *location);
+
+/* write the points not yet written as a block of their own */
+bool gps2_log_flush(struct gps2_log *log);
+
+/* flush and close */
+void gps2_log_close(struct gps2_log *log);
+
+/* check the blocks of a log of length bytes at data. Returns the number of good ones */
+size_t gps2_log_reader_init(struct gps2_log_reader *reader, const void *data, size_t length);
+
+/* points in the good blocks, from their headers */
+uint64_t gps2_log_reader_points(const struct gps2_log_reader *reader);
+
+/* start at the oldest point, read on with gps2_track_next. The reader must
+   outlive the iterator */
+void gps2_log_iter_init(const struct gps2_log_reader *reader, struct gps2_track_iter *iter);
+
+/* start at the first point at or after time_ms. false if there isn't one */
+bool gps2_log_seek(const struct gps2_log_reader *reader, struct gps2_track_iter *iter, int64_t time_ms);
+
+#endif /* GPS2_LOG_H */
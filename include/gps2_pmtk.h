@@ -0,0 +1,76 @@
+/*
+* PMTK command queue for MediaTek receivers. Commands go out as
+*
+*   $PMTKnnn,data*XX<CR><LF>
+*
+* and the receiver answers each one with
+*
+*   $PMTK001,nnn,flag*XX
+*
+* The queue holds a fixed number of formatted commands per device and sends
+* them one at a time: the next command goes when the one before it has been
+* acknowledged or has timed out, so the receiver never has more than one to
+* work on. Nothing is allocated per command.
+*/
+
+#ifndef GPS2_PMTK_H
+#define GPS2_PMTK_H
+
+#include "gps2.h"
+
+/* commands waiting per device, including the one in flight */
+#ifndef GPS2_PMTK_QUEUE_LENGTH
+#define GPS2_PMTK_QUEUE_LENGTH 8
+#endif
+
+/* longest command, "PMTKnnn,..." without the $, checksum and CRLF */
+#ifndef GPS2_PMTK_MAX_COMMAND
+#define GPS2_PMTK_MAX_COMMAND 80
+#endif
+
+/* how long to wait for a PMTK001 */
+#ifndef GPS2_PMTK_TIMEOUT_MS
+#define GPS2_PMTK_TIMEOUT_MS 1000
+#endif
+
+/* "$" and "*XX\r\n" around the command */
+#define GPS2_PMTK_MAX_SENTENCE (GPS2_PMTK_MAX_COMMAND + 6)
+
+struct gps2_pmtk_command {
+  char sentence[GPS2_PMTK_MAX_SENTENCE];
+  uint8_t length;
+  uint16_t number; /* nnn, matched against the PMTK001 */
+  gps2_pmtk_cb cb;
+  void *userdata;
+};
+
+struct gps2_pmtk_queue {
+  struct gps2_pmtk_command commands[GPS2_PMTK_QUEUE_LENGTH];
+  uint8_t first; /* the oldest command, in flight if sent is set */
+  uint8_t count;
+  bool sent;
+  mgos_timer_id timer;
+};
+
+void gps2_pmtk_init(struct gps2_pmtk_queue *queue);
+
+/* write command as a sentence, with its checksum and CRLF, to sentence, which
+   must hold GPS2_PMTK_MAX_SENTENCE bytes. A command that is already a whole
+   sentence ending in "*XX\r\n" is copied as it is. Returns its length, or 0 if
+   command isn't a PMTK command that fits. number is set to its nnn */
+size_t gps2_pmtk_format(char *sentence, const char *command, int *number);
+
+/* format command, e.g. "PMTK220,100", with its checksum and add it to the end of
+   the queue. false if the queue is full or command isn't a PMTK command that fits */
+bool gps2_pmtk_push(struct gps2_pmtk_queue *queue, const char *command, gps2_pmtk_cb cb, void *userdata);
+
+/* the oldest command, or NULL if the queue is empty */
+struct gps2_pmtk_command *gps2_pmtk_first(struct gps2_pmtk_queue *queue);
+
+/* take the oldest command off the queue, copying it to command */
+void gps2_pmtk_pop(struct gps2_pmtk_queue *queue, struct gps2_pmtk_command *command);
+
+/* read a PMTK001 line. false if it isn't one or its checksum is wrong */
+bool gps2_pmtk_parse_ack(const char *line, int *number, enum gps2_pmtk_result *result);
+
+#endif /* GPS2_PMTK_H */
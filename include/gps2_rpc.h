@@ -0,0 +1,27 @@
+/*
+* RPC interface to the global device:
+*
+*   gps.navigation  the latest location, with its age in milliseconds and
+*                   whether the receiver is still connected
+*   gps.fix         the latest MGOS_EV_GPS_FIX
+*   gps.sky         the last complete sky view of each constellation
+*   gps.stats       the device counters and histograms, and the link state
+*
+* Responses are written into one static buffer, with integers only, so a
+* call doesn't touch the heap or the FPU. Unknown values are null.
+*/
+
+#ifndef GPS2_RPC_H
+#define GPS2_RPC_H
+
+#include "gps2.h"
+
+/* big enough for a sky view of four full constellations */
+#ifndef GPS2_RPC_BUFFER_SIZE
+#define GPS2_RPC_BUFFER_SIZE 3072
+#endif
+
+/* register the handlers with the global RPC instance, if there is one */
+bool gps2_rpc_init(void);
+
+#endif /* GPS2_RPC_H */
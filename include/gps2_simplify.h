@@ -0,0 +1,63 @@
+/*
+* Online track simplification. Fixes that lie on the line between their
+* neighbours are dropped, so that on a straight road only the ends go on to
+* the events, the history and the log.
+*
+* This is the opening window algorithm. From the last point sent, the anchor,
+* fixes are held back for as long as every one of them lies in a corridor
+* tolerance wide either side of the line from the anchor to the newest. When a
+* fix breaks the corridor the one before it is sent and becomes the anchor. A
+* point is sent at least every heartbeat_ms while moving in a straight line,
+* and at most GPS2_SIMPLIFY_WINDOW are held, so memory is bounded and a point
+* is never held back for long.
+*
+* Positions are taken relative to the anchor in integers, east scaled by the
+* cosine of its latitude, so there is no floating point per fix.
+*/
+
+#ifndef GPS2_SIMPLIFY_H
+#define GPS2_SIMPLIFY_H
+
+#include "gps2.h"
+
+/* fixes held back at most, 8 bytes each */
+#ifndef GPS2_SIMPLIFY_WINDOW
+#define GPS2_SIMPLIFY_WINDOW 64
+#endif
+
+/* a fix relative to the anchor, in 1e-7 degrees of latitude north and east */
+struct gps2_simplify_offset {
+  int32_t x;
+  int32_t y;
+};
+
+struct gps2_simplify {
+  int32_t tolerance; /* 1e-7 degrees of latitude */
+  int heartbeat_ms; /* 0 for none */
+
+  bool have_anchor;
+  int32_t anchor_latitude_e7;
+  int32_t anchor_longitude_e7;
+  int64_t anchor_ms;
+  int32_t anchor_cos; /* of its latitude, 1 is 32768 */
+
+  /* held back since the anchor, the newest also in full in pending */
+  int count;
+  struct gps2_simplify_offset window[GPS2_SIMPLIFY_WINDOW];
+  struct mgos_gps_location_fixed pending;
+
+  uint32_t fixes;
+  uint32_t sent;
+};
+
+/* a corridor tolerance_m either side, at least one point every heartbeat_ms */
+void gps2_simplify_init(struct gps2_simplify *simplify, int tolerance_m, int heartbeat_ms);
+
+/* add a fix. true, with the point to send in out, if one is due. Never more than one */
+bool gps2_simplify_add(struct gps2_simplify *simplify, const struct mgos_gps_location_fixed *location,
+                       struct mgos_gps_location_fixed *out);
+
+/* the fix being held back, if there is one, e.g. when the fix is lost */
+bool gps2_simplify_flush(struct gps2_simplify *simplify, struct mgos_gps_location_fixed *out);
+
+#endif /* GPS2_SIMPLIFY_H */
@@ -0,0 +1,45 @@
+/*
+* Sky view assembler. Collects the satellites from each cycle of GSV messages
+* into a fixed table per constellation, marks the ones GSA says are used in
+* the fix, and hands the table over once the cycle is complete.
+*/
+
+#ifndef GPS2_SKY_H
+#define GPS2_SKY_H
+
+#include "gps2.h"
+
+/* constellations we keep a table for. Talkers after the first four are ignored */
+#define GPS2_SKY_VIEWS 4
+
+struct gps2_sky {
+  struct mgos_gps_sky_view views[GPS2_SKY_VIEWS]; /* being assembled */
+  struct mgos_gps_sky_view complete[GPS2_SKY_VIEWS]; /* the last complete cycle */
+
+  /* the next GSV message of each view's cycle, 0 while we wait for message 1 */
+  uint8_t next_msg[GPS2_SKY_VIEWS];
+  uint8_t total_msgs[GPS2_SKY_VIEWS];
+
+  /* PRNs GSA has put in the fix, a bit per PRN. GN talkers use used_any, as
+     combined GSA doesn't say which constellation a PRN is from */
+  uint32_t used[GPS2_SKY_VIEWS][8];
+  uint32_t used_any[8];
+
+  bool gsv_since_gsa; /* the next GSA starts a new set */
+};
+
+/* views are tagged with dev */
+void gps2_sky_init(struct gps2_sky *sky, struct gps2 *dev);
+
+/* add a GSV or GSA. Returns the view a GSV completes, valid until the next
+   cycle for that talker completes, or NULL */
+const struct mgos_gps_sky_view *gps2_sky_add(struct gps2_sky *sky, const struct minmea_frame *frame);
+
+/* the complete view of a talker, for sources that deliver a whole view at once
+   (UBX NAV-SAT). Sets index to its gps2_sky_get() index. NULL if the views are full */
+struct mgos_gps_sky_view *gps2_sky_complete_view(struct gps2_sky *sky, const char *talker, int *index);
+
+/* the last complete view of the index'th talker seen, or NULL */
+const struct mgos_gps_sky_view *gps2_sky_get(const struct gps2_sky *sky, int index);
+
+#endif /* GPS2_SKY_H */
@@ -0,0 +1,132 @@
+/*
+* Track history. Fixes are kept in RAM as variable length deltas, for upload
+* after a gap in connectivity.
+*
+* The history is a ring of fixed size blocks. Each block starts with a
+* keyframe, a whole point, and every point after it is stored as zigzag varints
+* of its difference from a prediction: time and position are predicted to move
+* as they did over the last step, speed and course to stay where they were. At
+* a steady 1 Hz on a straight road most fields then take one byte. When the
+* ring is full the oldest block goes, so the history always holds the most
+* recent points.
+*
+* Blocks are in time order, so seeking to a time is a binary search over their
+* keyframes and a decode of at most one block.
+*/
+
+#ifndef GPS2_TRACK_H
+#define GPS2_TRACK_H
+
+#include "gps2.h"
+
+/* bytes of points per block. A keyframe is up to 22 bytes and the deltas on a
+   drive average under 8, so a block holds around 30 points */
+#ifndef GPS2_TRACK_BLOCK_SIZE
+#define GPS2_TRACK_BLOCK_SIZE 240
+#endif
+
+/* the most a point can take: five varints of up to 10 bytes */
+#define GPS2_TRACK_MAX_POINT 50
+
+/* a point in the history. Unknown speed and course are MGOS_GPS_FIXED_UNKNOWN */
+struct gps2_track_point {
+  int64_t time_ms; /* UTC, milliseconds since the epoch */
+  int32_t latitude_e7;
+  int32_t longitude_e7;
+  int32_t speed_e3;
+  int32_t bearing_e2;
+};
+
+struct gps2_track_block {
+  int64_t start_ms; /* time of the keyframe */
+  uint16_t length; /* bytes used in data */
+  uint16_t count; /* points */
+  uint8_t data[GPS2_TRACK_BLOCK_SIZE];
+};
+
+/* the last point and step, the state of the encoder and of each decoder */
+struct gps2_track_cursor {
+  struct gps2_track_point point;
+  int64_t step_ms;
+  int64_t step_latitude;
+  int64_t step_longitude;
+};
+
+struct gps2_track {
+  struct gps2_track_block *blocks;
+  int block_count;
+  int first; /* the oldest block */
+  int used; /* blocks with points, the newest being filled */
+
+  struct gps2_track_cursor last; /* the newest point */
+
+  uint32_t points; /* held */
+  uint32_t evicted; /* dropped with the oldest block */
+  uint32_t rejected; /* older than the newest point */
+};
+
+/* blocks to read, wherever they are kept: the ring or a mapped log */
+struct gps2_track_blocks {
+  const void *arg;
+  size_t count;
+  /* the points of block i, oldest first, and how many there are */
+  const uint8_t *(*points)(const void *arg, size_t i, uint16_t *count);
+  /* the time of block i's keyframe */
+  int64_t (*start_ms)(const void *arg, size_t i);
+};
+
+/* reading blocks, oldest first */
+struct gps2_track_iter {
+  struct gps2_track_blocks blocks;
+  size_t block; /* from the oldest */
+  const uint8_t *data; /* the block's points */
+  uint16_t count; /* points in the block */
+  uint16_t offset; /* into the block's data */
+  uint16_t index; /* of the next point in the block */
+  struct gps2_track_cursor cursor;
+};
+
+/* the point for a fix */
+void gps2_track_point_set(struct gps2_track_point *point, const struct mgos_gps_location_fixed *location);
+
+/* the block codec, shared with gps2_log.h. Add point to block, as its keyframe
+   if the block is empty and otherwise as a delta from cursor, the block's last
+   point. false, with block and cursor unchanged, if it doesn't fit */
+bool gps2_track_block_add(struct gps2_track_block *block, struct gps2_track_cursor *cursor,
+                          const struct gps2_track_point *point);
+
+/* decode the point at p, the keyframe if index is 0, into cursor. Returns the
+   byte after it */
+const uint8_t *gps2_track_block_next(const uint8_t *p, int index, struct gps2_track_cursor *cursor);
+
+/* allocate as many blocks as fit in bytes, at least two. false if that fails */
+bool gps2_track_init(struct gps2_track *track, size_t bytes);
+
+void gps2_track_free(struct gps2_track *track);
+
+/* drop every point */
+void gps2_track_clear(struct gps2_track *track);
+
+/* add a fix. false, and it is counted in rejected, if it is older than the last one */
+bool gps2_track_add(struct gps2_track *track, const struct mgos_gps_location_fixed *location);
+
+/* bytes the points take, counting whole blocks and their headers */
+size_t gps2_track_bytes(const struct gps2_track *track);
+
+/* start at the oldest point of blocks */
+void gps2_track_blocks_iter_init(const struct gps2_track_blocks *blocks, struct gps2_track_iter *iter);
+
+/* start at the first point of blocks at or after time_ms, found with a binary
+   search over the keyframes. false if there isn't one */
+bool gps2_track_blocks_seek(const struct gps2_track_blocks *blocks, struct gps2_track_iter *iter, int64_t time_ms);
+
+/* start at the oldest point in the history */
+void gps2_track_iter_init(const struct gps2_track *track, struct gps2_track_iter *iter);
+
+/* start at the first point in the history at or after time_ms. false if there isn't one */
+bool gps2_track_seek(const struct gps2_track *track, struct gps2_track_iter *iter, int64_t time_ms);
+
+/* the next point, from the history or a log. false at the end */
+bool gps2_track_next(struct gps2_track_iter *iter, struct gps2_track_point *point);
+
+#endif /* GPS2_TRACK_H */
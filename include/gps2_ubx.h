@@ -0,0 +1,58 @@
+/*
+* u-blox UBX binary protocol. Packets are
+*
+*   0xB5 0x62 class id length(2, little endian) payload checksum(2)
+*
+* with an 8-bit Fletcher checksum over class to the end of the payload. The rx
+* path frames them alongside NMEA lines. NAV-PVT carries a whole epoch and is
+* decoded straight into a fix, NAV-SAT into sky views.
+*/
+
+#ifndef GPS2_UBX_H
+#define GPS2_UBX_H
+
+#include "gps2.h"
+#include "gps2_sky.h"
+
+#define GPS2_UBX_SYNC_1 0xB5
+#define GPS2_UBX_SYNC_2 0x62
+
+/* sync, class, id and length, then the checksum */
+#define GPS2_UBX_HEADER_LENGTH 6
+#define GPS2_UBX_OVERHEAD 8
+
+#define GPS2_UBX_CLASS_NAV 0x01
+#define GPS2_UBX_NAV_PVT 0x07
+#define GPS2_UBX_NAV_SAT 0x35
+
+#define GPS2_UBX_CLASS_CFG 0x06
+#define GPS2_UBX_CFG_PRT 0x00
+
+#define GPS2_UBX_NAV_PVT_LENGTH 92
+
+/* a CFG-PRT for a UART, with its 20 byte payload */
+#define GPS2_UBX_CFG_PRT_PACKET (GPS2_UBX_OVERHEAD + 20)
+
+/* largest packet we frame, a NAV-SAT with 40 satellites. Must be less than the
+   receive ring. Longer packets are skipped */
+#ifndef GPS2_UBX_MAX_LENGTH
+#define GPS2_UBX_MAX_LENGTH (GPS2_UBX_OVERHEAD + 8 + 12 * 40)
+#endif
+
+/* true if packet, length bytes from the first sync byte, has a good checksum */
+bool gps2_ubx_check(const uint8_t *packet, size_t length);
+
+/* decode a NAV-PVT payload into fix. The time is UTC, and left at 0 until the
+   receiver has a valid date and time. fix->sentences is 0. false if the payload
+   is too short */
+bool gps2_ubx_nav_pvt(const uint8_t *payload, size_t length, struct mgos_gps_fix *fix);
+
+/* write a CFG-PRT that sets the receiver's UART1 to 8N1 at baud_rate, with UBX
+   and NMEA in and out, to packet. Returns its length, GPS2_UBX_CFG_PRT_PACKET */
+size_t gps2_ubx_cfg_prt(uint8_t *packet, uint32_t baud_rate);
+
+/* replace the complete sky view of each constellation in a NAV-SAT payload. Returns
+   a bit per gps2_sky_get() index that was replaced */
+uint32_t gps2_ubx_nav_sat(const uint8_t *payload, size_t length, struct gps2_sky *sky);
+
+#endif /* GPS2_UBX_H */
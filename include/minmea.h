@@ -36,9 +36,16 @@
      MINMEA_SENTENCE_GST,
      MINMEA_SENTENCE_GSV,
      MINMEA_SENTENCE_VTG,
-     MINMEA_SENTENCE_ZDA
+     MINMEA_SENTENCE_ZDA,
+     // Ids for sentence types added with minmea_register_sentence().
+     MINMEA_SENTENCE_USER = 16,
+     MINMEA_SENTENCE_LAST = 31
  };
  
+ /* Three letter sentence type packed into an integer, e.g. MINMEA_TYPE_CODE('R','M','C'). */
+ #define MINMEA_TYPE_CODE(a, b, c) \
+     (((uint32_t) (uint8_t) (a) << 16) | ((uint32_t) (uint8_t) (b) << 8) | (uint32_t) (uint8_t) (c))
+ 
  struct minmea_float {
      int_least32_t value;
      int_least32_t scale;
@@ -164,6 +171,22 @@
      int minute_offset;
  };
 
+ /* Result of minmea_parse(). The member of data that is filled depends on id. */
+ struct minmea_frame {
+     enum minmea_sentence_id id;
+     char talker[3];
+     union {
+         struct minmea_sentence_rmc rmc;
+         struct minmea_sentence_gga gga;
+         struct minmea_sentence_gsa gsa;
+         struct minmea_sentence_gll gll;
+         struct minmea_sentence_gst gst;
+         struct minmea_sentence_gsv gsv;
+         struct minmea_sentence_vtg vtg;
+         struct minmea_sentence_zda zda;
+     } data;
+ };
+
 
 
 
@@ -177,6 +200,20 @@
   */
  bool minmea_check(const char *sentence, bool strict);
  
+ /**
+  * Bulk kernels behind minmea_check() and minmea_scan(), also usable directly
+  * when processing large volumes of sentences. AVX2 or SSE2 on x86 hosts,
+  * 32-bit SWAR elsewhere.
+  *
+  * minmea_xor() returns the XOR of length bytes.
+  * minmea_printable_length() returns the number of printable bytes at the start of data.
+  * minmea_delimiters() sets bit n of word n / 32 for byte n in each of the
+  * bitmaps, which must hold (length + 31) / 32 words.
+  */
+ uint8_t minmea_xor(const char *data, size_t length);
+ size_t minmea_printable_length(const char *data, size_t length);
+ void minmea_delimiters(const char *data, size_t length, uint32_t *commas, uint32_t *asterisks, uint32_t *unprintable);
+ 
  /**
   * Determine talker identifier.
   */
@@ -187,6 +224,20 @@
   */
  enum minmea_sentence_id minmea_sentence_id(const char *sentence, bool strict);
  
+ /**
+  * Determine sentence identifier from the "$ttsss" header alone, in constant
+  * time. Does not check sentence integrity.
+  */
+ enum minmea_sentence_id minmea_peek_sentence_id(const char *sentence);
+ 
+ /**
+  * Add a sentence type, e.g. "HDT", to the identifier lookup. id must be
+  * between MINMEA_SENTENCE_USER and MINMEA_SENTENCE_LAST. Registered sentences
+  * are identified and validated by minmea_parse() but not parsed.
+  * Returns false if the table is full or the type is already taken.
+  */
+ bool minmea_register_sentence(const char *type, enum minmea_sentence_id id);
+ 
  /**
   * Scanf-like processor for NMEA sentences. Supports the following formats:
   * c - single character (char *)
@@ -212,15 +263,32 @@
  bool minmea_parse_vtg(struct minmea_sentence_vtg *frame, const char *sentence);
  bool minmea_parse_zda(struct minmea_sentence_zda *frame, const char *sentence);
 
+ /**
+  * Validate, identify and parse a sentence in a single pass over its bytes.
+  * frame->id is set to what minmea_sentence_id() would return, except that
+  * unknown and proprietary sentences are identified from the header and
+  * rejected without being validated. Returns true if the sentence is one of
+  * the types above and the matching member of frame->data was filled, with
+  * the same result as minmea_parse_*().
+  */
+ bool minmea_parse(struct minmea_frame *frame, const char *sentence, bool strict);
+
  /**
   * Convert GPS UTC date/time representation to a UNIX timestamp.
+  * The result is UTC whatever the local timezone is.
   */
  int minmea_gettime(struct timespec *ts, const struct minmea_date *date, const struct minmea_time *time_);
+
+ /**
+  * Days from 1970-01-01 to a date in the proleptic Gregorian calendar, in
+  * constant time and without the timezone. month is 1-12, year is the full year.
+  */
+ int_least32_t minmea_days_from_civil(int year, int month, int day);
  
  /**
   * Rescale a fixed-point value to a different scale. Rounds towards zero.
   */
- static inline int_least32_t minmea_rescale(struct minmea_float *f, int_least32_t new_scale)
+ static inline int_least32_t minmea_rescale(const struct minmea_float *f, int_least32_t new_scale)
  {
      if (f->scale == 0)
          return 0;
@@ -236,7 +304,7 @@
   * Convert a fixed-point value to a floating-point value.
   * Returns NaN for "unknown" values.
   */
- static inline float minmea_tofloat(struct minmea_float *f)
+ static inline float minmea_tofloat(const struct minmea_float *f)
  {
      if (f->scale == 0)
          return NAN;
@@ -247,7 +315,7 @@
   * Convert a raw coordinate to a floating point DD.DDD... value.
   * Returns NaN for "unknown" values.
   */
- static inline float minmea_tocoord(struct minmea_float *f)
+ static inline float minmea_tocoord(const struct minmea_float *f)
  {
      if (f->scale == 0)
          return NAN;
@@ -256,6 +324,25 @@
      return (float) degrees + (float) minutes / (60 * f->scale);
  }
  
+ /**
+  * Convert a raw coordinate to degrees scaled by 1e7 (DD.DDDDDDD) using only
+  * 32-bit integer arithmetic. Rounds to nearest, which is within 1 cm.
+  * Returns 0 for "unknown" values.
+  */
+ static inline int_least32_t minmea_tocoord_e7(const struct minmea_float *f)
+ {
+     if (f->scale <= 0)
+         return 0;
+     int_least32_t degrees = f->value / (f->scale * 100);
+     int_least32_t minutes = f->value % (f->scale * 100);
+     // minutes * 1e7 / scale is below 6e8 for any scale up to 1e7, so it fits
+     if (f->scale <= 10000000)
+         minutes *= 10000000 / f->scale;
+     else
+         minutes /= f->scale / 10000000;
+     return degrees * 10000000 + (minutes + (minutes < 0 ? -30 : 30)) / 60;
+ }
+ 
  #ifdef __cplusplus
  }
  #endif
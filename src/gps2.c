@@ -23,69 +23,562 @@
 
 
 #include "minmea.h"
+#include "gps2_epoch.h"
+#include "gps2_sky.h"
+#include "gps2_rpc.h"
+#include "gps2_ubx.h"
+#include "gps2_pmtk.h"
+#include "gps2_track.h"
+#include "gps2_log.h"
+#include "gps2_simplify.h"
 
 #define CURRENT_CENTURY 2000
 
+/* the PMTK command queue, see gps2_pmtk.h */
+#ifndef GPS2_PMTK
 #define GPS2_PMTK 1
+#endif
+
+
+/* size of the receive ring. Must be a power of two */
+#define GPS2_RX_RING_SIZE 512
+
+/* size of the transmit ring. Must be a power of two, and hold the longest
+command with room for a few more */
+#ifndef GPS2_TX_RING_SIZE
+#define GPS2_TX_RING_SIZE 256
+#endif
+
+/* longest line we will frame. NMEA sentences are at most 82 characters, but 
+some proprietary sentences are longer */
+#define GPS2_MAX_LINE_LENGTH 128
+
+
+/* frame u-blox UBX packets as well as NMEA lines, see gps2_ubx.h */
+#ifndef GPS2_UBX
+#define GPS2_UBX 1
+#endif
+
+/* a message that wraps the end of the ring is copied out to one this long */
+#if GPS2_UBX && GPS2_UBX_MAX_LENGTH > GPS2_MAX_LINE_LENGTH + 1
+#define GPS2_RX_FRAME_LENGTH GPS2_UBX_MAX_LENGTH
+#else
+#define GPS2_RX_FRAME_LENGTH (GPS2_MAX_LINE_LENGTH + 1)
+#endif
+
+
+/* counters and timing histograms, see struct gps2_stats. Set GPS2_STATS to 0 in
+cdefs to compile them out */
+#ifndef GPS2_STATS
+#define GPS2_STATS 1
+#endif
+
+/* reading the clock costs more than everything else the stats do, so only one
+in this many lines and dispatcher runs is timed. A power of two */
+#ifndef GPS2_STATS_SAMPLE
+#define GPS2_STATS_SAMPLE 16
+#endif
+
+#if GPS2_STATS
+#define GPS2_STAT_INC(dev, field) ((dev)->stats.field++)
+#define GPS2_STAT_ADD(dev, field, n) ((dev)->stats.field += (n))
+#define GPS2_STAT_SAMPLED(count) (((count) & (GPS2_STATS_SAMPLE - 1)) == 0)
+/* 0 if this run isn't being timed */
+#define GPS2_STAT_START(dev) ((dev)->stats_sampling ? mgos_uptime_micros() : 0)
+#define GPS2_STAT_TIME(dev, histogram, start) \
+  do { \
+    if ((start) != 0) gps2_histogram_add(&(dev)->stats.histogram, mgos_uptime_micros() - (start)); \
+  } while (0)
+#else
+#define GPS2_STAT_INC(dev, field) ((void) 0)
+#define GPS2_STAT_ADD(dev, field, n) ((void) (n))
+#define GPS2_STAT_SAMPLED(count) false
+#define GPS2_STAT_START(dev) 0
+#define GPS2_STAT_TIME(dev, histogram, start) ((void) (start))
+#endif
+
+
+/* fixed size receive ring. The UART is read straight into the ring and lines
+are handed to the parser in place. The indexes are free running and are masked
+when we access the buffer */
+
+struct gps2_rx_ring {
+  char buf[GPS2_RX_RING_SIZE];
+
+  /* a line or packet that wraps around the end of the ring is copied here so
+  that the parser always sees it contiguous */
+  char line[GPS2_RX_FRAME_LENGTH];
+
+  size_t head; /* where the next byte from the UART is written */
+  size_t tail; /* start of the line we are currently framing */
+  size_t scan; /* next byte to check for a terminator */
+
+  size_t high_water; /* most bytes we have held */
+
+#if GPS2_UBX
+  size_t skip; /* bytes of a packet too long to frame that are still to come */
+  bool resync; /* after a bad packet, drop bytes up to the next '$' or sync */
+#endif
+};
+
+
+/* commands waiting for room in the UART's tx buffer. They are copied in whole
+or not at all, so the receiver never sees half a command, and the dispatcher
+writes out what the UART will take without waiting for it */
+
+struct gps2_tx_ring {
+  char buf[GPS2_TX_RING_SIZE];
+  size_t head; /* where the next byte is queued */
+  size_t tail; /* the next byte to write to the UART */
+};
+
+
+/* the latest location is written by the UART dispatcher and may be read from
+other tasks. It is double buffered: the dispatcher fills the slot which is not
+published and then bumps the sequence number, which selects the published slot.
+A reader copies the published slot and checks the sequence number hasn't moved,
+so it never waits for the dispatcher and never sees half a fix */
+
+struct gps2_location_snapshot {
+  uint32_t seq; /* number of fixes published. Slot seq & 1 is the latest */
+  struct mgos_gps_location_fixed slot[2];
+};
+
+
+/* fixes collected for MGOS_EV_GPS_LOCATION_BATCH. The array is allocated when
+batching is turned on and sent from the start once it holds size fixes, or
+timeout_ms after the first fix went in, so it is always contiguous */
+
+struct gps2_location_batch {
+  struct mgos_gps_location_fixed *locations; /* NULL while a batch is being sent */
+  int count;
+  int size; /* fixes per batch, 0 when batching is off */
+  int timeout_ms;
+  mgos_timer_id timer;
+};
+
+
+/* gps2_start_device_autobaud. Each baud rate gets GPS2_AUTOBAUD_PROBE_MS to
+deliver GPS2_AUTOBAUD_LINES good sentences, longer than a 1 Hz receiver's epoch */
+
+#ifndef GPS2_AUTOBAUD_PROBE_MS
+#define GPS2_AUTOBAUD_PROBE_MS 1500
+#endif
+
+#ifndef GPS2_AUTOBAUD_LINES
+#define GPS2_AUTOBAUD_LINES 2
+#endif
+
+/* tried after the configured rate, most common first */
+#ifndef GPS2_AUTOBAUD_RATES
+#define GPS2_AUTOBAUD_RATES 9600, 115200, 38400, 57600, 4800, 19200, 230400
+#endif
+
+/* time for the baud rate commands to leave the UART before it changes rate */
+#define GPS2_AUTOBAUD_SWITCH_MS 100
+
+enum gps2_autobaud_state {
+  GPS2_AUTOBAUD_IDLE,
+  GPS2_AUTOBAUD_PROBE, /* listening at rates[rate] */
+  GPS2_AUTOBAUD_COMMAND, /* the receiver has been told to change */
+  GPS2_AUTOBAUD_VERIFY, /* listening at the new rate */
+  GPS2_AUTOBAUD_FALLBACK /* listening at the old rate again */
+};
+
+struct gps2_autobaud {
+  enum gps2_autobaud_state state;
+  int rate; /* index into gps2_autobaud_rates, -1 for the rate we started at */
+  int lines; /* good sentences at the current rate */
+  int start_baud;
+  int detected_baud;
+  int target_baud;
+  int64_t started;
+  mgos_timer_id timer;
+};
+
+
+/* gps2_set_device_disconnect_timeout. The rx path only counts good sentences
+and packets. A timer compares the count GPS2_LINK_TICKS times per timeout, so
+the link goes down between 1 and 1 + 1/GPS2_LINK_TICKS timeouts after the
+last good one, without the rx path reading the clock */
+
+#ifndef GPS2_LINK_TICKS
+#define GPS2_LINK_TICKS 4
+#endif
+
+/* recovery is tried as the link goes down, again two timeouts later, and then
+at doubling intervals up to this */
+#ifndef GPS2_LINK_RECOVERY_MAX_MS
+#define GPS2_LINK_RECOVERY_MAX_MS 60000
+#endif
+
+struct gps2_link {
+  int timeout_ms; /* 0 when the link isn't watched */
+  uint32_t good; /* good sentences and packets */
+  uint32_t good_seen; /* good at the last tick */
+  uint32_t quiet_ticks; /* ticks since good last moved */
+  uint32_t recover_ticks; /* quiet_ticks at the next recovery */
+  uint32_t recover_interval; /* ticks, doubled after each recovery */
+  bool connected;
+  bool fix;
+  uint32_t disconnects;
+  uint32_t recoveries;
+  int64_t down_since;
+  int recover_baud; /* the last rate asked of gps2_start_device_autobaud */
+  const void *reconnect_commands;
+  size_t reconnect_length;
+  mgos_timer_id timer;
+};
 
 
 struct gps2 {
   uint8_t uart_no;
+  uint8_t id; /* index in gps2_devices */
   void *handler_user_data; 
 
-  struct mbuf *uart_rx_buffer;
-  struct mbuf *uart_tx_buffer; 
+  struct gps2_rx_ring rx_ring;
+  struct gps2_tx_ring tx_ring;
   struct mgos_uart_config  uart_config;
 
-  struct mgos_gps_location latest_location;
+  struct gps2_location_snapshot latest_location;
+
+  struct gps2_location_batch location_batch;
+
+  /* every fix, delta compressed, when track.blocks is set */
+  struct gps2_track track;
+
+  /* every fix appended to a file, when set */
+  struct gps2_log *log;
+
+  /* only the fixes off a straight line go on past gps2_publish_location, when set */
+  struct gps2_simplify *simplify;
+
+  struct gps2_stats stats;
+  bool stats_sampling; /* time the line being processed */
+
+  /* sentence types to send MGOS_EV_GPS_NMEA_SENTENCE for, if set with 
+  gps2_set_device_sentence_mask */
+  uint64_t sentence_mask;
+  bool sentence_mask_explicit;
+
+  /* merges each epoch into MGOS_EV_GPS_FIX */
+  struct gps2_epoch epoch;
+  uint64_t fix_sentences;
+
+  /* assembles GSV cycles into MGOS_EV_GPS_SKY_VIEW when sky_sentences is set */
+  struct gps2_sky sky;
+  uint64_t sky_sentences;
+
+  /* the last MGOS_EV_GPS_FIX, for readers between events */
+  struct mgos_gps_fix latest_fix;
+  bool have_fix;
+
+#if GPS2_PMTK
+  /* commands from gps2_send_device_pmtk, the first in flight once it is sent */
+  struct gps2_pmtk_queue pmtk;
+#endif
+
+  struct gps2_autobaud autobaud;
+
+  /* link health, see gps2_set_device_disconnect_timeout */
+  struct gps2_link link;
+
+  /* for time to first sentence. Until there has been one, and while autobaud
+  runs, every line's checksum is checked before the header filter */
+  int64_t created;
+  int32_t first_sentence_ms;
+
+  /* the date of the last fix and its days since the epoch, so that fixes on the
+  same day only need the time of day adding */
+  struct minmea_date utc_date;
+  int32_t utc_days;
 
 };
 
 
 static struct gps2 *global_gps_device;
 
+/* every device by id, and by UART number */
+static struct gps2 *gps2_devices[GPS2_MAX_DEVICES];
+static struct gps2 *gps2_uart_devices[GPS2_MAX_UARTS];
+
+
+
+#if GPS2_STATS
+/* bucket 0 counts times under 1us, bucket i times from 2^(i-1) up to 2^i us,
+   and the last bucket everything longer */
+static void gps2_histogram_add(struct gps2_histogram *histogram, int64_t micros) {
+  uint32_t us = micros > 0 ? (micros < UINT32_MAX ? (uint32_t) micros : UINT32_MAX) : 0;
+  int bucket = us == 0 ? 0 : 32 - __builtin_clz(us);
+
+  if (bucket >= GPS2_HISTOGRAM_BUCKETS) {
+    bucket = GPS2_HISTOGRAM_BUCKETS - 1;
+  }
+  histogram->buckets[bucket]++;
+  if (us > histogram->max_us) {
+    histogram->max_us = us;
+  }
+}
+#endif
+
+/* all our events go through here so they are counted and timed */
+static void gps2_trigger(struct gps2 *dev, int ev, void *ev_data) {
+  int64_t start = GPS2_STAT_START(dev);
+
+  mgos_event_trigger(ev, ev_data);
+
+  GPS2_STAT_INC(dev, events);
+  GPS2_STAT_TIME(dev, handler_us, start);
+}
+
+/* sentence types the driver parses for itself, whether or not anyone has subscribed */
+#define GPS2_PROCESSED_SENTENCES GPS2_SENTENCE_BIT(MINMEA_SENTENCE_RMC)
+
+
+/* handlers added with gps2_add_sentence_handler. Until there is one, every 
+sentence is sent to MGOS_EV_GPS_NMEA_SENTENCE as before */
+
+struct gps2_sentence_handler {
+  uint64_t mask;
+  mgos_event_handler_t cb;
+  void *userdata;
+};
+
+static uint64_t handler_sentence_mask = GPS2_SENTENCE_MASK_ALL;
+static bool have_sentence_handlers;
+
+#if GPS2_PMTK
+static void gps2_pmtk_ack(struct gps2 *dev, const char *line);
+#endif
+static void gps2_link_good(struct gps2 *dev);
+static void gps2_link_up(struct gps2 *dev);
+static void gps2_link_fix_changed(struct gps2 *dev, bool fix);
+
+/* a good sentence or packet. All the watchdog costs the rx path is the count.
+   connected and fix are kept whether or not the link is watched, only going
+   down needs the timer */
+static inline void gps2_link_alive(struct gps2 *dev) {
+  dev->link.good++;
+  if (!dev->link.connected) {
+    gps2_link_up(dev);
+  }
+}
+
+static inline void gps2_link_fix(struct gps2 *dev, bool fix) {
+  if (fix != dev->link.fix) {
+    gps2_link_fix_changed(dev, fix);
+  }
+}
+
+
+
+/* only the UART dispatcher publishes, so there is a single writer */
+static void gps2_publish_location(struct gps2 *dev, const struct mgos_gps_location_fixed *location) {
+  struct gps2_location_snapshot *snapshot = &dev->latest_location;
+  uint32_t seq = snapshot->seq + 1;
+
+  /* the last sequence number must be seen before this slot is overwritten,
+  pairing with the reader's fence, or a reader of the slot from two fixes ago
+  could copy it half written and still pass its recheck */
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  snapshot->slot[seq & 1] = *location;
+
+  /* the slot must be complete before the new sequence number is seen */
+  __atomic_store_n(&snapshot->seq, seq, __ATOMIC_RELEASE);
+}
+
+/* copy the latest location. Returns its sequence number, 0 if there hasn't been a fix */
+static uint32_t gps2_read_location(struct gps2 *dev, struct mgos_gps_location_fixed *location) {
+  struct gps2_location_snapshot *snapshot = &dev->latest_location;
+  uint32_t seq;
+
+  do {
+    seq = __atomic_load_n(&snapshot->seq, __ATOMIC_ACQUIRE);
+    *location = snapshot->slot[seq & 1];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    /* if another fix was published while we copied, the dispatcher may have
+       started writing our slot again */
+  } while (__atomic_load_n(&snapshot->seq, __ATOMIC_RELAXED) != seq);
+
+  return seq;
+}
+
+
 
 
+static void gps2_location_batch_send(struct gps2 *dev) {
+  struct gps2_location_batch *batch = &dev->location_batch;
+  struct mgos_gps_location_batch ev_data;
+  struct mgos_gps_location_fixed *locations = batch->locations;
 
+  if (batch->timer != MGOS_INVALID_TIMER_ID) {
+    mgos_clear_timer(batch->timer);
+    batch->timer = MGOS_INVALID_TIMER_ID;
+  }
+
+  if (batch->count == 0) {
+    return;
+  }
+
+  ev_data.dev = dev;
+  ev_data.count = batch->count;
+  ev_data.locations = locations;
+
+  /* the array goes out with the event. A handler may change the batch size or
+  add a fix, which then gets an array of its own */
+  batch->count = 0;
+  batch->locations = NULL;
+  gps2_trigger(dev, MGOS_EV_GPS_LOCATION_BATCH, &ev_data);
+
+  if (batch->locations == NULL && batch->size > 0) {
+    batch->locations = locations;
+  } else {
+    free(locations);
+  }
+}
+
+static void gps2_location_batch_timer_cb(void *arg) {
+  struct gps2 *dev = arg;
+
+  dev->location_batch.timer = MGOS_INVALID_TIMER_ID;
+  gps2_location_batch_send(dev);
+}
+
+static void gps2_location_batch_add(struct gps2 *dev, const struct mgos_gps_location_fixed *location) {
+  struct gps2_location_batch *batch = &dev->location_batch;
+
+  if (batch->locations == NULL) {
+    /* from a handler of the batch being sent */
+    batch->locations = malloc(batch->size * sizeof(struct mgos_gps_location_fixed));
+    if (batch->locations == NULL) {
+      return;
+    }
+  }
+  batch->locations[batch->count++] = *location;
+
+  if (batch->count >= batch->size) {
+    gps2_location_batch_send(dev);
+  } else if (batch->count == 1 && batch->timeout_ms > 0) {
+    batch->timer = mgos_set_timer(batch->timeout_ms, 0, gps2_location_batch_timer_cb, dev);
+  }
+}
+
+/* UTC seconds since the epoch. NMEA years are two digits */
+static time_t gps2_utc_time(struct gps2 *dev, const struct minmea_date *date, const struct minmea_time *time) {
+  if (date->year < 0 || date->month < 1 || date->month > 12 || time->hours < 0) {
+    return 0;
+  }
+
+  if (date->day != dev->utc_date.day || date->month != dev->utc_date.month
+      || date->year != dev->utc_date.year) {
+    dev->utc_days = minmea_days_from_civil(CURRENT_CENTURY + date->year, date->month, date->day);
+    dev->utc_date = *date;
+  }
+
+  return (time_t) dev->utc_days * 86400 + time->hours * 3600 + time->minutes * 60 + time->seconds;
+}
+
+/* keep a fix and send its events, or add it to the batch */
+static void gps2_location_send(struct gps2 *dev, struct mgos_gps_location_fixed *location) {
+#if GPS2_LOCATION_FLOAT
+  struct mgos_gps_location float_location;
+#endif
+
+  if (dev->track.blocks != NULL) {
+    gps2_track_add(&dev->track, location);
+  }
+  if (dev->log != NULL) {
+    gps2_log_add(dev->log, location);
+  }
+
+  if (dev->location_batch.size > 0) {
+    /* the location events go out together */
+    gps2_location_batch_add(dev, location);
+    return;
+  }
+
+  gps2_trigger(dev, MGOS_EV_GPS_LOCATION_FIXED, location);
+
+#if GPS2_LOCATION_FLOAT
+  gps2_location_from_fixed(location, &float_location);
+  gps2_trigger(dev, MGOS_EV_GPS_LOCATION, &float_location);
+#endif
+}
+
+/* publish a new location, and send it on unless it is on a straight line */
+static void gps2_location_ready(struct gps2 *dev, struct mgos_gps_location_fixed *location) {
+  struct mgos_gps_location_fixed significant;
+
+  gps2_publish_location(dev, location);
+
+  if (dev->simplify != NULL) {
+    if (!gps2_simplify_add(dev->simplify, location, &significant)) {
+      return;
+    }
+    location = &significant;
+  }
+  gps2_location_send(dev, location);
+}
+
+/* no fix in this epoch, so the last point held back is where the track ends */
+static inline void gps2_location_lost(struct gps2 *dev) {
+  if (dev->simplify != NULL && dev->simplify->count > 0) {
+    gps2_flush_device_simplify(dev);
+  }
+}
 
 void process_rmc_frame(struct gps2 *dev, struct minmea_sentence_rmc rmc_frame) {
-  struct mgos_gps_location location;
-  struct tm time;
+  struct mgos_gps_location_fixed location;
 
   LOG(LL_DEBUG,("Processing RMC frame"));
+  gps2_link_fix(dev, rmc_frame.valid);
   /* lon and lat */
 
   /* check we have a fix */
   if (rmc_frame.valid == true) {
 
-    time.tm_year = rmc_frame.date.year + 100;
-    time.tm_mon = rmc_frame.date.month - 1;
-    time.tm_mday = rmc_frame.date.day;
-    
-    time.tm_hour = rmc_frame.time.hours;
-    time.tm_min = rmc_frame.time.minutes;
-    time.tm_sec = rmc_frame.time.seconds;
-    
-
-    location.time = mktime(&time);
+    location.dev = dev;
+    location.time = gps2_utc_time(dev, &rmc_frame.date, &rmc_frame.time);
 
     location.microseconds = rmc_frame.time.microseconds;
 
 
-    location.longitude = minmea_tocoord(&(rmc_frame.longitude));
-    location.latitude = minmea_tocoord(&(rmc_frame.latitude));
-    location.speed = minmea_tofloat(&(rmc_frame.speed));    
-    location.bearing = minmea_tofloat(&(rmc_frame.course));
-    location.variation = minmea_tofloat(&(rmc_frame.variation));
+    /* integers all the way, there may not be an FPU */
+    location.longitude_e7 = gps2_fixed_coord(&(rmc_frame.longitude));
+    location.latitude_e7 = gps2_fixed_coord(&(rmc_frame.latitude));
+    location.speed_e3 = gps2_fixed(&(rmc_frame.speed), 1000);
+    location.bearing_e2 = gps2_fixed(&(rmc_frame.course), 100);
+    location.variation_e2 = gps2_fixed(&(rmc_frame.variation), 100);
     
     
     location.elapsed_time = mgos_uptime_micros();
 
-    dev->latest_location = location;
+    gps2_location_ready(dev, &location);
+  } else {
+    gps2_location_lost(dev);
+  }
+}
+
+/* an epoch is complete, finish the fix and send it */
+static void gps2_fix_ready(const struct gps2_epoch *epoch, struct mgos_gps_fix *fix, void *arg) {
+  struct gps2 *dev = arg;
 
-    mgos_event_trigger(MGOS_EV_GPS_LOCATION,&location);
+  fix->time = gps2_utc_time(dev, &epoch->date, &epoch->time);
+  fix->microseconds = epoch->time.microseconds;
+  fix->dev = dev;
 
+  dev->latest_fix = *fix;
+  dev->have_fix = true;
+
+  gps2_trigger(dev, MGOS_EV_GPS_FIX, fix);
+}
+
+/* sentence types the device sends events for */
+static uint64_t gps2_event_sentence_mask(struct gps2 *gps_dev) {
+  if (gps_dev->sentence_mask_explicit) {
+    return gps_dev->sentence_mask;
   }
+  return handler_sentence_mask;
 }
 
 void parseNmeaString(struct mg_str line, struct gps2 *gps_dev) {
@@ -93,28 +586,80 @@ void parseNmeaString(struct mg_str line, struct gps2 *gps_dev) {
 
   struct mgos_gps_nmea_sentence sentence;
 
-  enum minmea_sentence_id sentence_id;
+  struct minmea_frame frame;
+  bool parsed;
+  uint64_t event_mask;
+  const struct mgos_gps_sky_view *sky_view;
+  enum minmea_sentence_id peek_id;
+  int64_t start;
 
-  
-  /* parse the sentence */
-  sentence_id = minmea_sentence_id(line.p, false);
+  event_mask = gps2_event_sentence_mask(gps_dev);
+  peek_id = minmea_peek_sentence_id(line.p);
+
+  if ((gps_dev->first_sentence_ms < 0 || gps_dev->autobaud.state != GPS2_AUTOBAUD_IDLE)
+      && minmea_check(line.p, true)) {
+    gps2_link_good(gps_dev);
+  }
+
+  if (peek_id == MINMEA_UNKNOWN) {
+    GPS2_STAT_INC(gps_dev, unknown_lines);
+  } else if (peek_id == MINMEA_SENTENCE_PROPRIETARY) {
+    GPS2_STAT_INC(gps_dev, proprietary_lines);
+#if GPS2_PMTK
+    if (gps_dev->pmtk.sent) {
+      gps2_pmtk_ack(gps_dev, line.p);
+    }
+#endif
+  }
 
-  sentence.sentence_id = sentence_id;
-  sentence.nmea_string = line.p;
+  /* drop sentences nobody wants on the header alone, before the checksum or parse */
+  if (!((event_mask | GPS2_PROCESSED_SENTENCES | gps_dev->fix_sentences | gps_dev->sky_sentences)
+        & GPS2_SENTENCE_BIT(peek_id))) {
+    GPS2_STAT_INC(gps_dev, filtered_lines);
+    return;
+  }
   
-  mgos_event_trigger(MGOS_EV_GPS_NMEA_SENTENCE, &sentence);
+  /* validate, identify and parse the sentence in one pass */
+  start = GPS2_STAT_START(gps_dev);
+  parsed = minmea_parse(&frame, line.p, false);
+  GPS2_STAT_TIME(gps_dev, parse_us, start);
+
+  if (!parsed) {
+    if (frame.id == MINMEA_INVALID) {
+      /* bad checksum, bad characters or too long */
+      GPS2_STAT_INC(gps_dev, checksum_failures);
+    } else if (frame.id > MINMEA_UNKNOWN && frame.id < MINMEA_SENTENCE_USER) {
+      GPS2_STAT_INC(gps_dev, parse_failures[frame.id]);
+    }
+  }
 
+  if (event_mask & GPS2_SENTENCE_BIT(frame.id)) {
+    sentence.dev = gps_dev;
+    sentence.sentence_id = frame.id;
+    sentence.nmea_string = line.p;
   
+    gps2_trigger(gps_dev, MGOS_EV_GPS_NMEA_SENTENCE, &sentence);
+  }
 
-  switch (sentence_id) {
-    case MINMEA_SENTENCE_RMC: {
-      struct minmea_sentence_rmc frame;
-      if (minmea_parse_rmc(&frame, line.p)) {
-        process_rmc_frame(gps_dev, frame);
-          /* fire the trigger for the RMC sentence */
-          
+  if (!parsed) {
+    return;
+  }
+  gps2_link_alive(gps_dev);
 
-      }
+  if (gps_dev->fix_sentences & GPS2_SENTENCE_BIT(frame.id)) {
+    gps2_epoch_add(&gps_dev->epoch, &frame, gps2_fix_ready, gps_dev);
+  }
+
+  if (gps_dev->sky_sentences & GPS2_SENTENCE_BIT(frame.id)) {
+    sky_view = gps2_sky_add(&gps_dev->sky, &frame);
+    if (sky_view != NULL) {
+      gps2_trigger(gps_dev, MGOS_EV_GPS_SKY_VIEW, (void *) sky_view);
+    }
+  }
+
+  switch (frame.id) {
+    case MINMEA_SENTENCE_RMC: {
+      process_rmc_frame(gps_dev, frame.data.rmc);
     } break;
     default: {
       /* do nothing */
@@ -122,9 +667,6 @@ void parseNmeaString(struct mg_str line, struct gps2 *gps_dev) {
     } break;
   }
 
-  
-  (void)gps_dev;
-
 }
 
 
@@ -132,60 +674,311 @@ void parseNmeaString(struct mg_str line, struct gps2 *gps_dev) {
 
 
 /*
-* NMEA strings end CR LF i.e. "\n"
+* NMEA strings end CR LF i.e. "\r\n"
 * see https://en.wikipedia.org/wiki/NMEA_0183
+*
+* The terminator is replaced with a NUL in the ring so the parser gets a C string
+* without us allocating or copying. We accept a bare "\n" as well as "\r\n".
 */
 
-void gps2_uart_rx_callback(int uart_no, struct gps2 *gps_dev, size_t rx_available) {
-  struct mg_str line_buffer;
-  struct mg_str line_buffer_nul;
+static void gps2_rx_ring_frame_line(struct gps2 *gps_dev, size_t terminator) {
+  struct gps2_rx_ring *ring = &gps_dev->rx_ring;
   size_t line_length;
-  const char *terminator_ptr;  
-  
+  size_t start;
+  size_t first_part;
+  char *line;
+
+  /* drop the CR if we have one */
+  line_length = terminator - ring->tail;
+  if (line_length > 0 && ring->buf[(terminator - 1) & (GPS2_RX_RING_SIZE - 1)] == '\r') {
+    line_length--;
+  }
 
-  const struct mg_str crlf = mg_mk_str("\r\n");
+  if (line_length == 0 || line_length > GPS2_MAX_LINE_LENGTH) {
+    /* empty line or something which can't be NMEA */
+    GPS2_STAT_INC(gps_dev, lines_dropped);
+    return;
+  }
 
-  /* read the UART into our line buffer. */
-  mgos_uart_read_mbuf(uart_no,gps_dev->uart_rx_buffer,rx_available);
+  GPS2_STAT_INC(gps_dev, lines);
+  gps_dev->stats_sampling = GPS2_STAT_SAMPLED(gps_dev->stats.lines);
 
+  start = ring->tail & (GPS2_RX_RING_SIZE - 1);
 
-  /* if we've got anything in the buffer, look for the first "\n" */
-  if (gps_dev->uart_rx_buffer->len > 0) {
+  if (start + line_length < GPS2_RX_RING_SIZE) {
+    /* contiguous, so terminate it in place */
+    line = ring->buf + start;
+    line[line_length] = '\0';
+  } else {
+    /* the line wraps the end of the ring, so stitch the two parts together */
+    first_part = GPS2_RX_RING_SIZE - start;
+    line = ring->line;
+    memcpy(line, ring->buf + start, first_part);
+    memcpy(line + first_part, ring->buf, line_length - first_part);
+    line[line_length] = '\0';
+  }
 
-    
-    /* Look for a CRLF */
-    line_buffer = mg_mk_str_n(gps_dev->uart_rx_buffer->buf,gps_dev->uart_rx_buffer->len);
-    terminator_ptr = mg_strstr(line_buffer, crlf);
-      
-    while (terminator_ptr != NULL)
-    {
-      
-      /* calculate the length of the line using pointer arithmetic */
-      line_length = crlf.len + (terminator_ptr - gps_dev->uart_rx_buffer->buf);
+  parseNmeaString(mg_mk_str_n(line, line_length), gps_dev);
+}
 
-      
-      /* create a string from the line. */
-      line_buffer = mg_mk_str_n(gps_dev->uart_rx_buffer->buf, line_length);
+#if GPS2_UBX
+/* a framed UBX packet with a good checksum */
+static void gps2_process_ubx(struct gps2 *gps_dev, const uint8_t *packet, size_t length) {
+  const uint8_t *payload = packet + GPS2_UBX_HEADER_LENGTH;
+  size_t payload_length = length - GPS2_UBX_OVERHEAD;
+  struct mgos_gps_location_fixed location;
+  struct mgos_gps_fix fix;
+  uint32_t replaced;
+  int64_t start;
+  int i;
+
+  if (packet[2] != GPS2_UBX_CLASS_NAV) {
+    return;
+  }
 
-      line_buffer_nul = mg_strdup_nul(line_buffer);
-      
-      /* parse the line */
-      parseNmeaString(line_buffer_nul, gps_dev);
+  switch (packet[3]) {
+    case GPS2_UBX_NAV_PVT:
+      start = GPS2_STAT_START(gps_dev);
+      if (!gps2_ubx_nav_pvt(payload, payload_length, &fix)) {
+        return;
+      }
+      GPS2_STAT_TIME(gps_dev, parse_us, start);
+      fix.dev = gps_dev;
+      gps2_link_fix(gps_dev, fix.valid);
+
+      /* a whole epoch, so the location and the fix come together */
+      if (fix.valid && fix.latitude_e7 != MGOS_GPS_FIXED_UNKNOWN) {
+        location.dev = gps_dev;
+        location.latitude_e7 = fix.latitude_e7;
+        location.longitude_e7 = fix.longitude_e7;
+        location.bearing_e2 = fix.bearing_e2;
+        location.speed_e3 = fix.speed_e3;
+        location.variation_e2 = fix.variation_e2;
+        location.time = fix.time;
+        location.microseconds = fix.microseconds;
+        location.elapsed_time = fix.elapsed_time;
+        gps2_location_ready(gps_dev, &location);
+      } else {
+        gps2_location_lost(gps_dev);
+      }
+      if (gps_dev->fix_sentences != 0) {
+        gps_dev->latest_fix = fix;
+        gps_dev->have_fix = true;
+        gps2_trigger(gps_dev, MGOS_EV_GPS_FIX, &fix);
+      }
+      break;
 
-      /* free out line_buffer_nul */
-      mg_strfree(&line_buffer_nul);
-      
-      /* remove the line from the beginning of the buffer */
-      mbuf_remove(gps_dev->uart_rx_buffer, line_length);
+    case GPS2_UBX_NAV_SAT:
+      if (gps_dev->sky_sentences == 0) {
+        return;
+      }
+      replaced = gps2_ubx_nav_sat(payload, payload_length, &gps_dev->sky);
+      for (i = 0; i < GPS2_SKY_VIEWS; i++) {
+        if (replaced & (1u << i)) {
+          gps2_trigger(gps_dev, MGOS_EV_GPS_SKY_VIEW, (void *) gps2_sky_get(&gps_dev->sky, i));
+        }
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+/* called at the start of each message. Frames a UBX packet if that's what
+   starts here. Returns 1 if bytes were used, 0 if this is an NMEA line, or -1
+   to wait for more bytes */
+static int gps2_rx_ring_ubx(struct gps2 *gps_dev) {
+  struct gps2_rx_ring *ring = &gps_dev->rx_ring;
+  size_t available = ring->head - ring->tail;
+  size_t start;
+  size_t first_part;
+  size_t length;
+  const uint8_t *packet;
+  char c;
+
+  if (ring->skip > 0) {
+    length = ring->skip < available ? ring->skip : available;
+    ring->skip -= length;
+    ring->tail += length;
+    ring->scan = ring->tail;
+    return ring->skip > 0 ? -1 : 1;
+  }
+
+  c = ring->buf[ring->tail & (GPS2_RX_RING_SIZE - 1)];
+  if ((uint8_t) c != GPS2_UBX_SYNC_1) {
+    if (ring->resync && c != '$' && c != '!') {
+      ring->scan = ++ring->tail;
+      return 1;
+    }
+    return 0;
+  }
+
+  if (available < GPS2_UBX_HEADER_LENGTH) {
+    return -1;
+  }
+  if ((uint8_t) ring->buf[(ring->tail + 1) & (GPS2_RX_RING_SIZE - 1)] != GPS2_UBX_SYNC_2) {
+    if (ring->resync) {
+      ring->scan = ++ring->tail;
+      return 1;
+    }
+    return 0;
+  }
+
+  length = GPS2_UBX_OVERHEAD + ((uint8_t) ring->buf[(ring->tail + 4) & (GPS2_RX_RING_SIZE - 1)]
+                                | (uint8_t) ring->buf[(ring->tail + 5) & (GPS2_RX_RING_SIZE - 1)] << 8);
+  if (length > GPS2_UBX_MAX_LENGTH) {
+    /* a message we don't decode anyway. Let it go by */
+    GPS2_STAT_INC(gps_dev, ubx_dropped);
+    ring->skip = length;
+    return 1;
+  }
+  if (available < length) {
+    return -1;
+  }
+
+  start = ring->tail & (GPS2_RX_RING_SIZE - 1);
+  if (start + length <= GPS2_RX_RING_SIZE) {
+    packet = (const uint8_t *) ring->buf + start;
+  } else {
+    first_part = GPS2_RX_RING_SIZE - start;
+    memcpy(ring->line, ring->buf + start, first_part);
+    memcpy(ring->line + first_part, ring->buf, length - first_part);
+    packet = (const uint8_t *) ring->line;
+  }
+
+  GPS2_STAT_INC(gps_dev, ubx_packets);
+  if (!gps2_ubx_check(packet, length)) {
+    /* the length may be what is wrong, so only step over the sync */
+    GPS2_STAT_INC(gps_dev, ubx_checksum_failures);
+    ring->tail += 2;
+    ring->scan = ring->tail;
+    ring->resync = true;
+    return 1;
+  }
+
+  ring->tail += length;
+  ring->scan = ring->tail;
+  ring->resync = false;
+  gps_dev->stats_sampling = GPS2_STAT_SAMPLED(gps_dev->stats.ubx_packets);
+  if (gps_dev->first_sentence_ms < 0 || gps_dev->autobaud.state != GPS2_AUTOBAUD_IDLE) {
+    gps2_link_good(gps_dev);
+  }
+  gps2_link_alive(gps_dev);
+  gps2_process_ubx(gps_dev, packet, length);
+  return 1;
+}
+#endif
+
+/* look for terminators in the bytes which have arrived since we last looked */
+
+static void gps2_rx_ring_scan(struct gps2 *gps_dev) {
+  struct gps2_rx_ring *ring = &gps_dev->rx_ring;
+  size_t offset;
+  size_t segment_length;
+  const char *terminator_ptr;
+#if GPS2_UBX
+  int framed;
+  const char *sync_ptr;
+#endif
+
+  while (ring->scan != ring->head) {
+
+#if GPS2_UBX
+    if (ring->scan == ring->tail) {
+      /* the start of a message, which may be a UBX packet rather than a line */
+      framed = gps2_rx_ring_ubx(gps_dev);
+      if (framed < 0) {
+        break;
+      }
+      if (framed > 0) {
+        continue;
+      }
+    }
+#endif
+
+    /* scan up to the end of the ring or the end of the data, whichever comes first */
+    offset = ring->scan & (GPS2_RX_RING_SIZE - 1);
+    segment_length = ring->head - ring->scan;
+    if (segment_length > GPS2_RX_RING_SIZE - offset) {
+      segment_length = GPS2_RX_RING_SIZE - offset;
+    }
+
+    terminator_ptr = memchr(ring->buf + offset, '\n', segment_length);
+
+#if GPS2_UBX
+    if (ring->resync) {
+      /* a line found while resynchronising may be binary, with a packet starting inside it */
+      sync_ptr = memchr(ring->buf + offset, GPS2_UBX_SYNC_1,
+                        terminator_ptr != NULL ? (size_t) (terminator_ptr - (ring->buf + offset)) : segment_length);
+      if (sync_ptr != NULL) {
+        GPS2_STAT_INC(gps_dev, lines_dropped);
+        ring->scan += sync_ptr - (ring->buf + offset);
+        ring->tail = ring->scan;
+        continue;
+      }
+    }
+#endif
+
+    if (terminator_ptr == NULL) {
+      ring->scan += segment_length;
+    } else {
+      /* calculate the index of the terminator using pointer arithmetic */
+      ring->scan += (terminator_ptr - (ring->buf + offset));
 
-      /* Look for the next crlf*/
-      line_buffer = mg_mk_str_n(gps_dev->uart_rx_buffer->buf,gps_dev->uart_rx_buffer->len);
-      terminator_ptr = mg_strstr(line_buffer, crlf);
+      gps2_rx_ring_frame_line(gps_dev, ring->scan);
 
+      /* the next line starts after the LF */
+      ring->scan++;
+      ring->tail = ring->scan;
+#if GPS2_UBX
+      ring->resync = false;
+#endif
     }
   }
+}
 
+void gps2_uart_rx_callback(int uart_no, struct gps2 *gps_dev, size_t rx_available) {
+  struct gps2_rx_ring *ring = &gps_dev->rx_ring;
+  size_t offset;
+  size_t space;
+  size_t length_read;
+
+  while (rx_available > 0) {
+
+    if (ring->head - ring->tail == GPS2_RX_RING_SIZE) {
+      /* the ring is full of a line with no terminator. It can't be NMEA so throw it away */
+      LOG(LL_DEBUG,("UART%d rx ring overflow, discarding %d bytes", uart_no, GPS2_RX_RING_SIZE));
+      GPS2_STAT_INC(gps_dev, rx_overflows);
+      ring->tail = ring->head;
+      ring->scan = ring->head;
+    }
 
+    /* read into the free space up to the end of the ring */
+    offset = ring->head & (GPS2_RX_RING_SIZE - 1);
+    space = GPS2_RX_RING_SIZE - (ring->head - ring->tail);
+    if (space > GPS2_RX_RING_SIZE - offset) {
+      space = GPS2_RX_RING_SIZE - offset;
+    }
+    if (space > rx_available) {
+      space = rx_available;
+    }
+
+    length_read = mgos_uart_read(uart_no, ring->buf + offset, space);
+    if (length_read == 0) {
+      break;
+    }
+
+    ring->head += length_read;
+    GPS2_STAT_ADD(gps_dev, rx_bytes, length_read);
+    rx_available -= length_read;
+
+    if (ring->head - ring->tail > ring->high_water) {
+      ring->high_water = ring->head - ring->tail;
+    }
+
+    gps2_rx_ring_scan(gps_dev);
+  }
 
 }
 
@@ -194,10 +987,12 @@ void gps2_uart_dispatcher(int uart_no, void *arg){
     size_t rx_available;
     size_t tx_available;
     size_t length_to_write;
-    struct mg_str tx_string;
-    struct mg_str tx_string_nul;
+    size_t offset;
+    int64_t start;
     
     gps_dev = arg;
+    GPS2_STAT_INC(gps_dev, dispatcher_runs);
+    start = GPS2_STAT_SAMPLED(gps_dev->stats.dispatcher_runs) ? mgos_uptime_micros() : 0;
 
 
     // check that we've got the correct uart
@@ -214,67 +1009,174 @@ void gps2_uart_dispatcher(int uart_no, void *arg){
       
     }
 
-    /* check if we've got anything to write */
-    if (gps_dev->uart_tx_buffer->len > 0 ) {
-
-      // find out how many bytes are available to write
+    /* write what the UART has room for. It runs the dispatcher again when
+    there is more room, and we carry on from there */
+    while (gps_dev->tx_ring.head != gps_dev->tx_ring.tail) {
+      offset = gps_dev->tx_ring.tail & (GPS2_TX_RING_SIZE - 1);
+      length_to_write = gps_dev->tx_ring.head - gps_dev->tx_ring.tail;
+      if (length_to_write > GPS2_TX_RING_SIZE - offset) {
+        length_to_write = GPS2_TX_RING_SIZE - offset;
+      }
       tx_available = mgos_uart_write_avail(uart_no);
+      if (length_to_write > tx_available) {
+        length_to_write = tx_available;
+      }
+      if (length_to_write == 0) {
+        break;
+      }
 
-      // write what we've got in our tx buffer up to the tx available
+      length_to_write = mgos_uart_write(uart_no, gps_dev->tx_ring.buf + offset, length_to_write);
+      if (length_to_write == 0) {
+        break;
+      }
+      LOG(LL_VERBOSE_DEBUG, ("UART%d tx %.*s", uart_no, (int) length_to_write, gps_dev->tx_ring.buf + offset));
+      gps_dev->tx_ring.tail += length_to_write;
+    }
 
-      length_to_write = tx_available < gps_dev->uart_tx_buffer->len ? tx_available : gps_dev->uart_tx_buffer->len;
+    GPS2_STAT_TIME(gps_dev, dispatcher_us, start);
+}
 
-      mgos_uart_write(uart_no,gps_dev->uart_tx_buffer->buf, length_to_write); 
+static size_t gps2_tx_space(struct gps2 *gps_dev) {
+  return GPS2_TX_RING_SIZE - (gps_dev->tx_ring.head - gps_dev->tx_ring.tail);
+}
 
-            /* create a string from the line. */
-      tx_string = mg_mk_str_n(gps_dev->uart_tx_buffer->buf, length_to_write);
+/* copy into the tx ring, without scheduling the dispatcher */
+static void gps2_tx_copy(struct gps2 *gps_dev, const char *data, size_t length) {
+  struct gps2_tx_ring *ring = &gps_dev->tx_ring;
+  size_t offset = ring->head & (GPS2_TX_RING_SIZE - 1);
+  size_t first_part = GPS2_TX_RING_SIZE - offset;
 
+  if (first_part >= length) {
+    memcpy(ring->buf + offset, data, length);
+  } else {
+    memcpy(ring->buf + offset, data, first_part);
+    memcpy(ring->buf, data + first_part, length - first_part);
+  }
+  ring->head += length;
+  GPS2_STAT_ADD(gps_dev, tx_bytes_queued, length);
+}
 
-      tx_string_nul = mg_strdup_nul(tx_string);
+/* queue a whole command, or drop it if there isn't room. The dispatcher writes
+it out when it next runs, rather than from the caller's stack */
+static bool gps2_tx(struct gps2 *gps_dev, const char *data, size_t length) {
+  if (length > gps2_tx_space(gps_dev)) {
+    GPS2_STAT_ADD(gps_dev, tx_bytes_dropped, length);
+    return false;
+  }
+  gps2_tx_copy(gps_dev, data, length);
+  mgos_uart_schedule_dispatcher(gps_dev->uart_no, false);
+  return true;
+}
 
-      LOG(LL_DEBUG,("TX line us %s",tx_string_nul.p));
-      
+void gps2_send_device_command(struct gps2 *gps_dev, struct mg_str command_string) {
 
+  if (command_string.len + 2 > gps2_tx_space(gps_dev)) {
+    GPS2_STAT_ADD(gps_dev, tx_bytes_dropped, command_string.len + 2);
+    return;
+  }
+  gps2_tx_copy(gps_dev, command_string.p, command_string.len);
+  gps2_tx(gps_dev, "\r\n", 2);
 
-      // and flush
-      mgos_uart_flush(uart_no);
+}
 
+bool gps2_send_device_bytes(struct gps2 *gps_dev, const void *data, size_t length) {
+  return gps2_tx(gps_dev, data, length);
+}
 
-      // remove what we've written from the buffer
+#if GPS2_PMTK
+static void gps2_pmtk_send_next(struct gps2 *dev);
 
-      mbuf_remove(gps_dev->uart_tx_buffer,length_to_write);
+/* the command in flight has been answered or has timed out */
+static void gps2_pmtk_done(struct gps2 *dev, enum gps2_pmtk_result result) {
+  struct gps2_pmtk_command command;
 
-      /* if we didn't write everything then when the tx buffer empties this dispatcher will be called and we 
-      can can write again */
+  if (dev->pmtk.timer != MGOS_INVALID_TIMER_ID) {
+    mgos_clear_timer(dev->pmtk.timer);
+    dev->pmtk.timer = MGOS_INVALID_TIMER_ID;
+  }
+  gps2_pmtk_pop(&dev->pmtk, &command);
 
+  /* the callback may queue another command, which goes straight out */
+  if (command.cb != NULL) {
+    command.cb(dev, command.number, result, command.userdata);
+  }
+  gps2_pmtk_send_next(dev);
+}
 
-    }
+static void gps2_pmtk_timeout(void *arg) {
+  struct gps2 *dev = arg;
 
+  dev->pmtk.timer = MGOS_INVALID_TIMER_ID;
+  GPS2_STAT_INC(dev, pmtk_timeouts);
+  LOG(LL_WARN, ("UART%d no acknowledgement for PMTK%03d", dev->uart_no, gps2_pmtk_first(&dev->pmtk)->number));
+  gps2_pmtk_done(dev, GPS2_PMTK_TIMEOUT);
+}
 
- 
+/* send the first command, unless it's already waiting for its acknowledgement */
+static void gps2_pmtk_send_next(struct gps2 *dev) {
+  struct gps2_pmtk_command *command = gps2_pmtk_first(&dev->pmtk);
 
+  if (command == NULL || dev->pmtk.sent) {
+    return;
+  }
+  dev->pmtk.sent = true;
+  dev->pmtk.timer = mgos_set_timer(GPS2_PMTK_TIMEOUT_MS, 0, gps2_pmtk_timeout, dev);
+  GPS2_STAT_INC(dev, pmtk_commands);
+  gps2_tx(dev, command->sentence, command->length);
 }
 
-void gps2_uart_tx(struct gps2 *gps_dev, struct mbuf buffer) {
-  /* append to the tx buffer */
-  mbuf_append(gps_dev->uart_tx_buffer,buffer.buf,buffer.len);
-
-  /* call the dispatcher */
-  gps2_uart_dispatcher(gps_dev->uart_no, gps_dev);
+/* a proprietary line while a command is in flight */
+static void gps2_pmtk_ack(struct gps2 *dev, const char *line) {
+  enum gps2_pmtk_result result;
+  int number;
 
+  if (gps2_pmtk_parse_ack(line, &number, &result) && number == gps2_pmtk_first(&dev->pmtk)->number) {
+    gps2_pmtk_done(dev, result);
+  }
 }
 
-void gps2_send_device_command(struct gps2 *gps_dev, struct mg_str command_string) {
+/* tell everyone still waiting that their commands won't go */
+static void gps2_pmtk_cancel(struct gps2 *dev) {
+  struct gps2_pmtk_command command;
 
-  struct mbuf command_buffer;
-  struct mg_str crlf;
+  if (dev->pmtk.timer != MGOS_INVALID_TIMER_ID) {
+    mgos_clear_timer(dev->pmtk.timer);
+    dev->pmtk.timer = MGOS_INVALID_TIMER_ID;
+  }
+  while (gps2_pmtk_first(&dev->pmtk) != NULL) {
+    gps2_pmtk_pop(&dev->pmtk, &command);
+    if (command.cb != NULL) {
+      command.cb(dev, command.number, GPS2_PMTK_CANCELLED, command.userdata);
+    }
+  }
+}
+#endif
+
+bool gps2_send_device_pmtk(struct gps2 *dev, const char *command, gps2_pmtk_cb cb, void *userdata) {
+#if GPS2_PMTK
+  if (!gps2_pmtk_push(&dev->pmtk, command, cb, userdata)) {
+    return false;
+  }
+  gps2_pmtk_send_next(dev);
+  return true;
+#else
+  return false;
+#endif
+}
 
-  crlf = mg_mk_str("\r\n");
-  mbuf_init(&command_buffer,command_string.len);
-  mbuf_append(&command_buffer,command_string.p,command_string.len);
-  mbuf_append(&command_buffer,crlf.p, crlf.len);
-  gps2_uart_tx(gps_dev,command_buffer);
+bool gps2_send_pmtk(const char *command, gps2_pmtk_cb cb, void *userdata) {
+  if (gps2_get_global_device() == NULL) {
+    return false;
+  }
+  return gps2_send_device_pmtk(gps2_get_global_device(), command, cb, userdata);
+}
 
+int gps2_get_device_pmtk_pending(struct gps2 *dev) {
+#if GPS2_PMTK
+  return dev->pmtk.count;
+#else
+  return 0;
+#endif
 }
 
 /* send a  command_string to the global GPS 
@@ -330,33 +1232,345 @@ bool gps2_set_uart_baud(int baud_rate) {
   }
 }
 
+static const int gps2_autobaud_rates[] = {GPS2_AUTOBAUD_RATES};
+
+#define GPS2_AUTOBAUD_RATE_COUNT ((int) (sizeof(gps2_autobaud_rates) / sizeof(gps2_autobaud_rates[0])))
+
+static void gps2_autobaud_step(void *arg);
+
+/* a good sentence or packet has arrived */
+static void gps2_link_good(struct gps2 *dev) {
+  struct gps2_autobaud *autobaud = &dev->autobaud;
+
+  if (dev->first_sentence_ms < 0) {
+    dev->first_sentence_ms = (int32_t) ((mgos_uptime_micros() - dev->created) / 1000);
+    LOG(LL_INFO, ("UART%d first good sentence after %d ms", dev->uart_no, (int) dev->first_sentence_ms));
+  }
+
+  if (autobaud->state == GPS2_AUTOBAUD_IDLE || autobaud->state == GPS2_AUTOBAUD_COMMAND) {
+    return;
+  }
+  if (++autobaud->lines == GPS2_AUTOBAUD_LINES) {
+    /* no need to wait out the rest of the window. The step runs from a timer,
+    not from inside the dispatcher */
+    mgos_clear_timer(autobaud->timer);
+    autobaud->timer = mgos_set_timer(0, 0, gps2_autobaud_step, dev);
+  }
+}
+
+/* listen at baud_rate for the next window, with nothing left from the old rate */
+static void gps2_autobaud_listen(struct gps2 *dev, int baud_rate, int window_ms) {
+  struct gps2_rx_ring *ring = &dev->rx_ring;
+
+  gps2_set_device_uart_baud(dev, baud_rate);
+  ring->tail = ring->head;
+  ring->scan = ring->head;
+#if GPS2_UBX
+  ring->skip = 0;
+  ring->resync = false;
+#endif
+  dev->autobaud.lines = 0;
+  dev->autobaud.timer = mgos_set_timer(window_ms, 0, gps2_autobaud_step, dev);
+}
+
+static void gps2_autobaud_done(struct gps2 *dev, int baud_rate) {
+  struct gps2_autobaud *autobaud = &dev->autobaud;
+  struct mgos_gps_baud_rate result;
+
+  autobaud->state = GPS2_AUTOBAUD_IDLE;
+  autobaud->timer = MGOS_INVALID_TIMER_ID;
+  if (baud_rate == 0) {
+    /* nothing heard anywhere, so leave the UART where it was */
+    gps2_set_device_uart_baud(dev, autobaud->start_baud);
+  }
+
+  result.dev = dev;
+  result.baud_rate = baud_rate;
+  result.detected_baud_rate = autobaud->detected_baud;
+  result.elapsed_ms = (int) ((mgos_uptime_micros() - autobaud->started) / 1000);
+  LOG(LL_INFO, ("UART%d autobaud: receiver found at %d, now at %d, after %d ms", dev->uart_no,
+                result.detected_baud_rate, result.baud_rate, result.elapsed_ms));
+  gps2_trigger(dev, MGOS_EV_GPS_BAUD_RATE, &result);
+}
+
+/* tell the receiver to change rate, as MediaTek and u-blox receivers understand it */
+static void gps2_autobaud_command(struct gps2 *dev, int baud_rate) {
+  char command[24];
+  uint8_t packet[GPS2_UBX_CFG_PRT_PACKET];
+#if GPS2_PMTK
+  char sentence[GPS2_PMTK_MAX_SENTENCE];
+  size_t length;
+  int number;
+#endif
+
+  /* straight out rather than through the PMTK queue, it must go before the UART changes rate */
+  snprintf(command, sizeof(command), "PMTK251,%d", baud_rate);
+#if GPS2_PMTK
+  length = gps2_pmtk_format(sentence, command, &number);
+  gps2_tx(dev, sentence, length);
+#endif
+  gps2_tx(dev, (const char *) packet, gps2_ubx_cfg_prt(packet, baud_rate));
+}
+
+/* the end of a listening window, or enough good sentences before the end */
+static void gps2_autobaud_step(void *arg) {
+  struct gps2 *dev = arg;
+  struct gps2_autobaud *autobaud = &dev->autobaud;
+  bool heard = autobaud->lines >= GPS2_AUTOBAUD_LINES;
+
+  autobaud->timer = MGOS_INVALID_TIMER_ID;
+
+  switch (autobaud->state) {
+    case GPS2_AUTOBAUD_PROBE:
+      if (heard) {
+        autobaud->detected_baud = dev->uart_config.baud_rate;
+        if (autobaud->target_baud == 0 || autobaud->target_baud == autobaud->detected_baud) {
+          gps2_autobaud_done(dev, autobaud->detected_baud);
+          return;
+        }
+        gps2_autobaud_command(dev, autobaud->target_baud);
+        autobaud->state = GPS2_AUTOBAUD_COMMAND;
+        autobaud->timer = mgos_set_timer(GPS2_AUTOBAUD_SWITCH_MS, 0, gps2_autobaud_step, dev);
+        return;
+      }
+      /* the next rate, skipping the one we started at */
+      do {
+        autobaud->rate++;
+      } while (autobaud->rate < GPS2_AUTOBAUD_RATE_COUNT
+               && gps2_autobaud_rates[autobaud->rate] == autobaud->start_baud);
+      if (autobaud->rate == GPS2_AUTOBAUD_RATE_COUNT) {
+        gps2_autobaud_done(dev, 0);
+        return;
+      }
+      gps2_autobaud_listen(dev, gps2_autobaud_rates[autobaud->rate], GPS2_AUTOBAUD_PROBE_MS);
+      break;
+
+    case GPS2_AUTOBAUD_COMMAND:
+      autobaud->state = GPS2_AUTOBAUD_VERIFY;
+      gps2_autobaud_listen(dev, autobaud->target_baud, GPS2_AUTOBAUD_PROBE_MS);
+      break;
+
+    case GPS2_AUTOBAUD_VERIFY:
+      if (heard) {
+        gps2_autobaud_done(dev, autobaud->target_baud);
+        return;
+      }
+      /* the receiver didn't follow, or the link doesn't work at that rate */
+      LOG(LL_WARN, ("UART%d nothing at %d, back to %d", dev->uart_no, autobaud->target_baud,
+                    autobaud->detected_baud));
+      autobaud->state = GPS2_AUTOBAUD_FALLBACK;
+      gps2_autobaud_listen(dev, autobaud->detected_baud, GPS2_AUTOBAUD_PROBE_MS);
+      break;
+
+    case GPS2_AUTOBAUD_FALLBACK:
+      gps2_autobaud_done(dev, heard ? autobaud->detected_baud : 0);
+      break;
+
+    default:
+      break;
+  }
+}
+
+bool gps2_start_device_autobaud(struct gps2 *dev, int baud_rate) {
+  struct gps2_autobaud *autobaud = &dev->autobaud;
+
+  if (autobaud->state != GPS2_AUTOBAUD_IDLE || baud_rate < 0) {
+    return false;
+  }
+  autobaud->state = GPS2_AUTOBAUD_PROBE;
+  autobaud->rate = -1;
+  autobaud->start_baud = dev->uart_config.baud_rate;
+  autobaud->detected_baud = 0;
+  autobaud->target_baud = baud_rate;
+  autobaud->started = mgos_uptime_micros();
+  dev->link.recover_baud = baud_rate;
+  gps2_autobaud_listen(dev, autobaud->start_baud, GPS2_AUTOBAUD_PROBE_MS);
+  return true;
+}
+
+static void gps2_link_event(struct gps2 *dev, int ev, int down_ms) {
+  struct mgos_gps_link link;
+
+  gps2_get_device_link(dev, &link);
+  link.down_ms = down_ms;
+  gps2_trigger(dev, ev, &link);
+}
+
+/* the first good sentence, or the first after the link was down */
+static void gps2_link_up(struct gps2 *dev) {
+  struct gps2_link *link = &dev->link;
+  int down_ms = (int) ((mgos_uptime_micros() - link->down_since) / 1000);
+
+  link->connected = true;
+  LOG(LL_INFO, ("UART%d receiver connected after %d ms", dev->uart_no, down_ms));
+  if (link->disconnects > 0 && link->reconnect_length > 0) {
+    /* it may have been power cycled back to its defaults */
+    gps2_tx(dev, link->reconnect_commands, link->reconnect_length);
+  }
+  gps2_link_event(dev, MGOS_EV_GPS_CONNECTED, down_ms);
+}
+
+static void gps2_link_fix_changed(struct gps2 *dev, bool fix) {
+  dev->link.fix = fix;
+  gps2_link_event(dev, fix ? MGOS_EV_GPS_FIX_ACQUIRED : MGOS_EV_GPS_FIX_LOST, 0);
+}
+
+static void gps2_link_down(struct gps2 *dev) {
+  struct gps2_link *link = &dev->link;
+  int quiet_ms = (int) ((int64_t) link->quiet_ticks * link->timeout_ms / GPS2_LINK_TICKS);
+
+  link->connected = false;
+  link->disconnects++;
+  link->down_since = mgos_uptime_micros() - (int64_t) quiet_ms * 1000;
+  LOG(LL_WARN, ("UART%d nothing from the receiver for %d ms", dev->uart_no, quiet_ms));
+
+  /* the latest location is as old as the last good sentence, it won't be
+  updated until the link is back */
+  if (link->fix) {
+    link->fix = false;
+    gps2_link_event(dev, MGOS_EV_GPS_FIX_LOST, 0);
+  }
+  gps2_location_lost(dev);
+  gps2_link_event(dev, MGOS_EV_GPS_DISCONNECTED, quiet_ms);
+
+  link->recover_ticks = link->quiet_ticks;
+  link->recover_interval = GPS2_LINK_TICKS;
+}
+
+/* look for the receiver at every rate, and move it back to the one it was asked for */
+static void gps2_link_recover(struct gps2 *dev) {
+  struct gps2_link *link = &dev->link;
+  uint32_t max_interval = (uint32_t) ((int64_t) GPS2_LINK_RECOVERY_MAX_MS * GPS2_LINK_TICKS / link->timeout_ms);
+
+  link->recover_interval *= 2;
+  if (link->recover_interval > max_interval) {
+    link->recover_interval = max_interval > GPS2_LINK_TICKS ? max_interval : GPS2_LINK_TICKS;
+  }
+  link->recover_ticks = link->quiet_ticks + link->recover_interval;
+
+  if (gps2_start_device_autobaud(dev, link->recover_baud)) {
+    link->recoveries++;
+    LOG(LL_INFO, ("UART%d looking for the receiver, next try in %d ms", dev->uart_no,
+                  (int) ((int64_t) link->recover_interval * link->timeout_ms / GPS2_LINK_TICKS)));
+  }
+}
+
+static void gps2_link_tick(void *arg) {
+  struct gps2 *dev = arg;
+  struct gps2_link *link = &dev->link;
+
+  if (link->good != link->good_seen) {
+    link->good_seen = link->good;
+    link->quiet_ticks = 0;
+    return;
+  }
+
+  link->quiet_ticks++;
+  if (link->connected) {
+    if (link->quiet_ticks < GPS2_LINK_TICKS) {
+      return;
+    }
+    gps2_link_down(dev);
+  }
+
+  /* down, or not heard since the link was watched. Autobaud may already be looking */
+  if (link->quiet_ticks >= link->recover_ticks && dev->autobaud.state == GPS2_AUTOBAUD_IDLE) {
+    gps2_link_recover(dev);
+  }
+}
+
+bool gps2_set_device_disconnect_timeout(struct gps2 *dev, int timeout_ms) {
+  struct gps2_link *link = &dev->link;
+  int period_ms = timeout_ms / GPS2_LINK_TICKS;
+
+  if (timeout_ms < 0) {
+    return false;
+  }
+  if (link->timer != MGOS_INVALID_TIMER_ID) {
+    mgos_clear_timer(link->timer);
+    link->timer = MGOS_INVALID_TIMER_ID;
+  }
+  link->timeout_ms = timeout_ms;
+  if (timeout_ms == 0) {
+    return true;
+  }
+
+  link->good_seen = link->good;
+  link->quiet_ticks = 0;
+  /* a receiver that hasn't been heard is looked for after one timeout */
+  link->recover_ticks = GPS2_LINK_TICKS;
+  link->recover_interval = GPS2_LINK_TICKS;
+  link->timer = mgos_set_timer(period_ms > 0 ? period_ms : 1, MGOS_TIMER_REPEAT, gps2_link_tick, dev);
+  return link->timer != MGOS_INVALID_TIMER_ID;
+}
+
+bool gps2_set_device_reconnect_commands(struct gps2 *dev, const void *commands, size_t length) {
+  if (commands == NULL) {
+    length = 0;
+  }
+  if (length > GPS2_TX_RING_SIZE) {
+    return false;
+  }
+  dev->link.reconnect_commands = commands;
+  dev->link.reconnect_length = length;
+  return true;
+}
+
+void gps2_get_device_link(struct gps2 *dev, struct mgos_gps_link *link) {
+  link->dev = dev;
+  link->connected = dev->link.connected;
+  link->fix = dev->link.fix;
+  link->disconnects = dev->link.disconnects;
+  link->recoveries = dev->link.recoveries;
+  link->down_ms = dev->link.connected ? 0 : (int) ((mgos_uptime_micros() - dev->link.down_since) / 1000);
+}
+
 
 struct gps2 *gps2_create_uart(
   uint8_t uart_no, struct mgos_uart_config *ucfg) {
 
-    struct gps2 *gps_dev = calloc(1, sizeof(struct gps2));
-      
-    struct mbuf *uart_rx_buffer = calloc(1, sizeof(struct mbuf));
-    struct mbuf *uart_tx_buffer = calloc(1, sizeof(struct mbuf));
+    struct gps2 *gps_dev;
+    int id;
 
 
     /* check we have a uart config. If not, return null */
     if (ucfg == NULL) {
       return NULL;
     }
+
+    /* one device per UART, and a free id */
+    if (uart_no >= GPS2_MAX_UARTS || gps2_uart_devices[uart_no] != NULL) {
+      LOG(LL_ERROR, ("UART%d already has a GPS device or is out of range", uart_no));
+      return NULL;
+    }
+    for (id = 0; id < GPS2_MAX_DEVICES && gps2_devices[id] != NULL; id++) {
+    }
+    if (id == GPS2_MAX_DEVICES) {
+      LOG(LL_ERROR, ("Already have %d GPS devices", GPS2_MAX_DEVICES));
+      return NULL;
+    }
+
+    gps_dev = calloc(1, sizeof(struct gps2));
+    if (gps_dev == NULL) goto err;
     
 
 
     gps_dev->uart_no = uart_no;
+    gps_dev->id = id;
     memcpy(&(gps_dev->uart_config),ucfg,sizeof(struct mgos_uart_config));
 
 
-    /* we set the initial size of our receive buffer to the size of the UART receive buffer. It will grow
-    automatically if required */
-    mbuf_init(uart_rx_buffer,512);
-
-    gps_dev->uart_rx_buffer = uart_rx_buffer;
-    gps_dev->uart_tx_buffer = uart_tx_buffer;
+    gps2_epoch_init(&gps_dev->epoch);
+    gps_dev->fix_sentences = GPS2_EPOCH_SENTENCES;
+    gps2_sky_init(&gps_dev->sky, gps_dev);
+#if GPS2_PMTK
+    gps2_pmtk_init(&gps_dev->pmtk);
+#endif
+    gps_dev->autobaud.timer = MGOS_INVALID_TIMER_ID;
+    gps_dev->created = mgos_uptime_micros();
+    gps_dev->link.timer = MGOS_INVALID_TIMER_ID;
+    gps_dev->link.down_since = gps_dev->created;
+    gps_dev->first_sentence_ms = -1;
     
     
     if (!mgos_uart_configure(gps_dev->uart_no, &(gps_dev->uart_config))) goto err;
@@ -369,6 +1583,9 @@ struct gps2 *gps2_create_uart(
                 ucfg->parity == MGOS_UART_PARITY_NONE ? 'N' : ucfg->parity + '0',
                 ucfg->stop_bits));
 
+    gps2_devices[id] = gps_dev;
+    gps2_uart_devices[uart_no] = gps_dev;
+
     // set our callback for the UART for the GPS
     mgos_uart_set_dispatcher(gps_dev->uart_no,gps2_uart_dispatcher,gps_dev);
     
@@ -376,18 +1593,71 @@ struct gps2 *gps2_create_uart(
 
 
 
-    LOG(LL_INFO, ("Initialized GPS device"));
+    LOG(LL_INFO, ("Initialized GPS device %d", id));
   
     return gps_dev;
 
 
     err:
-      if (gps_dev) free(gps_dev);
+      free(gps_dev);
       return NULL;
 
 
 }
 
+void gps2_destroy_device(struct gps2 *dev) {
+  if (dev == NULL) {
+    return;
+  }
+
+  mgos_uart_set_rx_enabled(dev->uart_no, false);
+  mgos_uart_set_dispatcher(dev->uart_no, NULL, NULL);
+
+#if GPS2_PMTK
+  gps2_pmtk_cancel(dev);
+#endif
+  if (dev->autobaud.timer != MGOS_INVALID_TIMER_ID) {
+    mgos_clear_timer(dev->autobaud.timer);
+  }
+  if (dev->link.timer != MGOS_INVALID_TIMER_ID) {
+    mgos_clear_timer(dev->link.timer);
+  }
+
+  /* the point held back, into the batch, the history and the log before they go */
+  gps2_flush_device_simplify(dev);
+  /* whatever we have, as when the batch settings change. It clears the timer */
+  gps2_location_batch_send(dev);
+  free(dev->location_batch.locations);
+  gps2_track_free(&dev->track);
+  gps2_set_device_log(dev, NULL, 0);
+  free(dev->simplify);
+
+  gps2_devices[dev->id] = NULL;
+  gps2_uart_devices[dev->uart_no] = NULL;
+  if (global_gps_device == dev) {
+    global_gps_device = NULL;
+  }
+  free(dev);
+}
+
+int gps2_get_device_id(struct gps2 *dev) {
+  return dev->id;
+}
+
+struct gps2 *gps2_get_device(int id) {
+  if (id < 0 || id >= GPS2_MAX_DEVICES) {
+    return NULL;
+  }
+  return gps2_devices[id];
+}
+
+struct gps2 *gps2_get_device_by_uart(int uart_no) {
+  if (uart_no < 0 || uart_no >= GPS2_MAX_UARTS) {
+    return NULL;
+  }
+  return gps2_uart_devices[uart_no];
+}
+
 
 
 static struct gps2 *create_global_device(uint8_t uart_no) {
@@ -419,6 +1689,23 @@ struct gps2 *gps2_get_global_device() {
 
 
 
+/* the most bytes that have been waiting in the receive ring for a complete line */
+size_t gps2_get_device_rx_high_water(struct gps2 *dev) {
+  return dev->rx_ring.high_water;
+}
+
+void gps2_get_device_stats(struct gps2 *dev, struct gps2_stats *stats) {
+  *stats = dev->stats;
+  stats->rx_high_water = dev->rx_ring.high_water;
+  stats->first_sentence_ms = dev->first_sentence_ms;
+}
+
+void gps2_reset_device_stats(struct gps2 *dev) {
+  memset(&dev->stats, 0, sizeof(dev->stats));
+  dev->rx_ring.high_water = 0;
+}
+
+
 /* location including speed and course and age of fix in milliseconds 
    this is derived from the most recent RMC sentence*/
 void mgos_gps_get_latest_location(struct mgos_gps_location *latest_location) {
@@ -426,30 +1713,263 @@ void mgos_gps_get_latest_location(struct mgos_gps_location *latest_location) {
 };
 
 void mgos_gps_device_get_latest_location(struct gps2 *dev, struct mgos_gps_location *latest_location) {
-  latest_location->latitude = dev->latest_location.latitude;
-  latest_location->longitude = dev->latest_location.longitude;
-  latest_location->bearing = dev->latest_location.bearing;
-  latest_location->speed = dev->latest_location.speed;
-  latest_location->variation = dev->latest_location.variation;
-  latest_location->time = dev->latest_location.time;
-  latest_location->elapsed_time = dev->latest_location.elapsed_time; 
+  gps2_get_device_location(dev, latest_location);
+}
+
+/* consistent copy of the latest location, safe to call from any task */
+uint32_t gps2_get_device_location(struct gps2 *dev, struct mgos_gps_location *location) {
+  struct mgos_gps_location_fixed fixed;
+  uint32_t seq;
+
+  seq = gps2_read_location(dev, &fixed);
+  gps2_location_from_fixed(&fixed, location);
+  return seq;
+}
+
+uint32_t gps2_get_device_location_fixed(struct gps2 *dev, struct mgos_gps_location_fixed *location) {
+  return gps2_read_location(dev, location);
+}
+
+static float gps2_fixed_to_float(int32_t value, float scale) {
+  if (value == MGOS_GPS_FIXED_UNKNOWN) {
+    return NAN;
+  }
+  return value / scale;
+}
+
+/* the only place we go from fixed point to float */
+void gps2_location_from_fixed(const struct mgos_gps_location_fixed *fixed, struct mgos_gps_location *location) {
+  location->dev = fixed->dev;
+  location->latitude = gps2_fixed_to_float(fixed->latitude_e7, 1e7f);
+  location->longitude = gps2_fixed_to_float(fixed->longitude_e7, 1e7f);
+  location->bearing = gps2_fixed_to_float(fixed->bearing_e2, 1e2f);
+  location->speed = gps2_fixed_to_float(fixed->speed_e3, 1e3f);
+  location->variation = gps2_fixed_to_float(fixed->variation_e2, 1e2f);
+  location->time = fixed->time;
+  location->microseconds = fixed->microseconds;
+  location->elapsed_time = fixed->elapsed_time;
+}
+
+/* true if there has been a fix since the one with sequence number seq */
+bool gps2_device_location_changed(struct gps2 *dev, uint32_t seq) {
+  return __atomic_load_n(&dev->latest_location.seq, __ATOMIC_ACQUIRE) != seq;
+}
+
+/* milliseconds since the location was received */
+int64_t gps2_location_age_ms(const struct mgos_gps_location *location) {
+  return (mgos_uptime_micros() - location->elapsed_time) / 1000;
+}
+
+
+/* only send events for, and only parse, the sentence types in mask. This overrides
+   the mask built from gps2_add_sentence_handler */
+void gps2_set_device_sentence_mask(struct gps2 *dev, uint64_t mask) {
+  dev->sentence_mask = mask;
+  dev->sentence_mask_explicit = true;
+}
+
+uint64_t gps2_get_device_sentence_mask(struct gps2 *dev) {
+  return gps2_event_sentence_mask(dev);
+}
+
+/* the sentence types merged into MGOS_EV_GPS_FIX. Other types are not parsed for it,
+   and 0 turns the fix event off */
+void gps2_set_device_fix_sentences(struct gps2 *dev, uint64_t mask) {
+  dev->fix_sentences = mask & GPS2_EPOCH_SENTENCES;
+  gps2_epoch_init(&dev->epoch);
+}
+
+bool gps2_set_device_location_batch(struct gps2 *dev, int size, int timeout_ms) {
+  struct gps2_location_batch *batch = &dev->location_batch;
+  struct mgos_gps_location_fixed *locations = NULL;
+
+  if (size < 0 || size > GPS2_LOCATION_BATCH_MAX || timeout_ms < 0) {
+    return false;
+  }
+
+  /* whatever we have goes out under the old settings */
+  gps2_location_batch_send(dev);
+
+  if (size > 0) {
+    locations = realloc(batch->locations, size * sizeof(struct mgos_gps_location_fixed));
+    if (locations == NULL) {
+      return false;
+    }
+  } else {
+    free(batch->locations);
+  }
+
+  batch->locations = locations;
+  batch->size = size;
+  batch->timeout_ms = timeout_ms;
+  return true;
+}
+
+bool gps2_set_device_track_history(struct gps2 *dev, size_t bytes) {
+  gps2_track_free(&dev->track);
+  if (bytes == 0) {
+    return true;
+  }
+  return gps2_track_init(&dev->track, bytes);
+}
+
+const struct gps2_track *gps2_get_device_track(struct gps2 *dev) {
+  return dev->track.blocks != NULL ? &dev->track : NULL;
+}
+
+bool gps2_set_device_log(struct gps2 *dev, const char *path, int flush_ms) {
+  if (dev->log != NULL) {
+    gps2_log_close(dev->log);
+    free(dev->log);
+    dev->log = NULL;
+  }
+  if (path == NULL) {
+    return true;
+  }
+
+  dev->log = calloc(1, sizeof(struct gps2_log));
+  if (dev->log == NULL) {
+    return false;
+  }
+  if (!gps2_log_open(dev->log, path, flush_ms)) {
+    LOG(LL_ERROR, ("Can't open the fix log %s", path));
+    free(dev->log);
+    dev->log = NULL;
+    return false;
+  }
+  return true;
+}
+
+bool gps2_flush_device_log(struct gps2 *dev) {
+  return dev->log != NULL ? gps2_log_flush(dev->log) : true;
+}
+
+const struct gps2_log *gps2_get_device_log(struct gps2 *dev) {
+  return dev->log;
+}
+
+bool gps2_set_device_simplify(struct gps2 *dev, int tolerance_m, int heartbeat_ms) {
+  if (tolerance_m < 0 || heartbeat_ms < 0) {
+    return false;
+  }
+  if (dev->simplify != NULL) {
+    /* the point held back still goes out */
+    gps2_flush_device_simplify(dev);
+    if (tolerance_m == 0) {
+      free(dev->simplify);
+      dev->simplify = NULL;
+      return true;
+    }
+  } else if (tolerance_m == 0) {
+    return true;
+  } else {
+    dev->simplify = malloc(sizeof(struct gps2_simplify));
+    if (dev->simplify == NULL) {
+      return false;
+    }
+  }
+  gps2_simplify_init(dev->simplify, tolerance_m, heartbeat_ms);
+  return true;
+}
+
+void gps2_flush_device_simplify(struct gps2 *dev) {
+  struct mgos_gps_location_fixed location;
+
+  if (dev->simplify != NULL && gps2_simplify_flush(dev->simplify, &location)) {
+    gps2_location_send(dev, &location);
+  }
+}
+
+const struct gps2_simplify *gps2_get_device_simplify(struct gps2 *dev) {
+  return dev->simplify;
+}
+
+void gps2_flush_device_location_batch(struct gps2 *dev) {
+  gps2_location_batch_send(dev);
+}
+
+bool gps2_get_device_fix(struct gps2 *dev, struct mgos_gps_fix *fix) {
+  if (!dev->have_fix) {
+    return false;
+  }
+  *fix = dev->latest_fix;
+  return true;
+}
+
+bool gps2_get_device_sky_view(struct gps2 *dev, int index, struct mgos_gps_sky_view *view) {
+  const struct mgos_gps_sky_view *complete = gps2_sky_get(&dev->sky, index);
+
+  if (complete == NULL) {
+    return false;
+  }
+  memcpy(view, complete,
+         offsetof(struct mgos_gps_sky_view, satellites) + complete->count * sizeof(struct mgos_gps_satellite));
+  return true;
+}
+
+void gps2_set_device_sky_view(struct gps2 *dev, bool enable) {
+  gps2_sky_init(&dev->sky, dev);
+  dev->sky_sentences = enable ? GPS2_SENTENCE_BIT(MINMEA_SENTENCE_GSV) | GPS2_SENTENCE_BIT(MINMEA_SENTENCE_GSA) : 0;
+}
+
+static void gps2_sentence_handler_filter(int ev, void *ev_data, void *userdata) {
+  struct gps2_sentence_handler *handler = userdata;
+  const struct mgos_gps_nmea_sentence *sentence = ev_data;
+
+  if (handler->mask & GPS2_SENTENCE_BIT(sentence->sentence_id)) {
+    handler->cb(ev, ev_data, handler->userdata);
+  }
+}
+
+bool gps2_add_sentence_handler(uint64_t mask, mgos_event_handler_t cb, void *userdata) {
+  struct gps2_sentence_handler *handler = calloc(1, sizeof(struct gps2_sentence_handler));
+
+  if (handler == NULL) {
+    return false;
+  }
+  handler->mask = mask;
+  handler->cb = cb;
+  handler->userdata = userdata;
+
+  if (!mgos_event_add_handler(MGOS_EV_GPS_NMEA_SENTENCE, gps2_sentence_handler_filter, handler)) {
+    free(handler);
+    return false;
+  }
+
+  /* the first handler replaces "everything" */
+  if (!have_sentence_handlers) {
+    handler_sentence_mask = 0;
+    have_sentence_handlers = true;
+  }
+  handler_sentence_mask |= mask;
+  return true;
 }
 
 
 enum mgos_init_result mgos_gps2_init(void) {
   uint8_t gps_config_uart_no;
-  uint8_t gps_config_uart_baud;
+  int gps_config_uart_baud;
+  int gps_config_autobaud;
+  int gps_config_disconnect_timeout;
 
   mgos_event_register_base(MGOS_EV_GPS_BASE, __FILE__);
 
 
   gps_config_uart_no = mgos_sys_config_get_gps_uart_no();
   gps_config_uart_baud = mgos_sys_config_get_gps_uart_baud();
+  gps_config_autobaud = mgos_sys_config_get_gps_uart_autobaud();
+  gps_config_disconnect_timeout = mgos_sys_config_get_gps_uart_disconnect_timeout();
 
   /* check if we have a UART > 0. If so, create the global instance */  
   if (gps_config_uart_no > 0 && gps_config_uart_baud > 0) {
     if (create_global_device(gps_config_uart_no)) {
       LOG(LL_INFO,("Successfully created global GPS device on UART %i", gps_config_uart_no));
+      if (gps_config_autobaud > 0) {
+        gps2_start_device_autobaud(global_gps_device, gps_config_autobaud);
+      }
+      if (gps_config_disconnect_timeout > 0) {
+        gps2_set_device_disconnect_timeout(global_gps_device, gps_config_disconnect_timeout);
+      }
     } else {
       if (gps_config_uart_baud ==0) {
         LOG(LL_ERROR,("You must set the baud rate in config: gps.uart.baud"));
@@ -459,6 +1979,10 @@ enum mgos_init_result mgos_gps2_init(void) {
     } 
   }
 
+  if (!gps2_rpc_init()) {
+    LOG(LL_INFO,("No RPC, gps.navigation not available"));
+  }
+
   LOG(LL_DEBUG,("About to return success from init"));
   return true;
     
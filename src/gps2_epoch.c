@@ -0,0 +1,204 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mgos.h"
+#include "gps2_epoch.h"
+
+
+static void gps2_epoch_start(struct gps2_epoch *epoch) {
+  struct mgos_gps_fix *fix = &epoch->fix;
+
+  fix->sentences = 0;
+  fix->time = 0;
+  fix->microseconds = 0;
+  fix->elapsed_time = 0;
+  fix->valid = false;
+
+  fix->latitude_e7 = MGOS_GPS_FIXED_UNKNOWN;
+  fix->longitude_e7 = MGOS_GPS_FIXED_UNKNOWN;
+  fix->altitude_e3 = MGOS_GPS_FIXED_UNKNOWN;
+  fix->geoid_separation_e3 = MGOS_GPS_FIXED_UNKNOWN;
+  fix->bearing_e2 = MGOS_GPS_FIXED_UNKNOWN;
+  fix->speed_e3 = MGOS_GPS_FIXED_UNKNOWN;
+  fix->variation_e2 = MGOS_GPS_FIXED_UNKNOWN;
+
+  fix->fix_quality = MGOS_GPS_FIXED_UNKNOWN;
+  fix->fix_type = MGOS_GPS_FIXED_UNKNOWN;
+  fix->satellites_used = MGOS_GPS_FIXED_UNKNOWN;
+  fix->pdop_e2 = MGOS_GPS_FIXED_UNKNOWN;
+  fix->hdop_e2 = MGOS_GPS_FIXED_UNKNOWN;
+  fix->vdop_e2 = MGOS_GPS_FIXED_UNKNOWN;
+
+  fix->latitude_error_e3 = MGOS_GPS_FIXED_UNKNOWN;
+  fix->longitude_error_e3 = MGOS_GPS_FIXED_UNKNOWN;
+  fix->altitude_error_e3 = MGOS_GPS_FIXED_UNKNOWN;
+
+  epoch->open = true;
+  epoch->timed = false;
+}
+
+void gps2_epoch_init(struct gps2_epoch *epoch) {
+  memset(epoch, 0, sizeof(struct gps2_epoch));
+  epoch->closed_key = -1;
+
+  /* nothing is expected until we have seen two epochs */
+  epoch->closed_sentences = GPS2_SENTENCE_MASK_ALL;
+}
+
+static void gps2_epoch_close(struct gps2_epoch *epoch, gps2_epoch_cb cb, void *arg) {
+  uint64_t sentences = epoch->fix.sentences;
+
+  epoch->open = false;
+
+  /* without a time tag we can't tell which epoch these belonged to */
+  if (!epoch->timed) {
+    return;
+  }
+
+  /* types that were in both of the last two epochs are the ones to wait for.
+  Anything the receiver only sends now and again drops out */
+  epoch->expected = epoch->closed_sentences & sentences;
+  epoch->closed_sentences = sentences;
+  epoch->closed_key = epoch->time_key;
+
+  epoch->fix.elapsed_time = mgos_uptime_micros();
+  cb(epoch, &epoch->fix, arg);
+}
+
+static const struct minmea_time *gps2_epoch_frame_time(const struct minmea_frame *frame) {
+  switch (frame->id) {
+    case MINMEA_SENTENCE_RMC: return &frame->data.rmc.time;
+    case MINMEA_SENTENCE_GGA: return &frame->data.gga.time;
+    case MINMEA_SENTENCE_GST: return &frame->data.gst.time;
+    default: return NULL;
+  }
+}
+
+static void gps2_epoch_merge(struct gps2_epoch *epoch, const struct minmea_frame *frame) {
+  struct mgos_gps_fix *fix = &epoch->fix;
+
+  switch (frame->id) {
+    case MINMEA_SENTENCE_RMC: {
+      const struct minmea_sentence_rmc *rmc = &frame->data.rmc;
+      fix->valid = fix->valid || rmc->valid;
+      fix->latitude_e7 = gps2_fixed_coord(&rmc->latitude);
+      fix->longitude_e7 = gps2_fixed_coord(&rmc->longitude);
+      fix->speed_e3 = gps2_fixed(&rmc->speed, 1000);
+      fix->bearing_e2 = gps2_fixed(&rmc->course, 100);
+      fix->variation_e2 = gps2_fixed(&rmc->variation, 100);
+      if (rmc->date.year >= 0) {
+        epoch->date = rmc->date;
+      }
+    } break;
+
+    case MINMEA_SENTENCE_GGA: {
+      const struct minmea_sentence_gga *gga = &frame->data.gga;
+      fix->valid = fix->valid || gga->fix_quality > 0;
+      fix->fix_quality = gga->fix_quality;
+      fix->satellites_used = gga->satellites_tracked;
+      fix->altitude_e3 = gps2_fixed(&gga->altitude, 1000);
+      fix->geoid_separation_e3 = gps2_fixed(&gga->height, 1000);
+      /* RMC has the same position, so only fill the gaps */
+      if (fix->latitude_e7 == MGOS_GPS_FIXED_UNKNOWN) {
+        fix->latitude_e7 = gps2_fixed_coord(&gga->latitude);
+        fix->longitude_e7 = gps2_fixed_coord(&gga->longitude);
+      }
+      if (fix->hdop_e2 == MGOS_GPS_FIXED_UNKNOWN) {
+        fix->hdop_e2 = gps2_fixed(&gga->hdop, 100);
+      }
+    } break;
+
+    case MINMEA_SENTENCE_GSA: {
+      const struct minmea_sentence_gsa *gsa = &frame->data.gsa;
+      fix->fix_type = gsa->fix_type;
+      fix->pdop_e2 = gps2_fixed(&gsa->pdop, 100);
+      fix->hdop_e2 = gps2_fixed(&gsa->hdop, 100);
+      fix->vdop_e2 = gps2_fixed(&gsa->vdop, 100);
+    } break;
+
+    case MINMEA_SENTENCE_VTG: {
+      const struct minmea_sentence_vtg *vtg = &frame->data.vtg;
+      if (fix->speed_e3 == MGOS_GPS_FIXED_UNKNOWN) {
+        fix->speed_e3 = gps2_fixed(&vtg->speed_knots, 1000);
+      }
+      if (fix->bearing_e2 == MGOS_GPS_FIXED_UNKNOWN) {
+        fix->bearing_e2 = gps2_fixed(&vtg->true_track_degrees, 100);
+      }
+    } break;
+
+    case MINMEA_SENTENCE_GST: {
+      const struct minmea_sentence_gst *gst = &frame->data.gst;
+      fix->latitude_error_e3 = gps2_fixed(&gst->latitude_error_deviation, 1000);
+      fix->longitude_error_e3 = gps2_fixed(&gst->longitude_error_deviation, 1000);
+      fix->altitude_error_e3 = gps2_fixed(&gst->altitude_error_deviation, 1000);
+    } break;
+
+    default:
+      return;
+  }
+
+  fix->sentences |= GPS2_SENTENCE_BIT(frame->id);
+}
+
+void gps2_epoch_add(struct gps2_epoch *epoch, const struct minmea_frame *frame, gps2_epoch_cb cb, void *arg) {
+  const struct minmea_time *time;
+  uint64_t bit = GPS2_SENTENCE_BIT(frame->id);
+  int64_t key = -1;
+
+  if (!(bit & GPS2_EPOCH_SENTENCES)) {
+    return;
+  }
+
+  time = gps2_epoch_frame_time(frame);
+  if (time != NULL && time->hours >= 0) {
+    key = ((time->hours * 60 + time->minutes) * 60 + time->seconds) * (int64_t) 1000000 + time->microseconds;
+  }
+
+  if (!epoch->open) {
+    /* a sentence after we closed early, which wasn't in the epoch we closed, came
+       late for that epoch. We have already sent that fix, so drop it and wait
+       for this type from now on */
+    if ((key >= 0 && key == epoch->closed_key) || (key < 0 && !(bit & epoch->closed_sentences))) {
+      epoch->expected |= bit;
+      epoch->closed_sentences |= bit;
+      return;
+    }
+    gps2_epoch_start(epoch);
+  } else if ((key >= 0 && epoch->timed && key != epoch->time_key)
+             || (key < 0 && (epoch->fix.sentences & bit) && epoch->last_id != frame->id)) {
+    /* the time has moved on, or an untimed type we already have comes round again
+       (receivers send these before or after the timed ones). Either way the epoch we
+       have is all there is. Runs of one type, like a GSA per constellation, stay
+       in the same epoch */
+    gps2_epoch_close(epoch, cb, arg);
+    gps2_epoch_start(epoch);
+  }
+
+  if (key >= 0 && !epoch->timed) {
+    epoch->timed = true;
+    epoch->time_key = key;
+    epoch->time = *time;
+  }
+
+  gps2_epoch_merge(epoch, frame);
+  epoch->last_id = frame->id;
+
+  if (epoch->timed && epoch->expected != 0
+      && (epoch->fix.sentences & epoch->expected) == epoch->expected) {
+    gps2_epoch_close(epoch, cb, arg);
+  }
+}
@@ -0,0 +1,282 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mgos.h"
+#include "gps2_log.h"
+
+
+static const uint8_t gps2_log_magic[4] = {'G', '2', 'L', 'G'};
+
+/* CRC-32 as in zlib, four bits at a time so the table is 64 bytes */
+static const uint32_t gps2_log_crc_table[16] = {
+  0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+  0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+static uint32_t gps2_log_crc32(uint32_t crc, const uint8_t *p, size_t length) {
+  crc = ~crc;
+  while (length-- > 0) {
+    crc ^= *p++;
+    crc = (crc >> 4) ^ gps2_log_crc_table[crc & 0x0f];
+    crc = (crc >> 4) ^ gps2_log_crc_table[crc & 0x0f];
+  }
+  return ~crc;
+}
+
+static inline uint16_t gps2_log_get16(const uint8_t *p) {
+  return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static inline uint32_t gps2_log_get32(const uint8_t *p) {
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline void gps2_log_put16(uint8_t *p, uint16_t value) {
+  p[0] = (uint8_t) value;
+  p[1] = (uint8_t) (value >> 8);
+}
+
+static inline void gps2_log_put32(uint8_t *p, uint32_t value) {
+  p[0] = (uint8_t) value;
+  p[1] = (uint8_t) (value >> 8);
+  p[2] = (uint8_t) (value >> 16);
+  p[3] = (uint8_t) (value >> 24);
+}
+
+/* the varints of count points, five each of at most ten bytes, end within
+   length bytes, so decoding them can't read past the block */
+static bool gps2_log_points_fit(const uint8_t *p, uint16_t length, uint16_t count) {
+  uint32_t varints = (uint32_t) count * 5;
+  size_t i = 0;
+  int n;
+
+  for (; varints > 0; varints--) {
+    for (n = 1;; n++) {
+      if (i == length) {
+        return false;
+      }
+      if (!(p[i++] & 0x80) || n == 10) {
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+/* a whole block with a good CRC, whatever its sequence number. The header is
+   not trusted beyond that, the log may have come from anywhere */
+static bool gps2_log_block_good(const uint8_t *block) {
+  uint16_t length = gps2_log_get16(block + 8);
+  uint16_t count = gps2_log_get16(block + 10);
+  uint32_t crc;
+
+  /* every point takes at least a byte for each of its five fields */
+  if (memcmp(block, gps2_log_magic, 4) != 0 || length > GPS2_TRACK_BLOCK_SIZE || count == 0
+      || (uint32_t) count * 5 > length) {
+    return false;
+  }
+  crc = gps2_log_crc32(0, block, 12);
+  crc = gps2_log_crc32(crc, block + GPS2_LOG_HEADER_SIZE, length);
+  return crc == gps2_log_get32(block + 12)
+         && gps2_log_points_fit(block + GPS2_LOG_HEADER_SIZE, length, count);
+}
+
+/* the time of the block's keyframe */
+static int64_t gps2_log_block_start(const uint8_t *block) {
+  struct gps2_track_cursor cursor;
+
+  gps2_track_block_next(block + GPS2_LOG_HEADER_SIZE, 0, &cursor);
+  return cursor.point.time_ms;
+}
+
+/* write the block being filled at the next block boundary, and start another.
+   The points are dropped if the write fails, so the file stays in whole blocks */
+static bool gps2_log_write_block(struct gps2_log *log) {
+  uint8_t out[GPS2_LOG_BLOCK_SIZE];
+  uint32_t crc;
+  bool written;
+
+  memcpy(out, gps2_log_magic, 4);
+  gps2_log_put32(out + 4, log->sequence);
+  gps2_log_put16(out + 8, log->block.length);
+  gps2_log_put16(out + 10, log->block.count);
+  memcpy(out + GPS2_LOG_HEADER_SIZE, log->block.data, log->block.length);
+  memset(out + GPS2_LOG_HEADER_SIZE + log->block.length, 0, GPS2_TRACK_BLOCK_SIZE - log->block.length);
+  crc = gps2_log_crc32(0, out, 12);
+  crc = gps2_log_crc32(crc, out + GPS2_LOG_HEADER_SIZE, log->block.length);
+  gps2_log_put32(out + 12, crc);
+
+  written = write(log->fd, out, GPS2_LOG_BLOCK_SIZE) == GPS2_LOG_BLOCK_SIZE;
+  if (written) {
+    log->offset += GPS2_LOG_BLOCK_SIZE;
+    log->sequence++;
+    log->blocks_written++;
+  } else {
+    /* back to the boundary, the next block goes over whatever got out */
+    log->write_errors++;
+    lseek(log->fd, log->offset, SEEK_SET);
+  }
+  log->block.length = 0;
+  log->block.count = 0;
+  return written;
+}
+
+bool gps2_log_open(struct gps2_log *log, const char *path, int flush_ms) {
+  uint8_t block[GPS2_LOG_BLOCK_SIZE];
+  const uint8_t *p;
+  long blocks;
+  int i;
+
+  memset(log, 0, sizeof(struct gps2_log));
+  log->flush_ms = flush_ms;
+  log->fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (log->fd < 0) {
+    return false;
+  }
+
+  /* back from the end to the last good block. Only the last can be torn, but
+  a partial block at the end is skipped first */
+  blocks = lseek(log->fd, 0, SEEK_END) / GPS2_LOG_BLOCK_SIZE;
+  for (; blocks > 0; blocks--) {
+    if (lseek(log->fd, (blocks - 1) * GPS2_LOG_BLOCK_SIZE, SEEK_SET) < 0
+        || read(log->fd, block, GPS2_LOG_BLOCK_SIZE) != GPS2_LOG_BLOCK_SIZE) {
+      continue;
+    }
+    if (gps2_log_block_good(block)) {
+      /* carry on from its last point */
+      log->sequence = gps2_log_get32(block + 4) + 1;
+      p = block + GPS2_LOG_HEADER_SIZE;
+      for (i = 0; i < gps2_log_get16(block + 10); i++) {
+        p = gps2_track_block_next(p, i, &log->cursor);
+      }
+      log->have_point = true;
+      break;
+    }
+  }
+
+  log->offset = blocks * GPS2_LOG_BLOCK_SIZE;
+  if (lseek(log->fd, log->offset, SEEK_SET) != log->offset) {
+    close(log->fd);
+    log->fd = -1;
+    return false;
+  }
+  return true;
+}
+
+bool gps2_log_add(struct gps2_log *log, const struct mgos_gps_location_fixed *location) {
+  struct gps2_track_point point;
+  bool ok = true;
+
+  gps2_track_point_set(&point, location);
+  if (log->have_point && point.time_ms < log->cursor.point.time_ms) {
+    /* readers search the blocks by time */
+    log->rejected++;
+    return false;
+  }
+
+  if (log->block.count > 0 && log->flush_ms > 0 && point.time_ms - log->block.start_ms >= log->flush_ms) {
+    ok = gps2_log_write_block(log);
+  }
+  if (!gps2_track_block_add(&log->block, &log->cursor, &point)) {
+    ok = gps2_log_write_block(log) && ok;
+    /* a keyframe always fits */
+    gps2_track_block_add(&log->block, &log->cursor, &point);
+  }
+  log->have_point = true;
+  log->points++;
+  return ok;
+}
+
+bool gps2_log_flush(struct gps2_log *log) {
+  if (log->block.count == 0) {
+    return true;
+  }
+  return gps2_log_write_block(log);
+}
+
+void gps2_log_close(struct gps2_log *log) {
+  if (log->fd < 0) {
+    return;
+  }
+  gps2_log_flush(log);
+  close(log->fd);
+  log->fd = -1;
+}
+
+size_t gps2_log_reader_init(struct gps2_log_reader *reader, const void *data, size_t length) {
+  const uint8_t *block = data;
+  size_t count = length / GPS2_LOG_BLOCK_SIZE;
+  uint32_t first;
+  size_t i;
+
+  reader->data = data;
+  first = count > 0 ? gps2_log_get32(block + 4) : 0;
+  for (i = 0; i < count; i++, block += GPS2_LOG_BLOCK_SIZE) {
+    if (!gps2_log_block_good(block) || gps2_log_get32(block + 4) != first + (uint32_t) i) {
+      break;
+    }
+  }
+  reader->blocks = i;
+  reader->torn = count - i + (length % GPS2_LOG_BLOCK_SIZE != 0);
+  return i;
+}
+
+uint64_t gps2_log_reader_points(const struct gps2_log_reader *reader) {
+  uint64_t points = 0;
+  size_t i;
+
+  for (i = 0; i < reader->blocks; i++) {
+    points += gps2_log_get16(reader->data + i * GPS2_LOG_BLOCK_SIZE + 10);
+  }
+  return points;
+}
+
+/* the reader's blocks, for the gps2_track iterator */
+static const uint8_t *gps2_log_points(const void *arg, size_t i, uint16_t *count) {
+  const uint8_t *block = ((const struct gps2_log_reader *) arg)->data + i * GPS2_LOG_BLOCK_SIZE;
+
+  *count = gps2_log_get16(block + 10);
+  return block + GPS2_LOG_HEADER_SIZE;
+}
+
+static int64_t gps2_log_start_ms(const void *arg, size_t i) {
+  return gps2_log_block_start(((const struct gps2_log_reader *) arg)->data + i * GPS2_LOG_BLOCK_SIZE);
+}
+
+static void gps2_log_blocks(const struct gps2_log_reader *reader, struct gps2_track_blocks *blocks) {
+  blocks->arg = reader;
+  blocks->count = reader->blocks;
+  blocks->points = gps2_log_points;
+  blocks->start_ms = gps2_log_start_ms;
+}
+
+void gps2_log_iter_init(const struct gps2_log_reader *reader, struct gps2_track_iter *iter) {
+  struct gps2_track_blocks blocks;
+
+  gps2_log_blocks(reader, &blocks);
+  gps2_track_blocks_iter_init(&blocks, iter);
+}
+
+bool gps2_log_seek(const struct gps2_log_reader *reader, struct gps2_track_iter *iter, int64_t time_ms) {
+  struct gps2_track_blocks blocks;
+
+  gps2_log_blocks(reader, &blocks);
+  return gps2_track_blocks_seek(&blocks, iter, time_ms);
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <ctype.h>
+
+#include "mgos.h"
+#include "gps2_pmtk.h"
+
+
+static const char gps2_pmtk_hex[] = "0123456789ABCDEF";
+
+void gps2_pmtk_init(struct gps2_pmtk_queue *queue) {
+  memset(queue, 0, sizeof(struct gps2_pmtk_queue));
+  queue->timer = MGOS_INVALID_TIMER_ID;
+}
+
+/* the three digit command number after "PMTK", or -1 */
+static int gps2_pmtk_number(const char *p) {
+  if (strncmp(p, "PMTK", 4) != 0 || !isdigit((unsigned char) p[4]) || !isdigit((unsigned char) p[5])
+      || !isdigit((unsigned char) p[6])) {
+    return -1;
+  }
+  return (p[4] - '0') * 100 + (p[5] - '0') * 10 + (p[6] - '0');
+}
+
+size_t gps2_pmtk_format(char *sentence, const char *command, int *number) {
+  size_t length;
+  uint8_t checksum;
+
+  length = strlen(command);
+  if (command[0] == '$' && length >= 6 && command[length - 5] == '*' && command[length - 1] == '\n') {
+    /* already a sentence, e.g. from gps2_commands.h, so it goes as it is */
+    *number = gps2_pmtk_number(command + 1);
+    if (*number < 0 || length > GPS2_PMTK_MAX_SENTENCE) {
+      return 0;
+    }
+    memcpy(sentence, command, length);
+    return length;
+  }
+
+  if (command[0] == '$') {
+    command++;
+    length--;
+  }
+  *number = gps2_pmtk_number(command);
+  if (*number < 0 || length > GPS2_PMTK_MAX_COMMAND) {
+    return 0;
+  }
+  /* the checksum is ours to add, and nothing unprintable goes on the wire */
+  if (minmea_printable_length(command, length) != length || memchr(command, '*', length) != NULL) {
+    return 0;
+  }
+
+  checksum = minmea_xor(command, length);
+  sentence[0] = '$';
+  memcpy(sentence + 1, command, length);
+  sentence[length + 1] = '*';
+  sentence[length + 2] = gps2_pmtk_hex[checksum >> 4];
+  sentence[length + 3] = gps2_pmtk_hex[checksum & 0x0f];
+  sentence[length + 4] = '\r';
+  sentence[length + 5] = '\n';
+  return length + 6;
+}
+
+bool gps2_pmtk_push(struct gps2_pmtk_queue *queue, const char *command, gps2_pmtk_cb cb, void *userdata) {
+  struct gps2_pmtk_command *entry;
+  size_t length;
+  int number;
+
+  if (queue->count == GPS2_PMTK_QUEUE_LENGTH) {
+    return false;
+  }
+  entry = &queue->commands[(queue->first + queue->count) % GPS2_PMTK_QUEUE_LENGTH];
+  length = gps2_pmtk_format(entry->sentence, command, &number);
+  if (length == 0) {
+    return false;
+  }
+  entry->length = length;
+  entry->number = number;
+  entry->cb = cb;
+  entry->userdata = userdata;
+  queue->count++;
+  return true;
+}
+
+struct gps2_pmtk_command *gps2_pmtk_first(struct gps2_pmtk_queue *queue) {
+  if (queue->count == 0) {
+    return NULL;
+  }
+  return &queue->commands[queue->first];
+}
+
+void gps2_pmtk_pop(struct gps2_pmtk_queue *queue, struct gps2_pmtk_command *command) {
+  *command = queue->commands[queue->first];
+  queue->first = (queue->first + 1) % GPS2_PMTK_QUEUE_LENGTH;
+  queue->count--;
+  queue->sent = false;
+}
+
+bool gps2_pmtk_parse_ack(const char *line, int *number, enum gps2_pmtk_result *result) {
+  const char *p = line + 9;
+  int value = 0;
+
+  /* $PMTK001,nnn,f */
+  if (strncmp(line, "$PMTK001,", 9) != 0 || !minmea_check(line, true)) {
+    return false;
+  }
+  if (!isdigit((unsigned char) *p)) {
+    return false;
+  }
+  while (isdigit((unsigned char) *p)) {
+    value = value * 10 + (*p++ - '0');
+  }
+  if (p[0] != ',' || p[1] < '0' || p[1] > '3') {
+    return false;
+  }
+  *number = value;
+  *result = (enum gps2_pmtk_result) (p[1] - '0');
+  return true;
+}
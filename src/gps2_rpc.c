@@ -0,0 +1,274 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdarg.h>
+
+#include "mgos.h"
+#include "mgos_rpc.h"
+#include "gps2.h"
+#include "gps2_rpc.h"
+
+
+/* handlers all run on the Mongoose OS task, so they can share it */
+static char gps2_rpc_buffer[GPS2_RPC_BUFFER_SIZE];
+
+struct gps2_rpc_out {
+  char *buf;
+  size_t size;
+  size_t len; /* can run past size, then the response didn't fit */
+};
+
+static void gps2_rpc_printf(struct gps2_rpc_out *out, const char *fmt, ...) {
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(out->len < out->size ? out->buf + out->len : NULL,
+                out->len < out->size ? out->size - out->len : 0, fmt, ap);
+  va_end(ap);
+  if (n > 0) {
+    out->len += n;
+  }
+}
+
+/* "name":value for a fixed point value with decimals places, e.g. -1.2345678
+   for -12345678 and 7 */
+static void gps2_rpc_fixed(struct gps2_rpc_out *out, const char *name, int32_t value, int decimals) {
+  static const int32_t powers[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000};
+  uint32_t magnitude;
+
+  if (value == MGOS_GPS_FIXED_UNKNOWN) {
+    gps2_rpc_printf(out, "\"%s\":null", name);
+    return;
+  }
+  magnitude = value < 0 ? (uint32_t) -value : (uint32_t) value;
+  gps2_rpc_printf(out, "\"%s\":%s%lu.%0*lu", name, value < 0 ? "-" : "",
+                  (unsigned long) (magnitude / powers[decimals]), decimals,
+                  (unsigned long) (magnitude % powers[decimals]));
+}
+
+static void gps2_rpc_int(struct gps2_rpc_out *out, const char *name, int32_t value) {
+  if (value == MGOS_GPS_FIXED_UNKNOWN) {
+    gps2_rpc_printf(out, "\"%s\":null", name);
+  } else {
+    gps2_rpc_printf(out, "\"%s\":%ld", name, (long) value);
+  }
+}
+
+static void gps2_rpc_histogram(struct gps2_rpc_out *out, const char *name, const struct gps2_histogram *histogram) {
+  int i;
+
+  gps2_rpc_printf(out, "\"%s\":{\"max_us\":%lu,\"buckets\":[", name, (unsigned long) histogram->max_us);
+  for (i = 0; i < GPS2_HISTOGRAM_BUCKETS; i++) {
+    gps2_rpc_printf(out, i == 0 ? "%lu" : ",%lu", (unsigned long) histogram->buckets[i]);
+  }
+  gps2_rpc_printf(out, "]}");
+}
+
+static void gps2_rpc_send(struct mg_rpc_request_info *ri, const struct gps2_rpc_out *out) {
+  if (out->len >= out->size) {
+    mg_rpc_send_errorf(ri, 500, "response too large");
+    return;
+  }
+  mg_rpc_send_responsef(ri, "%.*s", (int) out->len, out->buf);
+}
+
+/* the device for a request, or NULL after sending the error */
+static struct gps2 *gps2_rpc_device(struct mg_rpc_request_info *ri, struct gps2_rpc_out *out) {
+  struct gps2 *dev = gps2_get_global_device();
+
+  if (dev == NULL) {
+    mg_rpc_send_errorf(ri, 503, "no GPS device");
+    return NULL;
+  }
+  out->buf = gps2_rpc_buffer;
+  out->size = sizeof(gps2_rpc_buffer);
+  out->len = 0;
+  return dev;
+}
+
+static void gps2_rpc_navigation_handler(struct mg_rpc_request_info *ri, void *cb_arg, struct mg_rpc_frame_info *fi,
+                                        struct mg_str args) {
+  struct gps2_rpc_out out;
+  struct mgos_gps_location_fixed location;
+  struct mgos_gps_link link;
+  struct gps2 *dev;
+
+  if ((dev = gps2_rpc_device(ri, &out)) == NULL) {
+    return;
+  }
+  if (gps2_get_device_location_fixed(dev, &location) == 0) {
+    mg_rpc_send_errorf(ri, 404, "no location yet");
+    return;
+  }
+
+  gps2_rpc_printf(&out, "{\"time\":%lld,\"microseconds\":%d,", (long long) location.time, location.microseconds);
+  gps2_rpc_fixed(&out, "latitude", location.latitude_e7, 7);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_fixed(&out, "longitude", location.longitude_e7, 7);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_fixed(&out, "speed", location.speed_e3, 3);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_fixed(&out, "bearing", location.bearing_e2, 2);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_fixed(&out, "variation", location.variation_e2, 2);
+  gps2_rpc_printf(&out, ",\"age_ms\":%lld,", (long long) ((mgos_uptime_micros() - location.elapsed_time) / 1000));
+  /* false once the receiver has gone quiet, so the location is stale */
+  gps2_get_device_link(dev, &link);
+  gps2_rpc_printf(&out, "\"connected\":%s}", link.connected ? "true" : "false");
+  gps2_rpc_send(ri, &out);
+}
+
+static void gps2_rpc_fix_handler(struct mg_rpc_request_info *ri, void *cb_arg, struct mg_rpc_frame_info *fi,
+                                 struct mg_str args) {
+  struct gps2_rpc_out out;
+  struct mgos_gps_fix fix;
+  struct gps2 *dev;
+
+  if ((dev = gps2_rpc_device(ri, &out)) == NULL) {
+    return;
+  }
+  if (!gps2_get_device_fix(dev, &fix)) {
+    mg_rpc_send_errorf(ri, 404, "no fix yet");
+    return;
+  }
+
+  gps2_rpc_printf(&out, "{\"time\":%lld,\"microseconds\":%d,\"valid\":%s,", (long long) fix.time, fix.microseconds,
+                  fix.valid ? "true" : "false");
+  gps2_rpc_fixed(&out, "latitude", fix.latitude_e7, 7);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_fixed(&out, "longitude", fix.longitude_e7, 7);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_fixed(&out, "altitude", fix.altitude_e3, 3);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_fixed(&out, "geoid_separation", fix.geoid_separation_e3, 3);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_fixed(&out, "speed", fix.speed_e3, 3);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_fixed(&out, "bearing", fix.bearing_e2, 2);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_fixed(&out, "variation", fix.variation_e2, 2);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_int(&out, "fix_quality", fix.fix_quality);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_int(&out, "fix_type", fix.fix_type);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_int(&out, "satellites_used", fix.satellites_used);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_fixed(&out, "pdop", fix.pdop_e2, 2);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_fixed(&out, "hdop", fix.hdop_e2, 2);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_fixed(&out, "vdop", fix.vdop_e2, 2);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_fixed(&out, "latitude_error", fix.latitude_error_e3, 3);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_fixed(&out, "longitude_error", fix.longitude_error_e3, 3);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_fixed(&out, "altitude_error", fix.altitude_error_e3, 3);
+  gps2_rpc_printf(&out, ",\"age_ms\":%lld}", (long long) ((mgos_uptime_micros() - fix.elapsed_time) / 1000));
+  gps2_rpc_send(ri, &out);
+}
+
+static void gps2_rpc_sky_handler(struct mg_rpc_request_info *ri, void *cb_arg, struct mg_rpc_frame_info *fi,
+                                 struct mg_str args) {
+  struct gps2_rpc_out out;
+  struct mgos_gps_sky_view view;
+  const struct mgos_gps_satellite *sat;
+  struct gps2 *dev;
+  int index;
+  int i;
+
+  if ((dev = gps2_rpc_device(ri, &out)) == NULL) {
+    return;
+  }
+
+  /* satellites are [prn, elevation, azimuth, snr, used] */
+  gps2_rpc_printf(&out, "{\"views\":[");
+  for (index = 0; gps2_get_device_sky_view(dev, index, &view); index++) {
+    gps2_rpc_printf(&out, "%s{\"talker\":\"%s\",\"used\":%u,\"satellites\":[", index == 0 ? "" : ",", view.talker,
+                    view.used_count);
+    for (i = 0; i < view.count; i++) {
+      sat = &view.satellites[i];
+      gps2_rpc_printf(&out, "%s[%u,%d,%u,%u,%u]", i == 0 ? "" : ",", sat->prn, sat->elevation, sat->azimuth,
+                      sat->snr, sat->used);
+    }
+    gps2_rpc_printf(&out, "]}");
+  }
+  gps2_rpc_printf(&out, "]}");
+  gps2_rpc_send(ri, &out);
+}
+
+static void gps2_rpc_stats_handler(struct mg_rpc_request_info *ri, void *cb_arg, struct mg_rpc_frame_info *fi,
+                                   struct mg_str args) {
+  struct gps2_rpc_out out;
+  struct gps2_stats stats;
+  struct mgos_gps_link link;
+  struct gps2 *dev;
+  int id;
+
+  if ((dev = gps2_rpc_device(ri, &out)) == NULL) {
+    return;
+  }
+  gps2_get_device_stats(dev, &stats);
+  gps2_get_device_link(dev, &link);
+
+  gps2_rpc_printf(&out, "{\"rx_bytes\":%lu,\"rx_overflows\":%lu,\"rx_high_water\":%lu,",
+                  (unsigned long) stats.rx_bytes, (unsigned long) stats.rx_overflows,
+                  (unsigned long) stats.rx_high_water);
+  gps2_rpc_printf(&out, "\"lines\":%lu,\"lines_dropped\":%lu,\"filtered_lines\":%lu,\"unknown_lines\":%lu,",
+                  (unsigned long) stats.lines, (unsigned long) stats.lines_dropped,
+                  (unsigned long) stats.filtered_lines, (unsigned long) stats.unknown_lines);
+  gps2_rpc_printf(&out, "\"proprietary_lines\":%lu,\"checksum_failures\":%lu,\"parse_failures\":[",
+                  (unsigned long) stats.proprietary_lines, (unsigned long) stats.checksum_failures);
+  /* by sentence id, from RMC */
+  for (id = MINMEA_SENTENCE_RMC; id < MINMEA_SENTENCE_USER; id++) {
+    gps2_rpc_printf(&out, id == MINMEA_SENTENCE_RMC ? "%lu" : ",%lu", (unsigned long) stats.parse_failures[id]);
+  }
+  gps2_rpc_printf(&out, "],\"ubx_packets\":%lu,\"ubx_checksum_failures\":%lu,\"ubx_dropped\":%lu,",
+                  (unsigned long) stats.ubx_packets, (unsigned long) stats.ubx_checksum_failures,
+                  (unsigned long) stats.ubx_dropped);
+  gps2_rpc_printf(&out, "\"pmtk_commands\":%lu,\"pmtk_timeouts\":%lu,",
+                  (unsigned long) stats.pmtk_commands, (unsigned long) stats.pmtk_timeouts);
+  /* null until there has been one */
+  gps2_rpc_int(&out, "first_sentence_ms", stats.first_sentence_ms >= 0 ? stats.first_sentence_ms : MGOS_GPS_FIXED_UNKNOWN);
+  gps2_rpc_printf(&out, ",\"connected\":%s,\"disconnects\":%lu,\"recoveries\":%lu,", link.connected ? "true" : "false",
+                  (unsigned long) link.disconnects, (unsigned long) link.recoveries);
+  gps2_rpc_printf(&out, "\"tx_bytes_queued\":%lu,\"tx_bytes_dropped\":%lu,\"events\":%lu,\"dispatcher_runs\":%lu,",
+                  (unsigned long) stats.tx_bytes_queued, (unsigned long) stats.tx_bytes_dropped,
+                  (unsigned long) stats.events, (unsigned long) stats.dispatcher_runs);
+  gps2_rpc_histogram(&out, "dispatcher_us", &stats.dispatcher_us);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_histogram(&out, "parse_us", &stats.parse_us);
+  gps2_rpc_printf(&out, ",");
+  gps2_rpc_histogram(&out, "handler_us", &stats.handler_us);
+  gps2_rpc_printf(&out, "}");
+  gps2_rpc_send(ri, &out);
+}
+
+bool gps2_rpc_init(void) {
+  struct mg_rpc *rpc = mgos_rpc_get_global();
+
+  if (rpc == NULL) {
+    return false;
+  }
+  mg_rpc_add_handler(rpc, "gps.navigation", "", gps2_rpc_navigation_handler, NULL);
+  mg_rpc_add_handler(rpc, "gps.fix", "", gps2_rpc_fix_handler, NULL);
+  mg_rpc_add_handler(rpc, "gps.sky", "", gps2_rpc_sky_handler, NULL);
+  mg_rpc_add_handler(rpc, "gps.stats", "", gps2_rpc_stats_handler, NULL);
+  return true;
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mgos.h"
+#include "gps2_simplify.h"
+
+
+/* 1e-7 degrees of latitude per km, on a sphere of radius 6371 km */
+#define GPS2_SIMPLIFY_E7_PER_KM 89932
+
+/* fixes further than this from the anchor, about 11 km, are sent as they are.
+   It keeps the products in the corridor test within 64 bits */
+#define GPS2_SIMPLIFY_MAX_OFFSET (1 << 20)
+
+/* cosine of whole degrees, 1 is 32768 */
+static const uint16_t gps2_simplify_cos_table[91] = {
+  32767, 32763, 32748, 32723, 32688, 32643, 32588, 32524, 32449, 32365, 32270, 32166,
+  32052, 31928, 31795, 31651, 31499, 31336, 31164, 30983, 30792, 30592, 30382, 30163,
+  29935, 29698, 29452, 29197, 28932, 28660, 28378, 28088, 27789, 27482, 27166, 26842,
+  26510, 26170, 25822, 25466, 25102, 24730, 24351, 23965, 23571, 23170, 22763, 22348,
+  21926, 21498, 21063, 20622, 20174, 19720, 19261, 18795, 18324, 17847, 17364, 16877,
+  16384, 15886, 15384, 14876, 14365, 13848, 13328, 12803, 12275, 11743, 11207, 10668,
+  10126, 9580, 9032, 8481, 7927, 7371, 6813, 6252, 5690, 5126, 4560, 3993,
+  3425, 2856, 2286, 1715, 1144, 572, 0
+};
+
+static int32_t gps2_simplify_cos(int32_t latitude_e7) {
+  uint32_t latitude = latitude_e7 < 0 ? -(uint32_t) latitude_e7 : (uint32_t) latitude_e7;
+  uint32_t degrees = latitude / 10000000;
+  uint32_t fraction = latitude % 10000000;
+
+  if (degrees >= 90) {
+    return 0;
+  }
+  return gps2_simplify_cos_table[degrees]
+         - (int32_t) ((int64_t) (gps2_simplify_cos_table[degrees] - gps2_simplify_cos_table[degrees + 1])
+                      * fraction / 10000000);
+}
+
+static uint32_t gps2_simplify_sqrt(uint64_t value) {
+  uint64_t root = 0;
+  uint64_t bit = (uint64_t) 1 << 62;
+
+  while (bit > value) {
+    bit >>= 2;
+  }
+  while (bit != 0) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (uint32_t) root;
+}
+
+static inline int64_t gps2_simplify_ms(const struct mgos_gps_location_fixed *location) {
+  return (int64_t) location->time * 1000 + location->microseconds / 1000;
+}
+
+static void gps2_simplify_anchor(struct gps2_simplify *simplify, const struct mgos_gps_location_fixed *location) {
+  simplify->have_anchor = true;
+  simplify->anchor_latitude_e7 = location->latitude_e7;
+  simplify->anchor_longitude_e7 = location->longitude_e7;
+  simplify->anchor_ms = gps2_simplify_ms(location);
+  simplify->anchor_cos = gps2_simplify_cos(location->latitude_e7);
+  simplify->count = 0;
+}
+
+static int32_t gps2_simplify_clamp(int64_t value) {
+  if (value > GPS2_SIMPLIFY_MAX_OFFSET) {
+    return GPS2_SIMPLIFY_MAX_OFFSET;
+  }
+  if (value < -GPS2_SIMPLIFY_MAX_OFFSET) {
+    return -GPS2_SIMPLIFY_MAX_OFFSET;
+  }
+  return (int32_t) value;
+}
+
+/* location relative to the anchor. false if it is too far for the corridor
+   test, when the offset is clamped */
+static bool gps2_simplify_offset(const struct gps2_simplify *simplify, const struct mgos_gps_location_fixed *location,
+                                 struct gps2_simplify_offset *offset) {
+  int64_t east = (int64_t) location->longitude_e7 - simplify->anchor_longitude_e7;
+  int64_t north = (int64_t) location->latitude_e7 - simplify->anchor_latitude_e7;
+
+  /* across the antimeridian */
+  if (east > 1800000000) {
+    east -= 3600000000LL;
+  } else if (east < -1800000000) {
+    east += 3600000000LL;
+  }
+  east = east * simplify->anchor_cos / 32768;
+
+  offset->x = gps2_simplify_clamp(east);
+  offset->y = gps2_simplify_clamp(north);
+  return offset->x == east && offset->y == north;
+}
+
+/* every fix held back is within tolerance of the line from the anchor to end,
+   and not beyond either end of it */
+static bool gps2_simplify_corridor(const struct gps2_simplify *simplify, const struct gps2_simplify_offset *end) {
+  int64_t length2 = (int64_t) end->x * end->x + (int64_t) end->y * end->y;
+  int64_t tolerance2 = (int64_t) simplify->tolerance * simplify->tolerance;
+  int64_t margin;
+  int64_t cross;
+  int64_t dot;
+  const struct gps2_simplify_offset *p;
+  int i;
+
+  if (length2 == 0) {
+    /* still back where it started */
+    for (i = 0; i < simplify->count; i++) {
+      p = &simplify->window[i];
+      if ((int64_t) p->x * p->x + (int64_t) p->y * p->y > tolerance2) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /* distance from the line times its length, compared without dividing */
+  margin = (int64_t) simplify->tolerance * gps2_simplify_sqrt((uint64_t) length2);
+  for (i = 0; i < simplify->count; i++) {
+    p = &simplify->window[i];
+    cross = (int64_t) end->x * p->y - (int64_t) end->y * p->x;
+    if (cross > margin || cross < -margin) {
+      return false;
+    }
+    dot = (int64_t) end->x * p->x + (int64_t) end->y * p->y;
+    if (dot < -margin || dot > length2 + margin) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void gps2_simplify_init(struct gps2_simplify *simplify, int tolerance_m, int heartbeat_ms) {
+  memset(simplify, 0, sizeof(struct gps2_simplify));
+  simplify->tolerance = (int32_t) ((int64_t) tolerance_m * GPS2_SIMPLIFY_E7_PER_KM / 1000);
+  simplify->heartbeat_ms = heartbeat_ms;
+}
+
+bool gps2_simplify_add(struct gps2_simplify *simplify, const struct mgos_gps_location_fixed *location,
+                       struct mgos_gps_location_fixed *out) {
+  struct gps2_simplify_offset offset;
+  bool near;
+
+  simplify->fixes++;
+  if (!simplify->have_anchor) {
+    gps2_simplify_anchor(simplify, location);
+    *out = *location;
+    simplify->sent++;
+    return true;
+  }
+
+  near = gps2_simplify_offset(simplify, location, &offset);
+  if (near && simplify->count < GPS2_SIMPLIFY_WINDOW && gps2_simplify_corridor(simplify, &offset)) {
+    if (simplify->heartbeat_ms > 0 && gps2_simplify_ms(location) - simplify->anchor_ms >= simplify->heartbeat_ms) {
+      /* still on the line, but it has been a while. The ones held back are on
+      the way to it */
+      gps2_simplify_anchor(simplify, location);
+      *out = *location;
+      simplify->sent++;
+      return true;
+    }
+    simplify->window[simplify->count++] = offset;
+    simplify->pending = *location;
+    return false;
+  }
+
+  if (simplify->count == 0) {
+    /* nothing held back, so it is too far from the anchor */
+    gps2_simplify_anchor(simplify, location);
+    *out = *location;
+    simplify->sent++;
+    return true;
+  }
+
+  /* the corridor is broken: the last one that fitted is a corner, and the
+  line starts again from it */
+  *out = simplify->pending;
+  gps2_simplify_anchor(simplify, &simplify->pending);
+  gps2_simplify_offset(simplify, location, &simplify->window[0]);
+  simplify->count = 1;
+  simplify->pending = *location;
+  simplify->sent++;
+  return true;
+}
+
+bool gps2_simplify_flush(struct gps2_simplify *simplify, struct mgos_gps_location_fixed *out) {
+  if (simplify->count == 0) {
+    return false;
+  }
+  *out = simplify->pending;
+  gps2_simplify_anchor(simplify, &simplify->pending);
+  simplify->sent++;
+  return true;
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mgos.h"
+#include "gps2_sky.h"
+
+
+void gps2_sky_init(struct gps2_sky *sky, struct gps2 *dev) {
+  int i;
+
+  memset(sky, 0, sizeof(struct gps2_sky));
+  for (i = 0; i < GPS2_SKY_VIEWS; i++) {
+    sky->views[i].dev = dev;
+  }
+}
+
+/* the view for a talker, taking a free one if we haven't seen it before */
+static int gps2_sky_view_index(struct gps2_sky *sky, const char *talker) {
+  int i;
+
+  for (i = 0; i < GPS2_SKY_VIEWS; i++) {
+    if (sky->views[i].talker[0] == '\0') {
+      sky->views[i].talker[0] = talker[0];
+      sky->views[i].talker[1] = talker[1];
+      return i;
+    }
+    if (sky->views[i].talker[0] == talker[0] && sky->views[i].talker[1] == talker[1]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static bool gps2_sky_prn_used(const uint32_t *used, uint8_t prn) {
+  return (used[prn >> 5] >> (prn & 31)) & 1;
+}
+
+static void gps2_sky_add_gsa(struct gps2_sky *sky, const struct minmea_frame *frame) {
+  const struct minmea_sentence_gsa *gsa = &frame->data.gsa;
+  uint32_t *used;
+  int view;
+  int i;
+
+  /* the first GSA after a GSV starts the next epoch's set */
+  if (sky->gsv_since_gsa) {
+    memset(sky->used, 0, sizeof(sky->used));
+    memset(sky->used_any, 0, sizeof(sky->used_any));
+    sky->gsv_since_gsa = false;
+  }
+
+  if (frame->talker[0] == 'G' && frame->talker[1] == 'N') {
+    used = sky->used_any;
+  } else {
+    view = gps2_sky_view_index(sky, frame->talker);
+    if (view < 0) {
+      return;
+    }
+    used = sky->used[view];
+  }
+
+  for (i = 0; i < 12; i++) {
+    if (gsa->sats[i] > 0 && gsa->sats[i] < 256) {
+      used[gsa->sats[i] >> 5] |= (uint32_t) 1 << (gsa->sats[i] & 31);
+    }
+  }
+}
+
+/* mark the satellites in the fix and count them */
+static void gps2_sky_mark_used(struct gps2_sky *sky, int view) {
+  struct mgos_gps_sky_view *sky_view = &sky->views[view];
+  struct mgos_gps_satellite *sat;
+  int i;
+
+  sky_view->used_count = 0;
+  for (i = 0; i < sky_view->count; i++) {
+    sat = &sky_view->satellites[i];
+    sat->used = gps2_sky_prn_used(sky->used[view], sat->prn) || gps2_sky_prn_used(sky->used_any, sat->prn);
+    sky_view->used_count += sat->used;
+  }
+}
+
+static const struct mgos_gps_sky_view *gps2_sky_add_gsv(struct gps2_sky *sky, const struct minmea_frame *frame) {
+  const struct minmea_sentence_gsv *gsv = &frame->data.gsv;
+  struct mgos_gps_sky_view *sky_view;
+  struct mgos_gps_sky_view *complete;
+  struct mgos_gps_satellite *sat;
+  int view;
+  int i;
+
+  sky->gsv_since_gsa = true;
+
+  view = gps2_sky_view_index(sky, frame->talker);
+  if (view < 0) {
+    return NULL;
+  }
+  sky_view = &sky->views[view];
+
+  if (gsv->msg_nr == 1) {
+    /* a new cycle, whatever happened to the last one */
+    sky_view->count = 0;
+    sky->total_msgs[view] = gsv->total_msgs;
+    sky->next_msg[view] = 1;
+  }
+
+  if (gsv->msg_nr != sky->next_msg[view] || gsv->total_msgs != sky->total_msgs[view]) {
+    /* we missed a message, wait for the next cycle */
+    sky->next_msg[view] = 0;
+    return NULL;
+  }
+
+  for (i = 0; i < 4 && sky_view->count < MGOS_GPS_SKY_MAX_SATELLITES; i++) {
+    if (gsv->sats[i].nr <= 0 || gsv->sats[i].nr > 255) {
+      continue;
+    }
+    sat = &sky_view->satellites[sky_view->count++];
+    sat->prn = gsv->sats[i].nr;
+    sat->elevation = gsv->sats[i].elevation;
+    sat->azimuth = gsv->sats[i].azimuth;
+    sat->snr = gsv->sats[i].snr;
+    sat->used = 0;
+  }
+
+  if (gsv->msg_nr < gsv->total_msgs) {
+    sky->next_msg[view]++;
+    return NULL;
+  }
+
+  sky->next_msg[view] = 0;
+  gps2_sky_mark_used(sky, view);
+
+  /* keep it while the next cycle is assembled, for readers between events */
+  complete = &sky->complete[view];
+  memcpy(complete, sky_view,
+         offsetof(struct mgos_gps_sky_view, satellites) + sky_view->count * sizeof(struct mgos_gps_satellite));
+  return complete;
+}
+
+struct mgos_gps_sky_view *gps2_sky_complete_view(struct gps2_sky *sky, const char *talker, int *index) {
+  int view = gps2_sky_view_index(sky, talker);
+
+  if (view < 0) {
+    return NULL;
+  }
+  sky->complete[view].dev = sky->views[view].dev;
+  sky->complete[view].talker[0] = talker[0];
+  sky->complete[view].talker[1] = talker[1];
+  *index = view;
+  return &sky->complete[view];
+}
+
+const struct mgos_gps_sky_view *gps2_sky_get(const struct gps2_sky *sky, int index) {
+  if (index < 0 || index >= GPS2_SKY_VIEWS || sky->complete[index].talker[0] == '\0') {
+    return NULL;
+  }
+  return &sky->complete[index];
+}
+
+const struct mgos_gps_sky_view *gps2_sky_add(struct gps2_sky *sky, const struct minmea_frame *frame) {
+  switch (frame->id) {
+    case MINMEA_SENTENCE_GSA:
+      gps2_sky_add_gsa(sky, frame);
+      return NULL;
+    case MINMEA_SENTENCE_GSV:
+      return gps2_sky_add_gsv(sky, frame);
+    default:
+      return NULL;
+  }
+}
@@ -0,0 +1,344 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mgos.h"
+#include "gps2_track.h"
+
+
+bool gps2_track_init(struct gps2_track *track, size_t bytes) {
+  int count = (int) (bytes / sizeof(struct gps2_track_block));
+
+  memset(track, 0, sizeof(struct gps2_track));
+  /* one to fill while the other still holds the points before it */
+  if (count < 2) {
+    count = 2;
+  }
+  track->blocks = malloc(count * sizeof(struct gps2_track_block));
+  if (track->blocks == NULL) {
+    return false;
+  }
+  track->block_count = count;
+  return true;
+}
+
+void gps2_track_free(struct gps2_track *track) {
+  free(track->blocks);
+  memset(track, 0, sizeof(struct gps2_track));
+}
+
+void gps2_track_clear(struct gps2_track *track) {
+  track->first = 0;
+  track->used = 0;
+  track->points = 0;
+}
+
+static inline uint64_t gps2_track_zigzag(int64_t value) {
+  return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static inline int64_t gps2_track_unzigzag(uint64_t value) {
+  return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+static size_t gps2_track_put(uint8_t *p, int64_t value) {
+  uint64_t v = gps2_track_zigzag(value);
+  size_t n = 0;
+
+  while (v >= 0x80) {
+    p[n++] = (uint8_t) v | 0x80;
+    v >>= 7;
+  }
+  p[n++] = (uint8_t) v;
+  return n;
+}
+
+static const uint8_t *gps2_track_get(const uint8_t *p, int64_t *value) {
+  uint64_t v = 0;
+  int shift = 0;
+
+  /* at most ten bytes, whatever the data */
+  while ((*p & 0x80) && shift < 63) {
+    v |= (uint64_t) (*p++ & 0x7f) << shift;
+    shift += 7;
+  }
+  v |= (uint64_t) *p++ << shift;
+  *value = gps2_track_unzigzag(v);
+  return p;
+}
+
+/* a keyframe is the point itself, and the prediction starts again from it */
+static size_t gps2_track_put_keyframe(uint8_t *p, struct gps2_track_cursor *cursor,
+                                      const struct gps2_track_point *point) {
+  size_t n = 0;
+
+  n += gps2_track_put(p + n, point->time_ms);
+  n += gps2_track_put(p + n, point->latitude_e7);
+  n += gps2_track_put(p + n, point->longitude_e7);
+  n += gps2_track_put(p + n, point->speed_e3);
+  n += gps2_track_put(p + n, point->bearing_e2);
+  cursor->point = *point;
+  cursor->step_ms = 0;
+  cursor->step_latitude = 0;
+  cursor->step_longitude = 0;
+  return n;
+}
+
+static size_t gps2_track_put_delta(uint8_t *p, struct gps2_track_cursor *cursor,
+                                   const struct gps2_track_point *point) {
+  int64_t step_ms = point->time_ms - cursor->point.time_ms;
+  int64_t step_latitude = (int64_t) point->latitude_e7 - cursor->point.latitude_e7;
+  int64_t step_longitude = (int64_t) point->longitude_e7 - cursor->point.longitude_e7;
+  size_t n = 0;
+
+  n += gps2_track_put(p + n, step_ms - cursor->step_ms);
+  n += gps2_track_put(p + n, step_latitude - cursor->step_latitude);
+  n += gps2_track_put(p + n, step_longitude - cursor->step_longitude);
+  n += gps2_track_put(p + n, (int64_t) point->speed_e3 - cursor->point.speed_e3);
+  n += gps2_track_put(p + n, (int64_t) point->bearing_e2 - cursor->point.bearing_e2);
+  cursor->point = *point;
+  cursor->step_ms = step_ms;
+  cursor->step_latitude = step_latitude;
+  cursor->step_longitude = step_longitude;
+  return n;
+}
+
+static const uint8_t *gps2_track_get_keyframe(const uint8_t *p, struct gps2_track_cursor *cursor) {
+  int64_t value;
+
+  p = gps2_track_get(p, &cursor->point.time_ms);
+  p = gps2_track_get(p, &value);
+  cursor->point.latitude_e7 = (int32_t) value;
+  p = gps2_track_get(p, &value);
+  cursor->point.longitude_e7 = (int32_t) value;
+  p = gps2_track_get(p, &value);
+  cursor->point.speed_e3 = (int32_t) value;
+  p = gps2_track_get(p, &value);
+  cursor->point.bearing_e2 = (int32_t) value;
+  cursor->step_ms = 0;
+  cursor->step_latitude = 0;
+  cursor->step_longitude = 0;
+  return p;
+}
+
+static const uint8_t *gps2_track_get_delta(const uint8_t *p, struct gps2_track_cursor *cursor) {
+  int64_t value;
+
+  p = gps2_track_get(p, &value);
+  cursor->step_ms += value;
+  cursor->point.time_ms += cursor->step_ms;
+  p = gps2_track_get(p, &value);
+  cursor->step_latitude += value;
+  cursor->point.latitude_e7 = (int32_t) (cursor->point.latitude_e7 + cursor->step_latitude);
+  p = gps2_track_get(p, &value);
+  cursor->step_longitude += value;
+  cursor->point.longitude_e7 = (int32_t) (cursor->point.longitude_e7 + cursor->step_longitude);
+  p = gps2_track_get(p, &value);
+  cursor->point.speed_e3 = (int32_t) (cursor->point.speed_e3 + value);
+  p = gps2_track_get(p, &value);
+  cursor->point.bearing_e2 = (int32_t) (cursor->point.bearing_e2 + value);
+  return p;
+}
+
+void gps2_track_point_set(struct gps2_track_point *point, const struct mgos_gps_location_fixed *location) {
+  point->time_ms = (int64_t) location->time * 1000 + location->microseconds / 1000;
+  point->latitude_e7 = location->latitude_e7;
+  point->longitude_e7 = location->longitude_e7;
+  point->speed_e3 = location->speed_e3;
+  point->bearing_e2 = location->bearing_e2;
+}
+
+bool gps2_track_block_add(struct gps2_track_block *block, struct gps2_track_cursor *cursor,
+                          const struct gps2_track_point *point) {
+  struct gps2_track_cursor next = *cursor;
+  uint8_t buf[GPS2_TRACK_MAX_POINT];
+  size_t n;
+
+  if (block->count == 0) {
+    n = gps2_track_put_keyframe(buf, &next, point);
+    block->start_ms = point->time_ms;
+  } else {
+    n = gps2_track_put_delta(buf, &next, point);
+  }
+  if (block->length + n > GPS2_TRACK_BLOCK_SIZE) {
+    return false;
+  }
+  memcpy(block->data + block->length, buf, n);
+  block->length += n;
+  block->count++;
+  *cursor = next;
+  return true;
+}
+
+const uint8_t *gps2_track_block_next(const uint8_t *p, int index, struct gps2_track_cursor *cursor) {
+  return index == 0 ? gps2_track_get_keyframe(p, cursor) : gps2_track_get_delta(p, cursor);
+}
+
+static inline struct gps2_track_block *gps2_track_block(const struct gps2_track *track, int i) {
+  return &track->blocks[(track->first + i) % track->block_count];
+}
+
+/* start a block, dropping the oldest if they are all in use */
+static struct gps2_track_block *gps2_track_new_block(struct gps2_track *track) {
+  struct gps2_track_block *block;
+
+  if (track->used == track->block_count) {
+    block = gps2_track_block(track, 0);
+    track->points -= block->count;
+    track->evicted += block->count;
+    track->first = (track->first + 1) % track->block_count;
+    track->used--;
+  }
+  block = gps2_track_block(track, track->used++);
+  block->length = 0;
+  block->count = 0;
+  return block;
+}
+
+bool gps2_track_add(struct gps2_track *track, const struct mgos_gps_location_fixed *location) {
+  struct gps2_track_point point;
+
+  gps2_track_point_set(&point, location);
+  if (track->used > 0) {
+    if (point.time_ms < track->last.point.time_ms) {
+      /* the blocks must stay in time order to be searched */
+      track->rejected++;
+      return false;
+    }
+    if (gps2_track_block_add(gps2_track_block(track, track->used - 1), &track->last, &point)) {
+      track->points++;
+      return true;
+    }
+  }
+
+  /* the first point, or the block is full. A keyframe always fits */
+  gps2_track_block_add(gps2_track_new_block(track), &track->last, &point);
+  track->points++;
+  return true;
+}
+
+size_t gps2_track_bytes(const struct gps2_track *track) {
+  return track->used * sizeof(struct gps2_track_block);
+}
+
+/* the ring's blocks, from the oldest */
+static const uint8_t *gps2_track_ring_points(const void *arg, size_t i, uint16_t *count) {
+  const struct gps2_track_block *block = gps2_track_block(arg, (int) i);
+
+  *count = block->count;
+  return block->data;
+}
+
+static int64_t gps2_track_ring_start_ms(const void *arg, size_t i) {
+  return gps2_track_block(arg, (int) i)->start_ms;
+}
+
+static void gps2_track_ring(const struct gps2_track *track, struct gps2_track_blocks *blocks) {
+  blocks->arg = track;
+  blocks->count = (size_t) track->used;
+  blocks->points = gps2_track_ring_points;
+  blocks->start_ms = gps2_track_ring_start_ms;
+}
+
+/* to the keyframe of iter->block */
+static void gps2_track_iter_load(struct gps2_track_iter *iter) {
+  iter->offset = 0;
+  iter->index = 0;
+  iter->count = 0;
+  iter->data = NULL;
+  if (iter->block < iter->blocks.count) {
+    iter->data = iter->blocks.points(iter->blocks.arg, iter->block, &iter->count);
+  }
+}
+
+void gps2_track_blocks_iter_init(const struct gps2_track_blocks *blocks, struct gps2_track_iter *iter) {
+  iter->blocks = *blocks;
+  iter->block = 0;
+  gps2_track_iter_load(iter);
+}
+
+bool gps2_track_next(struct gps2_track_iter *iter, struct gps2_track_point *point) {
+  const uint8_t *p;
+
+  if (iter->block >= iter->blocks.count) {
+    return false;
+  }
+  if (iter->index == iter->count) {
+    /* on to the next block's keyframe */
+    if (++iter->block == iter->blocks.count) {
+      return false;
+    }
+    gps2_track_iter_load(iter);
+  }
+
+  p = gps2_track_block_next(iter->data + iter->offset, iter->index, &iter->cursor);
+  iter->offset = (uint16_t) (p - iter->data);
+  iter->index++;
+  *point = iter->cursor.point;
+  return true;
+}
+
+bool gps2_track_blocks_seek(const struct gps2_track_blocks *blocks, struct gps2_track_iter *iter, int64_t time_ms) {
+  struct gps2_track_iter ahead;
+  struct gps2_track_point point;
+  size_t low = 0;
+  size_t high;
+  size_t middle;
+
+  gps2_track_blocks_iter_init(blocks, iter);
+  if (blocks->count == 0) {
+    return false;
+  }
+
+  /* the last block starting at or before time_ms */
+  high = blocks->count - 1;
+  while (low < high) {
+    middle = (low + high + 1) / 2;
+    if (blocks->start_ms(blocks->arg, middle) <= time_ms) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  iter->block = low;
+  gps2_track_iter_load(iter);
+
+  /* decode up to the point, so that gps2_track_next returns it */
+  for (;;) {
+    ahead = *iter;
+    if (!gps2_track_next(&ahead, &point)) {
+      return false;
+    }
+    if (point.time_ms >= time_ms) {
+      return true;
+    }
+    *iter = ahead;
+  }
+}
+
+void gps2_track_iter_init(const struct gps2_track *track, struct gps2_track_iter *iter) {
+  struct gps2_track_blocks blocks;
+
+  gps2_track_ring(track, &blocks);
+  gps2_track_blocks_iter_init(&blocks, iter);
+}
+
+bool gps2_track_seek(const struct gps2_track *track, struct gps2_track_iter *iter, int64_t time_ms) {
+  struct gps2_track_blocks blocks;
+
+  gps2_track_ring(track, &blocks);
+  return gps2_track_blocks_seek(&blocks, iter, time_ms);
+}
@@ -0,0 +1,254 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mgos.h"
+#include "gps2_ubx.h"
+
+
+/* NAV-PVT valid */
+#define GPS2_UBX_PVT_VALID_DATE 0x01
+#define GPS2_UBX_PVT_VALID_TIME 0x02
+#define GPS2_UBX_PVT_VALID_MAG 0x08
+
+/* NAV-PVT flags */
+#define GPS2_UBX_PVT_GNSS_FIX_OK 0x01
+#define GPS2_UBX_PVT_DIFF_SOLN 0x02
+#define GPS2_UBX_PVT_CARR_SOLN_SHIFT 6
+
+/* NAV-PVT flags3 */
+#define GPS2_UBX_PVT_INVALID_LLH 0x01
+
+/* NAV-SAT flags */
+#define GPS2_UBX_SAT_SV_USED 0x08
+
+/* CFG-PRT for a UART */
+#define GPS2_UBX_PRT_UART1 1
+#define GPS2_UBX_PRT_MODE_8N1 0x08D0
+#define GPS2_UBX_PRT_PROTO_UBX_NMEA 0x0003
+
+/* payloads are little endian */
+static uint16_t gps2_ubx_u2(const uint8_t *p) {
+  return (uint16_t) (p[0] | p[1] << 8);
+}
+
+static uint32_t gps2_ubx_u4(const uint8_t *p) {
+  return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static int32_t gps2_ubx_i4(const uint8_t *p) {
+  return (int32_t) gps2_ubx_u4(p);
+}
+
+bool gps2_ubx_check(const uint8_t *packet, size_t length) {
+  uint8_t ck_a = 0;
+  uint8_t ck_b = 0;
+  size_t i;
+
+  if (length < GPS2_UBX_OVERHEAD) {
+    return false;
+  }
+  for (i = 2; i < length - 2; i++) {
+    ck_a += packet[i];
+    ck_b += ck_a;
+  }
+  return ck_a == packet[length - 2] && ck_b == packet[length - 1];
+}
+
+static void gps2_ubx_put_u2(uint8_t *p, uint16_t value) {
+  p[0] = value & 0xff;
+  p[1] = value >> 8;
+}
+
+static void gps2_ubx_put_u4(uint8_t *p, uint32_t value) {
+  gps2_ubx_put_u2(p, value & 0xffff);
+  gps2_ubx_put_u2(p + 2, value >> 16);
+}
+
+size_t gps2_ubx_cfg_prt(uint8_t *packet, uint32_t baud_rate) {
+  uint8_t *payload = packet + GPS2_UBX_HEADER_LENGTH;
+  uint8_t ck_a = 0;
+  uint8_t ck_b = 0;
+  size_t i;
+
+  memset(packet, 0, GPS2_UBX_CFG_PRT_PACKET);
+  packet[0] = GPS2_UBX_SYNC_1;
+  packet[1] = GPS2_UBX_SYNC_2;
+  packet[2] = GPS2_UBX_CLASS_CFG;
+  packet[3] = GPS2_UBX_CFG_PRT;
+  gps2_ubx_put_u2(packet + 4, GPS2_UBX_CFG_PRT_PACKET - GPS2_UBX_OVERHEAD);
+
+  payload[0] = GPS2_UBX_PRT_UART1;
+  gps2_ubx_put_u4(payload + 4, GPS2_UBX_PRT_MODE_8N1);
+  gps2_ubx_put_u4(payload + 8, baud_rate);
+  gps2_ubx_put_u2(payload + 12, GPS2_UBX_PRT_PROTO_UBX_NMEA);
+  gps2_ubx_put_u2(payload + 14, GPS2_UBX_PRT_PROTO_UBX_NMEA);
+
+  for (i = 2; i < GPS2_UBX_CFG_PRT_PACKET - 2; i++) {
+    ck_a += packet[i];
+    ck_b += ck_a;
+  }
+  packet[GPS2_UBX_CFG_PRT_PACKET - 2] = ck_a;
+  packet[GPS2_UBX_CFG_PRT_PACKET - 1] = ck_b;
+  return GPS2_UBX_CFG_PRT_PACKET;
+}
+
+bool gps2_ubx_nav_pvt(const uint8_t *payload, size_t length, struct mgos_gps_fix *fix) {
+  uint8_t valid;
+  uint8_t fix_type;
+  uint8_t flags;
+  int32_t nano;
+  int32_t height;
+  int32_t msl;
+
+  if (length < GPS2_UBX_NAV_PVT_LENGTH) {
+    return false;
+  }
+
+  valid = payload[11];
+  fix_type = payload[20];
+  flags = payload[21];
+
+  fix->sentences = 0;
+  fix->elapsed_time = mgos_uptime_micros();
+  fix->valid = (flags & GPS2_UBX_PVT_GNSS_FIX_OK) != 0;
+
+  fix->time = 0;
+  fix->microseconds = 0;
+  if ((valid & (GPS2_UBX_PVT_VALID_DATE | GPS2_UBX_PVT_VALID_TIME)) == (GPS2_UBX_PVT_VALID_DATE | GPS2_UBX_PVT_VALID_TIME)) {
+    fix->time = (time_t) minmea_days_from_civil(gps2_ubx_u2(payload + 4), payload[6], payload[7]) * 86400
+                + payload[8] * 3600 + payload[9] * 60 + payload[10];
+    /* nano is the fraction of the second in the fields above, and can be negative */
+    nano = gps2_ubx_i4(payload + 16);
+    if (nano < 0) {
+      fix->time--;
+      nano += 1000000000;
+    }
+    fix->microseconds = nano / 1000;
+  }
+
+  if (payload[78] & GPS2_UBX_PVT_INVALID_LLH) {
+    fix->latitude_e7 = MGOS_GPS_FIXED_UNKNOWN;
+    fix->longitude_e7 = MGOS_GPS_FIXED_UNKNOWN;
+    fix->altitude_e3 = MGOS_GPS_FIXED_UNKNOWN;
+    fix->geoid_separation_e3 = MGOS_GPS_FIXED_UNKNOWN;
+  } else {
+    /* already degrees * 10^7 and millimetres */
+    fix->longitude_e7 = gps2_ubx_i4(payload + 24);
+    fix->latitude_e7 = gps2_ubx_i4(payload + 28);
+    height = gps2_ubx_i4(payload + 32);
+    msl = gps2_ubx_i4(payload + 36);
+    fix->altitude_e3 = msl;
+    fix->geoid_separation_e3 = height - msl;
+  }
+
+  /* mm/s to knots * 1000, and degrees * 10^5 to degrees * 100 */
+  fix->speed_e3 = (int32_t) (((int64_t) gps2_ubx_i4(payload + 60) * 1000000 + 257222) / 514444);
+  fix->bearing_e2 = (gps2_ubx_i4(payload + 64) + 500) / 1000;
+  if (valid & GPS2_UBX_PVT_VALID_MAG) {
+    fix->variation_e2 = (int16_t) gps2_ubx_u2(payload + 88);
+  } else {
+    fix->variation_e2 = MGOS_GPS_FIXED_UNKNOWN;
+  }
+
+  /* as GGA fix quality and GSA fix type would have it */
+  if (!fix->valid) {
+    fix->fix_quality = fix_type == 1 ? 6 : 0;
+  } else if ((flags >> GPS2_UBX_PVT_CARR_SOLN_SHIFT) == 2) {
+    fix->fix_quality = 4;
+  } else if ((flags >> GPS2_UBX_PVT_CARR_SOLN_SHIFT) == 1) {
+    fix->fix_quality = 5;
+  } else {
+    fix->fix_quality = (flags & GPS2_UBX_PVT_DIFF_SOLN) ? 2 : 1;
+  }
+  fix->fix_type = fix_type == 2 ? 2 : (fix_type == 3 || fix_type == 4) ? 3 : 1;
+  fix->satellites_used = payload[23];
+
+  fix->pdop_e2 = gps2_ubx_u2(payload + 76);
+  fix->hdop_e2 = MGOS_GPS_FIXED_UNKNOWN;
+  fix->vdop_e2 = MGOS_GPS_FIXED_UNKNOWN;
+
+  /* one horizontal estimate rather than GST's error per axis */
+  fix->latitude_error_e3 = (int32_t) gps2_ubx_u4(payload + 40);
+  fix->longitude_error_e3 = fix->latitude_error_e3;
+  fix->altitude_error_e3 = (int32_t) gps2_ubx_u4(payload + 44);
+
+  return true;
+}
+
+/* the NMEA talker and PRN for a UBX gnssId and svId, as u-blox NMEA output numbers them */
+static bool gps2_ubx_nmea_satellite(uint8_t gnss_id, uint8_t sv_id, const char **talker, int *prn) {
+  switch (gnss_id) {
+    case 0: *talker = "GP"; *prn = sv_id; return true; /* GPS */
+    case 1: *talker = "GP"; *prn = sv_id - 87; return true; /* SBAS 120-158 as 33-64 */
+    case 2: *talker = "GA"; *prn = sv_id; return true; /* Galileo */
+    case 3: *talker = "GB"; *prn = sv_id; return true; /* BeiDou */
+    case 5: *talker = "GQ"; *prn = sv_id; return true; /* QZSS */
+    case 6: *talker = "GL"; *prn = sv_id + 64; return true; /* GLONASS */
+    default: return false;
+  }
+}
+
+uint32_t gps2_ubx_nav_sat(const uint8_t *payload, size_t length, struct gps2_sky *sky) {
+  struct mgos_gps_sky_view *view;
+  struct mgos_gps_satellite *sat;
+  const uint8_t *p;
+  const char *talker;
+  uint32_t replaced = 0;
+  int count;
+  int index;
+  int prn;
+  int azimuth;
+  int i;
+
+  if (length < 8) {
+    return 0;
+  }
+  count = payload[5];
+  if (8 + (size_t) count * 12 > length) {
+    count = (length - 8) / 12;
+  }
+
+  for (i = 0; i < count; i++) {
+    p = payload + 8 + i * 12;
+    if (!gps2_ubx_nmea_satellite(p[0], p[1], &talker, &prn) || prn <= 0 || prn > 255) {
+      continue;
+    }
+    view = gps2_sky_complete_view(sky, talker, &index);
+    if (view == NULL) {
+      continue;
+    }
+    if (!(replaced & (1u << index))) {
+      /* first satellite of this constellation in the packet */
+      view->count = 0;
+      view->used_count = 0;
+      replaced |= 1u << index;
+    }
+    if (view->count == MGOS_GPS_SKY_MAX_SATELLITES) {
+      continue;
+    }
+
+    azimuth = (int16_t) gps2_ubx_u2(p + 4);
+    sat = &view->satellites[view->count++];
+    sat->prn = prn;
+    sat->snr = p[2];
+    sat->elevation = (int8_t) p[3];
+    sat->azimuth = azimuth > 0 ? azimuth : 0;
+    sat->used = (gps2_ubx_u4(p + 8) & GPS2_UBX_SAT_SV_USED) != 0;
+    view->used_count += sat->used;
+  }
+  return replaced;
+}
@@ -13,6 +13,7 @@
  #include <string.h>
  #include <ctype.h>
  #include <stdarg.h>
+ #include <limits.h>
  #include <time.h>
  
  #define boolstr(s) ((s) ? "true" : "false")
@@ -28,27 +29,267 @@
      return -1;
  }
  
+ // Printable is ' ' to '~', which is what isprint() gives in the "C" locale
+ // without the table lookup.
+ static inline bool minmea_isprint(char c) {
+     return (unsigned char) (c - ' ') <= '~' - ' ';
+ }
+ 
+ static inline bool minmea_isfield(char c) {
+     return minmea_isprint(c) && c != ',' && c != '*';
+ }
+ 
+ /*
+  * Block kernels. Each step classifies 32 bytes into one bitmap word per
+  * class, bit n for byte n, and XORs them into a running checksum. x86 hosts
+  * use AVX2 or SSE2 when the compiler targets them, everything else uses
+  * 32-bit SWAR so the MCU builds get four bytes per operation.
+  */
+ #if defined(__AVX2__) || defined(__SSE2__)
+ #include <immintrin.h>
+ #endif
+ 
+ struct minmea_block {
+     uint32_t commas;
+     uint32_t asterisks;
+     uint32_t unprintable;
+ };
+ 
+ #if defined(__AVX2__)
+ 
+ typedef __m256i minmea_xor_t;
+ 
+ static inline minmea_xor_t minmea_xor_init(void)
+ {
+     return _mm256_setzero_si256();
+ }
+ 
+ static inline void minmea_block32(const char *data, struct minmea_block *block, minmea_xor_t *x, bool delimiters)
+ {
+     __m256i v = _mm256_loadu_si256((const __m256i *) data);
+     // Printable as a signed compare: shift ' '..'~' down to -128..-34.
+     __m256i shifted = _mm256_xor_si256(_mm256_sub_epi8(v, _mm256_set1_epi8(' ')), _mm256_set1_epi8((char) 0x80));
+ 
+     if (delimiters) {
+         block->commas = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')));
+         block->asterisks = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('*')));
+     }
+     block->unprintable = (uint32_t) _mm256_movemask_epi8(_mm256_cmpgt_epi8(shifted, _mm256_set1_epi8('~' - ' ' - 128)));
+     *x = _mm256_xor_si256(*x, v);
+ }
+ 
+ static inline uint8_t minmea_xor_fold(minmea_xor_t x)
+ {
+     __m128i v = _mm_xor_si128(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+     v = _mm_xor_si128(v, _mm_srli_si128(v, 8));
+     v = _mm_xor_si128(v, _mm_srli_si128(v, 4));
+     v = _mm_xor_si128(v, _mm_srli_si128(v, 2));
+     v = _mm_xor_si128(v, _mm_srli_si128(v, 1));
+     return (uint8_t) _mm_cvtsi128_si32(v);
+ }
+ 
+ #elif defined(__SSE2__)
+ 
+ typedef __m128i minmea_xor_t;
+ 
+ static inline minmea_xor_t minmea_xor_init(void)
+ {
+     return _mm_setzero_si128();
+ }
+ 
+ static inline void minmea_block16(__m128i v, uint32_t *commas, uint32_t *asterisks, uint32_t *unprintable, bool delimiters)
+ {
+     // Printable as a signed compare: shift ' '..'~' down to -128..-34.
+     __m128i shifted = _mm_xor_si128(_mm_sub_epi8(v, _mm_set1_epi8(' ')), _mm_set1_epi8((char) 0x80));
+ 
+     if (delimiters) {
+         *commas = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+         *asterisks = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('*')));
+     }
+     *unprintable = (uint32_t) _mm_movemask_epi8(_mm_cmpgt_epi8(shifted, _mm_set1_epi8('~' - ' ' - 128)));
+ }
+ 
+ static inline void minmea_block32(const char *data, struct minmea_block *block, minmea_xor_t *x, bool delimiters)
+ {
+     __m128i lo = _mm_loadu_si128((const __m128i *) data);
+     __m128i hi = _mm_loadu_si128((const __m128i *) (data + 16));
+     uint32_t commas = 0, asterisks = 0, unprintable;
+ 
+     minmea_block16(lo, &block->commas, &block->asterisks, &block->unprintable, delimiters);
+     minmea_block16(hi, &commas, &asterisks, &unprintable, delimiters);
+     block->commas |= commas << 16;
+     block->asterisks |= asterisks << 16;
+     block->unprintable |= unprintable << 16;
+     *x = _mm_xor_si128(*x, _mm_xor_si128(lo, hi));
+ }
+ 
+ static inline uint8_t minmea_xor_fold(minmea_xor_t v)
+ {
+     v = _mm_xor_si128(v, _mm_srli_si128(v, 8));
+     v = _mm_xor_si128(v, _mm_srli_si128(v, 4));
+     v = _mm_xor_si128(v, _mm_srli_si128(v, 2));
+     v = _mm_xor_si128(v, _mm_srli_si128(v, 1));
+     return (uint8_t) _mm_cvtsi128_si32(v);
+ }
+ 
+ #else
+ 
+ typedef uint32_t minmea_xor_t;
+ 
+ static inline minmea_xor_t minmea_xor_init(void)
+ {
+     return 0;
+ }
+ 
+ // High bit of each byte which is zero. Exact, unlike the usual haszero() trick.
+ static inline uint32_t minmea_swar_zero(uint32_t v)
+ {
+     return ~(((v & 0x7F7F7F7FU) + 0x7F7F7F7FU) | v) & 0x80808080U;
+ }
+ 
+ // Gather the four high bits into the low nibble, byte 0 in bit 0.
+ static inline uint32_t minmea_swar_bits(uint32_t high_bits)
+ {
+     return (((high_bits >> 7) * 0x01020408U) >> 24) & 0xF;
+ }
+ 
+ static inline void minmea_block32(const char *data, struct minmea_block *block, minmea_xor_t *x, bool delimiters)
+ {
+     const unsigned char *p = (const unsigned char *) data;
+ 
+     block->commas = block->asterisks = block->unprintable = 0;
+     for (int i = 0; i < 32; i += 4) {
+         // Assembled byte by byte so byte 0 is always the low byte.
+         uint32_t v = p[i] | (uint32_t) p[i+1] << 8 | (uint32_t) p[i+2] << 16 | (uint32_t) p[i+3] << 24;
+         uint32_t low = v & 0x7F7F7F7FU;
+         // Below ' ' (no borrow between bytes as each starts at 0x80 or more), DEL or high bit set.
+         uint32_t unprintable = (~((low | 0x80808080U) - 0x20202020U) | (low + 0x01010101U) | v) & 0x80808080U;
+ 
+         if (delimiters) {
+             block->commas |= minmea_swar_bits(minmea_swar_zero(v ^ 0x2C2C2C2CU)) << i;
+             block->asterisks |= minmea_swar_bits(minmea_swar_zero(v ^ 0x2A2A2A2AU)) << i;
+         }
+         block->unprintable |= minmea_swar_bits(unprintable) << i;
+         *x ^= v;
+     }
+ }
+ 
+ static inline uint8_t minmea_xor_fold(minmea_xor_t v)
+ {
+     v ^= v >> 16;
+     v ^= v >> 8;
+     return (uint8_t) v;
+ }
+ 
+ #endif
+ 
+ static inline size_t minmea_printable_length_tail(const char *data, size_t length)
+ {
+     size_t i = 0;
+     while (i < length && minmea_isprint(data[i]))
+         i++;
+     return i;
+ }
+ 
+ // Classify up to 32 bytes. Bytes past length are left out of the bitmaps and the XOR.
+ static inline void minmea_block_tail(const char *data, size_t length, struct minmea_block *block, uint8_t *checksum)
+ {
+     block->commas = block->asterisks = block->unprintable = 0;
+     for (size_t i = 0; i < length; i++) {
+         block->commas |= (uint32_t) (data[i] == ',') << i;
+         block->asterisks |= (uint32_t) (data[i] == '*') << i;
+         block->unprintable |= (uint32_t) !minmea_isprint(data[i]) << i;
+         *checksum ^= data[i];
+     }
+ }
+ 
+ uint8_t minmea_xor(const char *data, size_t length)
+ {
+     minmea_xor_t x = minmea_xor_init();
+     struct minmea_block block;
+     uint8_t checksum = 0x00;
+ 
+     for (; length >= 32; data += 32, length -= 32)
+         minmea_block32(data, &block, &x, false);
+     minmea_block_tail(data, length, &block, &checksum);
+ 
+     return checksum ^ minmea_xor_fold(x);
+ }
+ 
+ // Length of the printable run at the start of data, and the XOR of that run.
+ static size_t minmea_xor_printable(const char *data, size_t length, uint8_t *checksum)
+ {
+     minmea_xor_t x = minmea_xor_init();
+     struct minmea_block block;
+     size_t offset = 0;
+     size_t stop;
+ 
+     *checksum = 0x00;
+     for (; length - offset >= 32; offset += 32) {
+         minmea_xor_t before = x;
+         minmea_block32(data + offset, &block, &x, false);
+         if (block.unprintable) {
+             // XOR the printable part of this block a byte at a time.
+             stop = offset + __builtin_ctz(block.unprintable);
+             for (; offset < stop; offset++)
+                 *checksum ^= data[offset];
+             *checksum ^= minmea_xor_fold(before);
+             return stop;
+         }
+     }
+ 
+     stop = minmea_printable_length_tail(data + offset, length - offset);
+     for (size_t i = 0; i < stop; i++)
+         *checksum ^= data[offset + i];
+     *checksum ^= minmea_xor_fold(x);
+     return offset + stop;
+ }
+ 
+ size_t minmea_printable_length(const char *data, size_t length)
+ {
+     uint8_t checksum;
+     return minmea_xor_printable(data, length, &checksum);
+ }
+ 
+ void minmea_delimiters(const char *data, size_t length, uint32_t *commas, uint32_t *asterisks, uint32_t *unprintable)
+ {
+     minmea_xor_t x = minmea_xor_init();
+     struct minmea_block block;
+     uint8_t checksum = 0x00;
+ 
+     for (; length > 0; data += 32, length -= (length < 32 ? length : 32)) {
+         if (length >= 32)
+             minmea_block32(data, &block, &x, true);
+         else
+             minmea_block_tail(data, length, &block, &checksum);
+         *commas++ = block.commas;
+         *asterisks++ = block.asterisks;
+         *unprintable++ = block.unprintable;
+     }
+ }
+ 
  uint8_t minmea_checksum(const char *sentence)
  {
      // Support senteces with or without the starting dollar sign.
      if (*sentence == '$')
          sentence++;
  
-     uint8_t checksum = 0x00;
- 
      // The optional checksum is an XOR of all bytes between "$" and "*".
-     while (*sentence && *sentence != '*')
-         checksum ^= *sentence++;
+     size_t length = strlen(sentence);
+     const char *asterisk = memchr(sentence, '*', length);
+     if (asterisk)
+         length = asterisk - sentence;
  
-     return checksum;
+     return minmea_xor(sentence, length);
  }
  
  bool minmea_check(const char *sentence, bool strict)
  {
      uint8_t checksum = 0x00;
+     size_t length = strlen(sentence);
  
      // Sequence length is limited.
-     if (strlen(sentence) > MINMEA_MAX_LENGTH + 3){       
+     if (length > MINMEA_MAX_LENGTH + 3){       
         return false;
      }
  
@@ -56,10 +297,14 @@
      if (*sentence++ != '$'){             
         return false;
      }
+     length--;
  
-     // The optional checksum is an XOR of all bytes between "$" and "*".
-     while (*sentence && *sentence != '*' && isprint((unsigned char) *sentence))
-         checksum ^= *sentence++;
+     // The optional checksum is an XOR of all bytes between "$" and "*",
+     // stopping early at anything unprintable.
+     const char *asterisk = memchr(sentence, '*', length);
+     if (asterisk)
+         length = asterisk - sentence;
+     sentence += minmea_xor_printable(sentence, length, &checksum);
  
      // If checksum is present...
      if (*sentence == '*') {
@@ -89,8 +334,25 @@
      return true;
  }
  
- static inline bool minmea_isfield(char c) {
-     return isprint((unsigned char) c) && c != ',' && c != '*';
+ // minmea_scan() maps field boundaries for this much of the sentence up front.
+ #define MINMEA_SCAN_WINDOW 128
+ 
+ // End of the field at p: the next ',', '*' or unprintable byte.
+ static const char *minmea_field_end(const char *p, const char *start, const uint32_t *stops, size_t mapped)
+ {
+     size_t from = p - start;
+ 
+     for (size_t pos = from; pos < mapped; pos = (pos / 32 + 1) * 32) {
+         uint32_t word = stops[pos / 32] >> (pos % 32);
+         if (word)
+             return start + pos + __builtin_ctz(word);
+     }
+ 
+     // Past the mapped window.
+     p = start + (from < mapped ? mapped : from);
+     while (minmea_isfield(*p))
+         p++;
+     return p;
  }
  
  bool minmea_scan(const char *sentence, const char *format, ...)
@@ -100,12 +362,21 @@
      va_list ap;
      va_start(ap, format);
  
+     // Bitmap of the bytes which end a field, including the terminating NUL.
+     const char *start = sentence;
+     uint32_t commas[MINMEA_SCAN_WINDOW / 32];
+     uint32_t asterisks[MINMEA_SCAN_WINDOW / 32];
+     uint32_t stops[MINMEA_SCAN_WINDOW / 32];
+     size_t mapped = strnlen(sentence, MINMEA_SCAN_WINDOW - 1) + 1;
+     minmea_delimiters(sentence, mapped, commas, asterisks, stops);
+     for (size_t w = 0; w < (mapped + 31) / 32; w++)
+         stops[w] |= commas[w] | asterisks[w];
+ 
      const char *field = sentence;
  #define next_field() \
      do { \
          /* Progress to the next field. */ \
-         while (minmea_isfield(*sentence)) \
-             sentence++; \
+         sentence = minmea_field_end(sentence, start, stops, mapped); \
          /* Make sure there is a field there. */ \
          if (*sentence == ',') { \
              sentence++; \
@@ -374,69 +645,370 @@
      return true;
  }
  
+ /*
+  * Sentence types are looked up by their three letter code packed into an
+  * integer. The table is open addressed with a multiplicative hash, which
+  * places the built-in types in distinct slots, so a lookup is one multiply
+  * and one compare. Types added with minmea_register_sentence() go into the
+  * following free slot.
+  */
+ #define MINMEA_TYPE_SLOTS 32
+ #define MINMEA_TYPE_MAX_REGISTERED 24
+ 
+ struct minmea_type_slot {
+     uint32_t code; // zero for an empty slot
+     enum minmea_sentence_id id;
+ };
+ 
+ static inline unsigned minmea_type_hash(uint32_t code)
+ {
+     return (uint32_t) (code * 0x9E3779B1u) >> 27;
+ }
+ 
+ static struct minmea_type_slot minmea_types[MINMEA_TYPE_SLOTS] = {
+     [ 2] = { MINMEA_TYPE_CODE('R','M','C'), MINMEA_SENTENCE_RMC },
+     [ 6] = { MINMEA_TYPE_CODE('G','L','L'), MINMEA_SENTENCE_GLL },
+     [ 9] = { MINMEA_TYPE_CODE('G','G','A'), MINMEA_SENTENCE_GGA },
+     [20] = { MINMEA_TYPE_CODE('G','S','T'), MINMEA_SENTENCE_GST },
+     [22] = { MINMEA_TYPE_CODE('Z','D','A'), MINMEA_SENTENCE_ZDA },
+     [28] = { MINMEA_TYPE_CODE('G','S','V'), MINMEA_SENTENCE_GSV },
+     [29] = { MINMEA_TYPE_CODE('G','S','A'), MINMEA_SENTENCE_GSA },
+     [30] = { MINMEA_TYPE_CODE('V','T','G'), MINMEA_SENTENCE_VTG },
+ };
+ static int minmea_types_count = 8;
+ 
+ static inline uint32_t minmea_type_code(const char *type)
+ {
+     return MINMEA_TYPE_CODE(type[0], type[1], type[2]);
+ }
+ 
+ static enum minmea_sentence_id minmea_lookup_type(uint32_t code)
+ {
+     unsigned slot = minmea_type_hash(code);
+ 
+     // The table is never full, so we always reach an empty slot.
+     while (minmea_types[slot].code) {
+         if (minmea_types[slot].code == code)
+             return minmea_types[slot].id;
+         slot = (slot + 1) % MINMEA_TYPE_SLOTS;
+     }
+     return MINMEA_UNKNOWN;
+ }
+ 
+ bool minmea_register_sentence(const char *type, enum minmea_sentence_id id)
+ {
+     if (strlen(type) != 3 || id < MINMEA_SENTENCE_USER || id > MINMEA_SENTENCE_LAST)
+         return false;
+ 
+     uint32_t code = minmea_type_code(type);
+     unsigned slot = minmea_type_hash(code);
+ 
+     while (minmea_types[slot].code) {
+         if (minmea_types[slot].code == code)
+             return minmea_types[slot].id == id;
+         slot = (slot + 1) % MINMEA_TYPE_SLOTS;
+     }
+     if (minmea_types_count >= MINMEA_TYPE_MAX_REGISTERED)
+         return false;
+ 
+     minmea_types[slot].code = code;
+     minmea_types[slot].id = id;
+     minmea_types_count++;
+     return true;
+ }
+ 
+ enum minmea_sentence_id minmea_peek_sentence_id(const char *sentence)
+ {
+     // A valid sentence starts with "$".
+     if (sentence[0] != '$')
+         return MINMEA_INVALID;
+ 
+     // Proprietary sentences have a free length type.
+     if (sentence[1] == 'P')
+         return MINMEA_SENTENCE_PROPRIETARY;
+ 
+     // Two letter talker and three letter type.
+     for (int f=0; f<5; f++)
+         if (!minmea_isfield(sentence[1+f]))
+             return MINMEA_INVALID;
+ 
+     return minmea_lookup_type(minmea_type_code(sentence+3));
+ }
+ 
  enum minmea_sentence_id minmea_sentence_id(const char *sentence, bool strict)
  {
      if (!minmea_check(sentence, strict)){
         LOG(LL_DEBUG,("minmea_check1 error"));
-        //printf("minmea_check1 error");
         return MINMEA_INVALID;
      }
-     
 
-     char type[8];
-   
-
-     if (!minmea_scan(sentence, "t", type)){
-        LOG(LL_DEBUG,("minmea_check2 error"));
-        //printf("minmea_check2 error");
-        return MINMEA_INVALID;
+     return minmea_peek_sentence_id(sentence);
+ }
+ 
+ /*
+  * Specialised parsers. Each sentence type has its field layout written out as
+  * straight-line calls to the field readers below, instead of a format string
+  * interpreted by minmea_scan(). The readers follow the same rules as the
+  * minmea_scan() formats. The cursor folds every byte it passes into the
+  * checksum, so minmea_parse() can validate, identify and parse a sentence in a
+  * single read of the line.
+  */
+ struct minmea_cursor {
+     const char *p;
+     uint8_t checksum;
+     bool field; // false once we have run out of fields, like field == NULL in minmea_scan()
+ };
+ 
+ static inline char minmea_cursor_take(struct minmea_cursor *cursor)
+ {
+     char c = *cursor->p++;
+     cursor->checksum ^= c;
+     return c;
+ }
+ 
+ static inline bool minmea_cursor_isfield(const struct minmea_cursor *cursor)
+ {
+     return cursor->field && minmea_isfield(*cursor->p);
+ }
+ 
+ static inline void minmea_cursor_next(struct minmea_cursor *cursor)
+ {
+     // Progress to the next field.
+     while (minmea_isfield(*cursor->p))
+         minmea_cursor_take(cursor);
+     // Make sure there is a field there.
+     if (*cursor->p == ',') {
+         minmea_cursor_take(cursor);
+         cursor->field = true;
+     } else {
+         cursor->field = false;
      }
-
-     if (!strcmp(type+2, "RMC"))
-         return MINMEA_SENTENCE_RMC;
-     if (!strcmp(type+2, "GGA"))
-         return MINMEA_SENTENCE_GGA;
-     if (!strcmp(type+2, "GSA"))
-         return MINMEA_SENTENCE_GSA;
-     if (!strcmp(type+2, "GLL"))
-         return MINMEA_SENTENCE_GLL;
-     if (!strcmp(type+2, "GST"))
-         return MINMEA_SENTENCE_GST;
-     if (!strcmp(type+2, "GSV"))
-         return MINMEA_SENTENCE_GSV;
-     if (!strcmp(type+2, "VTG"))
-         return MINMEA_SENTENCE_VTG;
-     if (!strcmp(type+2, "ZDA"))
-         return MINMEA_SENTENCE_ZDA;
-     if (type[1]== 'P') {
-        return MINMEA_SENTENCE_PROPRIETARY;
+ }
+ 
+ static bool minmea_read_char(struct minmea_cursor *cursor, char *value)
+ {
+     *value = minmea_cursor_isfield(cursor) ? *cursor->p : '\0';
+     return true;
+ }
+ 
+ static bool minmea_read_direction(struct minmea_cursor *cursor, int *value)
+ {
+     *value = 0;
+     if (!minmea_cursor_isfield(cursor))
+         return true;
+ 
+     switch (*cursor->p) {
+         case 'N':
+         case 'E':
+             *value = 1;
+             return true;
+         case 'S':
+         case 'W':
+             *value = -1;
+             return true;
+         default:
+             return false;
      }
-
+ }
  
-     return MINMEA_UNKNOWN;
+ static inline bool minmea_isdigit(char c)
+ {
+     return (unsigned char) (c - '0') <= 9;
  }
  
- bool minmea_parse_rmc(struct minmea_sentence_rmc *frame, const char *sentence)
+ static bool minmea_read_float(struct minmea_cursor *cursor, struct minmea_float *f)
+ {
+     int sign = 0;
+     int_least32_t value = -1;
+     int_least32_t scale = 0;
+ 
+     if (cursor->field) {
+         for (;;) {
+             char c = *cursor->p;
+             if (minmea_isdigit(c)) {
+                 int digit = c - '0';
+                 if (value == -1)
+                     value = 0;
+                 if (value >= INT_LEAST32_MAX / 10 &&
+                     (value > INT_LEAST32_MAX / 10 || digit > INT_LEAST32_MAX % 10)) {
+                     /* we ran out of bits, what do we do? */
+                     if (scale) {
+                         /* truncate extra precision */
+                         break;
+                     } else {
+                         /* integer overflow. bail out. */
+                         return false;
+                     }
+                 }
+                 value = (10 * value) + digit;
+                 if (scale)
+                     scale *= 10;
+             } else if (!minmea_isfield(c)) {
+                 break;
+             } else if (c == '.' && scale == 0) {
+                 scale = 1;
+             } else if (c == '+' && !sign && value == -1) {
+                 sign = 1;
+             } else if (c == '-' && !sign && value == -1) {
+                 sign = -1;
+             } else if (c == ' ') {
+                 /* Allow spaces at the start of the field. */
+                 if (sign != 0 || value != -1 || scale != 0)
+                     return false;
+             } else {
+                 return false;
+             }
+             minmea_cursor_take(cursor);
+         }
+     }
+ 
+     if ((sign || scale) && value == -1)
+         return false;
+ 
+     if (value == -1) {
+         /* No digits were scanned. */
+         value = 0;
+         scale = 0;
+     } else if (scale == 0) {
+         /* No decimal point. */
+         scale = 1;
+     }
+     if (sign)
+         value *= sign;
+ 
+     f->value = value;
+     f->scale = scale;
+     return true;
+ }
+ 
+ static bool minmea_read_int(struct minmea_cursor *cursor, int *value)
+ {
+     // Same rules as strtol(), which can skip past the end of the field, so this
+     // only looks ahead and leaves minmea_cursor_next() to consume the field.
+     const char *p = cursor->p;
+     bool negative = false;
+     unsigned long result = 0;
+     unsigned long limit;
+ 
+     *value = 0;
+     if (!cursor->field)
+         return true;
+ 
+     // isspace() in the "C" locale.
+     while (*p == ' ' || (*p >= '\t' && *p <= '\r'))
+         p++;
+     if (*p == '+' || *p == '-')
+         negative = (*p++ == '-');
+     if (!minmea_isdigit(*p)) {
+         // No number, so strtol() leaves endptr at the start of the field.
+         return !minmea_isfield(*cursor->p);
+     }
+ 
+     // Saturate like strtol() does.
+     limit = negative ? (unsigned long) LONG_MAX + 1 : (unsigned long) LONG_MAX;
+     while (minmea_isdigit(*p)) {
+         unsigned digit = *p++ - '0';
+         result = (result > (limit - digit) / 10) ? limit : 10 * result + digit;
+     }
+     if (minmea_isfield(*p))
+         return false;
+ 
+     *value = (int) (negative ? -result : result);
+     return true;
+ }
+ 
+ static inline bool minmea_isdigits(const char *p, int count)
+ {
+     for (int f=0; f<count; f++)
+         if (!minmea_isdigit(p[f]))
+             return false;
+     return true;
+ }
+ 
+ static inline int minmea_take_2digits(struct minmea_cursor *cursor)
+ {
+     int tens = minmea_cursor_take(cursor) - '0';
+     return 10 * tens + (minmea_cursor_take(cursor) - '0');
+ }
+ 
+ static bool minmea_read_date(struct minmea_cursor *cursor, struct minmea_date *date)
+ {
+     date->day = date->month = date->year = -1;
+     if (!minmea_cursor_isfield(cursor))
+         return true;
+ 
+     // Always six digits.
+     if (!minmea_isdigits(cursor->p, 6))
+         return false;
+     date->day = minmea_take_2digits(cursor);
+     date->month = minmea_take_2digits(cursor);
+     date->year = minmea_take_2digits(cursor);
+     return true;
+ }
+ 
+ static bool minmea_read_time(struct minmea_cursor *cursor, struct minmea_time *time_)
+ {
+     time_->hours = time_->minutes = time_->seconds = time_->microseconds = -1;
+     if (!minmea_cursor_isfield(cursor))
+         return true;
+ 
+     // Minimum required: integer time.
+     if (!minmea_isdigits(cursor->p, 6))
+         return false;
+     time_->hours = minmea_take_2digits(cursor);
+     time_->minutes = minmea_take_2digits(cursor);
+     time_->seconds = minmea_take_2digits(cursor);
+ 
+     // Extra: fractional time. Saved as microseconds.
+     time_->microseconds = 0;
+     if (*cursor->p == '.') {
+         uint32_t value = 0;
+         uint32_t scale = 1000000LU;
+         minmea_cursor_take(cursor);
+         while (minmea_isdigit(*cursor->p) && scale > 1) {
+             value = (value * 10) + (minmea_cursor_take(cursor) - '0');
+             scale /= 10;
+         }
+         time_->microseconds = value * scale;
+     }
+     return true;
+ }
+ 
+ // Required field: fail if we ran out of input, otherwise read it and move on.
+ #define minmea_field(reader) \
+     do { \
+         if (!cursor->field || !(reader)) \
+             return false; \
+         minmea_cursor_next(cursor); \
+     } while (0)
+ 
+ // Optional field: missing fields get the reader's default.
+ #define minmea_optional_field(reader) \
+     do { \
+         if (!(reader)) \
+             return false; \
+         minmea_cursor_next(cursor); \
+     } while (0)
+ 
+ static bool minmea_read_rmc(struct minmea_cursor *cursor, struct minmea_sentence_rmc *frame)
  {
      // $GPRMC,081836,A,3751.65,S,14507.36,E,000.0,360.0,130998,011.3,E*62
-     char type[6];
      char validity;
      int latitude_direction;
      int longitude_direction;
      int variation_direction;
-     if (!minmea_scan(sentence, "tTcfdfdffDfd",
-             type,
-             &frame->time,
-             &validity,
-             &frame->latitude, &latitude_direction,
-             &frame->longitude, &longitude_direction,
-             &frame->speed,
-             &frame->course,
-             &frame->date,
-             &frame->variation, &variation_direction))
-         return false;
-     if (strcmp(type+2, "RMC"))
-         return false;
+ 
+     minmea_field(minmea_read_time(cursor, &frame->time));
+     minmea_field(minmea_read_char(cursor, &validity));
+     minmea_field(minmea_read_float(cursor, &frame->latitude));
+     minmea_field(minmea_read_direction(cursor, &latitude_direction));
+     minmea_field(minmea_read_float(cursor, &frame->longitude));
+     minmea_field(minmea_read_direction(cursor, &longitude_direction));
+     minmea_field(minmea_read_float(cursor, &frame->speed));
+     minmea_field(minmea_read_float(cursor, &frame->course));
+     minmea_field(minmea_read_date(cursor, &frame->date));
+     minmea_field(minmea_read_float(cursor, &frame->variation));
+     minmea_field(minmea_read_direction(cursor, &variation_direction));
  
      frame->valid = (validity == 'A');
      frame->latitude.value *= latitude_direction;
@@ -446,27 +1018,26 @@
      return true;
  }
  
- bool minmea_parse_gga(struct minmea_sentence_gga *frame, const char *sentence)
+ static bool minmea_read_gga(struct minmea_cursor *cursor, struct minmea_sentence_gga *frame)
  {
      // $GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47
-     char type[6];
      int latitude_direction;
      int longitude_direction;
  
-     if (!minmea_scan(sentence, "tTfdfdiiffcfci_",
-             type,
-             &frame->time,
-             &frame->latitude, &latitude_direction,
-             &frame->longitude, &longitude_direction,
-             &frame->fix_quality,
-             &frame->satellites_tracked,
-             &frame->hdop,
-             &frame->altitude, &frame->altitude_units,
-             &frame->height, &frame->height_units,
-             &frame->dgps_age))
-         return false;
-     if (strcmp(type+2, "GGA"))
-         return false;
+     minmea_field(minmea_read_time(cursor, &frame->time));
+     minmea_field(minmea_read_float(cursor, &frame->latitude));
+     minmea_field(minmea_read_direction(cursor, &latitude_direction));
+     minmea_field(minmea_read_float(cursor, &frame->longitude));
+     minmea_field(minmea_read_direction(cursor, &longitude_direction));
+     minmea_field(minmea_read_int(cursor, &frame->fix_quality));
+     minmea_field(minmea_read_int(cursor, &frame->satellites_tracked));
+     minmea_field(minmea_read_float(cursor, &frame->hdop));
+     minmea_field(minmea_read_float(cursor, &frame->altitude));
+     minmea_field(minmea_read_char(cursor, &frame->altitude_units));
+     minmea_field(minmea_read_float(cursor, &frame->height));
+     minmea_field(minmea_read_char(cursor, &frame->height_units));
+     minmea_field(minmea_read_int(cursor, &frame->dgps_age));
+     minmea_field(true);
  
      frame->latitude.value *= latitude_direction;
      frame->longitude.value *= longitude_direction;
@@ -474,54 +1045,33 @@
      return true;
  }
  
- bool minmea_parse_gsa(struct minmea_sentence_gsa *frame, const char *sentence)
+ static bool minmea_read_gsa(struct minmea_cursor *cursor, struct minmea_sentence_gsa *frame)
  {
      // $GPGSA,A,3,04,05,,09,12,,,24,,,,,2.5,1.3,2.1*39
-     char type[6];
- 
-     if (!minmea_scan(sentence, "tciiiiiiiiiiiiifff",
-             type,
-             &frame->mode,
-             &frame->fix_type,
-             &frame->sats[0],
-             &frame->sats[1],
-             &frame->sats[2],
-             &frame->sats[3],
-             &frame->sats[4],
-             &frame->sats[5],
-             &frame->sats[6],
-             &frame->sats[7],
-             &frame->sats[8],
-             &frame->sats[9],
-             &frame->sats[10],
-             &frame->sats[11],
-             &frame->pdop,
-             &frame->hdop,
-             &frame->vdop))
-         return false;
-     if (strcmp(type+2, "GSA"))
-         return false;
+     minmea_field(minmea_read_char(cursor, &frame->mode));
+     minmea_field(minmea_read_int(cursor, &frame->fix_type));
+     for (int i=0; i<12; i++)
+         minmea_field(minmea_read_int(cursor, &frame->sats[i]));
+     minmea_field(minmea_read_float(cursor, &frame->pdop));
+     minmea_field(minmea_read_float(cursor, &frame->hdop));
+     minmea_field(minmea_read_float(cursor, &frame->vdop));
  
      return true;
  }
  
- bool minmea_parse_gll(struct minmea_sentence_gll *frame, const char *sentence)
+ static bool minmea_read_gll(struct minmea_cursor *cursor, struct minmea_sentence_gll *frame)
  {
-     // $GPGLL,3723.2475,N,12158.3416,W,161229.487,A,A*41$;
-     char type[6];
+     // $GPGLL,3723.2475,N,12158.3416,W,161229.487,A,A*41
      int latitude_direction;
      int longitude_direction;
  
-     if (!minmea_scan(sentence, "tfdfdTc;c",
-             type,
-             &frame->latitude, &latitude_direction,
-             &frame->longitude, &longitude_direction,
-             &frame->time,
-             &frame->status,
-             &frame->mode))
-         return false;
-     if (strcmp(type+2, "GLL"))
-         return false;
+     minmea_field(minmea_read_float(cursor, &frame->latitude));
+     minmea_field(minmea_read_direction(cursor, &latitude_direction));
+     minmea_field(minmea_read_float(cursor, &frame->longitude));
+     minmea_field(minmea_read_direction(cursor, &longitude_direction));
+     minmea_field(minmea_read_time(cursor, &frame->time));
+     minmea_field(minmea_read_char(cursor, &frame->status));
+     minmea_optional_field(minmea_read_char(cursor, &frame->mode));
  
      frame->latitude.value *= latitude_direction;
      frame->longitude.value *= longitude_direction;
@@ -529,90 +1079,54 @@
      return true;
  }
  
- bool minmea_parse_gst(struct minmea_sentence_gst *frame, const char *sentence)
+ static bool minmea_read_gst(struct minmea_cursor *cursor, struct minmea_sentence_gst *frame)
  {
      // $GPGST,024603.00,3.2,6.6,4.7,47.3,5.8,5.6,22.0*58
-     char type[6];
- 
-     if (!minmea_scan(sentence, "tTfffffff",
-             type,
-             &frame->time,
-             &frame->rms_deviation,
-             &frame->semi_major_deviation,
-             &frame->semi_minor_deviation,
-             &frame->semi_major_orientation,
-             &frame->latitude_error_deviation,
-             &frame->longitude_error_deviation,
-             &frame->altitude_error_deviation))
-         return false;
-     if (strcmp(type+2, "GST"))
-         return false;
+     minmea_field(minmea_read_time(cursor, &frame->time));
+     minmea_field(minmea_read_float(cursor, &frame->rms_deviation));
+     minmea_field(minmea_read_float(cursor, &frame->semi_major_deviation));
+     minmea_field(minmea_read_float(cursor, &frame->semi_minor_deviation));
+     minmea_field(minmea_read_float(cursor, &frame->semi_major_orientation));
+     minmea_field(minmea_read_float(cursor, &frame->latitude_error_deviation));
+     minmea_field(minmea_read_float(cursor, &frame->longitude_error_deviation));
+     minmea_field(minmea_read_float(cursor, &frame->altitude_error_deviation));
  
      return true;
  }
  
- bool minmea_parse_gsv(struct minmea_sentence_gsv *frame, const char *sentence)
+ static bool minmea_read_gsv(struct minmea_cursor *cursor, struct minmea_sentence_gsv *frame)
  {
      // $GPGSV,3,1,11,03,03,111,00,04,15,270,00,06,01,010,00,13,06,292,00*74
-     // $GPGSV,3,3,11,22,42,067,42,24,14,311,43,27,05,244,00,,,,*4D
-     // $GPGSV,4,2,11,08,51,203,30,09,45,215,28*75
-     // $GPGSV,4,4,13,39,31,170,27*40
      // $GPGSV,4,4,13*7B
-     char type[6];
- 
-     if (!minmea_scan(sentence, "tiii;iiiiiiiiiiiiiiii",
-             type,
-             &frame->total_msgs,
-             &frame->msg_nr,
-             &frame->total_sats,
-             &frame->sats[0].nr,
-             &frame->sats[0].elevation,
-             &frame->sats[0].azimuth,
-             &frame->sats[0].snr,
-             &frame->sats[1].nr,
-             &frame->sats[1].elevation,
-             &frame->sats[1].azimuth,
-             &frame->sats[1].snr,
-             &frame->sats[2].nr,
-             &frame->sats[2].elevation,
-             &frame->sats[2].azimuth,
-             &frame->sats[2].snr,
-             &frame->sats[3].nr,
-             &frame->sats[3].elevation,
-             &frame->sats[3].azimuth,
-             &frame->sats[3].snr
-             )) {
-         return false;
+     minmea_field(minmea_read_int(cursor, &frame->total_msgs));
+     minmea_field(minmea_read_int(cursor, &frame->msg_nr));
+     minmea_field(minmea_read_int(cursor, &frame->total_sats));
+     for (int i=0; i<4; i++) {
+         minmea_optional_field(minmea_read_int(cursor, &frame->sats[i].nr));
+         minmea_optional_field(minmea_read_int(cursor, &frame->sats[i].elevation));
+         minmea_optional_field(minmea_read_int(cursor, &frame->sats[i].azimuth));
+         minmea_optional_field(minmea_read_int(cursor, &frame->sats[i].snr));
      }
-     if (strcmp(type+2, "GSV"))
-         return false;
  
      return true;
  }
  
- bool minmea_parse_vtg(struct minmea_sentence_vtg *frame, const char *sentence)
+ static bool minmea_read_vtg(struct minmea_cursor *cursor, struct minmea_sentence_vtg *frame)
  {
      // $GPVTG,054.7,T,034.4,M,005.5,N,010.2,K*48
-     // $GPVTG,156.1,T,140.9,M,0.0,N,0.0,K*41
      // $GPVTG,096.5,T,083.5,M,0.0,N,0.0,K,D*22
-     // $GPVTG,188.36,T,,M,0.820,N,1.519,K,A*3F
-     char type[6];
      char c_true, c_magnetic, c_knots, c_kph, c_faa_mode;
  
-     if (!minmea_scan(sentence, "tfcfcfcfc;c",
-             type,
-             &frame->true_track_degrees,
-             &c_true,
-             &frame->magnetic_track_degrees,
-             &c_magnetic,
-             &frame->speed_knots,
-             &c_knots,
-             &frame->speed_kph,
-             &c_kph,
-             &c_faa_mode))
-         return false;
-     if (strcmp(type+2, "VTG"))
-         return false;
+     minmea_field(minmea_read_float(cursor, &frame->true_track_degrees));
+     minmea_field(minmea_read_char(cursor, &c_true));
+     minmea_field(minmea_read_float(cursor, &frame->magnetic_track_degrees));
+     minmea_field(minmea_read_char(cursor, &c_magnetic));
+     minmea_field(minmea_read_float(cursor, &frame->speed_knots));
+     minmea_field(minmea_read_char(cursor, &c_knots));
+     minmea_field(minmea_read_float(cursor, &frame->speed_kph));
+     minmea_field(minmea_read_char(cursor, &c_kph));
+     minmea_optional_field(minmea_read_char(cursor, &c_faa_mode));
+ 
      // check chars
      if (c_true != 'T' ||
          c_magnetic != 'M' ||
@@ -624,61 +1138,246 @@
      return true;
  }
  
+ static bool minmea_read_zda(struct minmea_cursor *cursor, struct minmea_sentence_zda *frame)
+ {
+     // $GPZDA,201530.00,04,07,2002,00,00*60
+     minmea_field(minmea_read_time(cursor, &frame->time));
+     minmea_field(minmea_read_int(cursor, &frame->date.day));
+     minmea_field(minmea_read_int(cursor, &frame->date.month));
+     minmea_field(minmea_read_int(cursor, &frame->date.year));
+     minmea_field(minmea_read_int(cursor, &frame->hour_offset));
+     minmea_field(minmea_read_int(cursor, &frame->minute_offset));
+ 
+     // check offsets
+     if (abs(frame->hour_offset) > 13 ||
+         frame->minute_offset > 59 ||
+         frame->minute_offset < 0)
+         return false;
+ 
+     return true;
+ }
+ 
+ #undef minmea_field
+ #undef minmea_optional_field
+ 
+ /*
+  * Position the cursor after the talker+sentence identifier, which must be
+  * the expected type. Same rules as the "t" format of minmea_scan().
+  */
+ static bool minmea_cursor_start(struct minmea_cursor *cursor, const char *sentence, uint32_t code)
+ {
+     if (sentence[0] != '$')
+         return false;
+     for (int f=0; f<5; f++)
+         if (!minmea_isfield(sentence[1+f]))
+             return false;
+     if (minmea_type_code(sentence+3) != code)
+         return false;
+ 
+     cursor->p = sentence + 1;
+     cursor->checksum = 0x00;
+     cursor->field = true;
+     minmea_cursor_next(cursor);
+     return true;
+ }
+ 
+ bool minmea_parse_rmc(struct minmea_sentence_rmc *frame, const char *sentence)
+ {
+     struct minmea_cursor cursor;
+ 
+     if (!minmea_cursor_start(&cursor, sentence, MINMEA_TYPE_CODE('R','M','C')))
+         return false;
+     return minmea_read_rmc(&cursor, frame);
+ }
+ 
+ bool minmea_parse_gga(struct minmea_sentence_gga *frame, const char *sentence)
+ {
+     struct minmea_cursor cursor;
+ 
+     if (!minmea_cursor_start(&cursor, sentence, MINMEA_TYPE_CODE('G','G','A')))
+         return false;
+     return minmea_read_gga(&cursor, frame);
+ }
+ 
+ bool minmea_parse_gsa(struct minmea_sentence_gsa *frame, const char *sentence)
+ {
+     struct minmea_cursor cursor;
+ 
+     if (!minmea_cursor_start(&cursor, sentence, MINMEA_TYPE_CODE('G','S','A')))
+         return false;
+     return minmea_read_gsa(&cursor, frame);
+ }
+ 
+ bool minmea_parse_gll(struct minmea_sentence_gll *frame, const char *sentence)
+ {
+     struct minmea_cursor cursor;
+ 
+     if (!minmea_cursor_start(&cursor, sentence, MINMEA_TYPE_CODE('G','L','L')))
+         return false;
+     return minmea_read_gll(&cursor, frame);
+ }
+ 
+ bool minmea_parse_gst(struct minmea_sentence_gst *frame, const char *sentence)
+ {
+     struct minmea_cursor cursor;
+ 
+     if (!minmea_cursor_start(&cursor, sentence, MINMEA_TYPE_CODE('G','S','T')))
+         return false;
+     return minmea_read_gst(&cursor, frame);
+ }
+ 
+ bool minmea_parse_gsv(struct minmea_sentence_gsv *frame, const char *sentence)
+ {
+     struct minmea_cursor cursor;
+ 
+     if (!minmea_cursor_start(&cursor, sentence, MINMEA_TYPE_CODE('G','S','V')))
+         return false;
+     return minmea_read_gsv(&cursor, frame);
+ }
+ 
+ bool minmea_parse_vtg(struct minmea_sentence_vtg *frame, const char *sentence)
+ {
+     struct minmea_cursor cursor;
+ 
+     if (!minmea_cursor_start(&cursor, sentence, MINMEA_TYPE_CODE('V','T','G')))
+         return false;
+     return minmea_read_vtg(&cursor, frame);
+ }
+ 
  bool minmea_parse_zda(struct minmea_sentence_zda *frame, const char *sentence)
  {
-   // $GPZDA,201530.00,04,07,2002,00,00*60
-   char type[6];
- 
-   if(!minmea_scan(sentence, "tTiiiii",
-           type,
-           &frame->time,
-           &frame->date.day,
-           &frame->date.month,
-           &frame->date.year,
-           &frame->hour_offset,
-           &frame->minute_offset))
-       return false;
-   if (strcmp(type+2, "ZDA"))
-       return false;
- 
-   // check offsets
-   if (abs(frame->hour_offset) > 13 ||
-       frame->minute_offset > 59 ||
-       frame->minute_offset < 0)
-       return false;
- 
-   return true;
+     struct minmea_cursor cursor;
+ 
+     if (!minmea_cursor_start(&cursor, sentence, MINMEA_TYPE_CODE('Z','D','A')))
+         return false;
+     return minmea_read_zda(&cursor, frame);
  }
+ 
+ bool minmea_parse(struct minmea_frame *frame, const char *sentence, bool strict)
+ {
+     struct minmea_cursor cursor = {sentence, 0x00, true};
+     enum minmea_sentence_id id;
+     bool parsed = false;
+ 
+     // Identify the sentence from its header. Unknown and proprietary
+     // sentences are turned away here, without validating them.
+     id = minmea_peek_sentence_id(sentence);
+     frame->id = id;
+     frame->talker[0] = '\0';
+     if (id == MINMEA_INVALID || id == MINMEA_UNKNOWN || id == MINMEA_SENTENCE_PROPRIETARY)
+         return false;
+ 
+     frame->id = MINMEA_INVALID;
+     frame->talker[0] = sentence[1];
+     frame->talker[1] = sentence[2];
+     frame->talker[2] = '\0';
+ 
+     // The "$" is not part of the checksum.
+     cursor.p++;
+     minmea_cursor_next(&cursor);
+ 
+     switch (id) {
+         case MINMEA_SENTENCE_RMC:
+             parsed = minmea_read_rmc(&cursor, &frame->data.rmc);
+             break;
+         case MINMEA_SENTENCE_GGA:
+             parsed = minmea_read_gga(&cursor, &frame->data.gga);
+             break;
+         case MINMEA_SENTENCE_GSA:
+             parsed = minmea_read_gsa(&cursor, &frame->data.gsa);
+             break;
+         case MINMEA_SENTENCE_GLL:
+             parsed = minmea_read_gll(&cursor, &frame->data.gll);
+             break;
+         case MINMEA_SENTENCE_GST:
+             parsed = minmea_read_gst(&cursor, &frame->data.gst);
+             break;
+         case MINMEA_SENTENCE_GSV:
+             parsed = minmea_read_gsv(&cursor, &frame->data.gsv);
+             break;
+         case MINMEA_SENTENCE_VTG:
+             parsed = minmea_read_vtg(&cursor, &frame->data.vtg);
+             break;
+         case MINMEA_SENTENCE_ZDA:
+             parsed = minmea_read_zda(&cursor, &frame->data.zda);
+             break;
+         default:
+             // A registered type. We don't parse it, but it still has to be validated.
+             break;
+     }
+ 
+     // Fold whatever is left up to the "*" into the checksum.
+     while (*cursor.p != '*' && minmea_isprint(*cursor.p))
+         minmea_cursor_take(&cursor);
+ 
+     // If checksum is present...
+     if (*cursor.p == '*') {
+         // Extract checksum.
+         cursor.p++;
+         int upper = hex2int(*cursor.p++);
+         if (upper == -1)
+             return false;
+         int lower = hex2int(*cursor.p++);
+         if (lower == -1)
+             return false;
+ 
+         // Check for checksum mismatch.
+         if (cursor.checksum != (upper << 4 | lower))
+             return false;
+     } else if (strict) {
+         // Discard non-checksummed frames in strict mode.
+         return false;
+     }
+ 
+     // The only stuff allowed at this point is a newline.
+     if (cursor.p[0] == '\r' && cursor.p[1] == '\n')
+         cursor.p += 2;
+     else if (cursor.p[0] == '\n')
+         cursor.p++;
+     if (*cursor.p)
+         return false;
+ 
+     // Sequence length is limited.
+     if (cursor.p - sentence > MINMEA_MAX_LENGTH + 3)
+         return false;
+ 
+     frame->id = id;
+     return parsed;
+ }
+ 
 
+ int_least32_t minmea_days_from_civil(int year, int month, int day)
+ {
+     // Counted in 400 year eras starting on 1 March, so that the leap day is
+     // the last day of the year. See http://howardhinnant.github.io/date_algorithms.html
+     year -= month <= 2;
+     int_least32_t era = (year >= 0 ? year : year - 399) / 400;
+     int_least32_t year_of_era = year - era * 400;
+     int_least32_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+     int_least32_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+     return era * 146097 + day_of_era - 719468;
+ }
  
  int minmea_gettime(struct timespec *ts, const struct minmea_date *date, const struct minmea_time *time_)
  {
      if (date->year == -1 || time_->hours == -1)
          return -1;
+     if (date->month < 1 || date->month > 12)
+         return -1;
  
-     struct tm tm;
-     memset(&tm, 0, sizeof(tm));
+     int year;
      if (date->year < 80) {
-         tm.tm_year = 2000 + date->year - 1900;  // 2000-2079
+         year = 2000 + date->year;  // 2000-2079
      } else if (date->year >= 1900) {
-         tm.tm_year = date->year - 1900; // 4 digit year, use directly
+         year = date->year; // 4 digit year, use directly
      } else {
-         tm.tm_year = date->year;    // 1980-1999
-     }
-     tm.tm_mon = date->month - 1;
-     tm.tm_mday = date->day;
-     tm.tm_hour = time_->hours;
-     tm.tm_min = time_->minutes;
-     tm.tm_sec = time_->seconds;
- 
-     time_t timestamp = mktime(&tm); /* See README.md if your system lacks timegm(). */
-     if (timestamp != -1) {
-         ts->tv_sec = timestamp;
-         ts->tv_nsec = time_->microseconds * 1000;
-         return 0;
-     } else {
-         return -1;
+         year = 1900 + date->year;    // 1980-1999
      }
+ 
+     int_least32_t days = minmea_days_from_civil(year, date->month, date->day);
+     ts->tv_sec = (time_t) days * 86400 + time_->hours * 3600 + time_->minutes * 60 + time_->seconds;
+     ts->tv_nsec = time_->microseconds * 1000;
+     return 0;
  }
  
  /* vim: set ts=4 sw=4 et: */
\ No newline at end of file
@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""Generate include/gps2_commands.h, receiver commands with their checksums.
+
+Each command becomes a string literal holding the whole sentence or packet, so
+sending one is a copy into the tx ring with no formatting or checksum at run
+time. Add commands to the tables below and rerun:
+
+usage: gen_commands.py > include/gps2_commands.h
+"""
+
+import struct
+import sys
+
+
+def checksum(body):
+    value = 0
+    for c in body:
+        value ^= ord(c)
+    return value
+
+
+def sentence(body):
+    return ("$%s*%02X\r\n" % (body, checksum(body))).encode("ascii")
+
+
+def ubx(msg_class, msg_id, payload):
+    body = struct.pack("<BBH", msg_class, msg_id, len(payload)) + payload
+    ck_a = ck_b = 0
+    for b in body:
+        ck_a = (ck_a + b) & 0xFF
+        ck_b = (ck_b + ck_a) & 0xFF
+    return b"\xb5\x62" + body + bytes((ck_a, ck_b))
+
+
+# PMTK314 sets the interval, in fixes, of GLL RMC VTG GGA GSA GSV and then
+# thirteen more sentence types we don't use
+def pmtk314(gll=0, rmc=0, vtg=0, gga=0, gsa=0, gsv=0):
+    return "PMTK314," + ",".join(str(n) for n in (gll, rmc, vtg, gga, gsa, gsv) + (0,) * 13)
+
+
+PMTK = [
+    ("HOT_START", "PMTK101", "restart using everything in memory"),
+    ("WARM_START", "PMTK102", "restart without the ephemeris"),
+    ("COLD_START", "PMTK103", "restart without time, position or almanac"),
+    ("STANDBY", "PMTK161,0", "standby until the next byte"),
+    ("UPDATE_1HZ", "PMTK220,1000", "one fix a second"),
+    ("UPDATE_5HZ", "PMTK220,200", None),
+    ("UPDATE_10HZ", "PMTK220,100", None),
+    ("BAUD_9600", "PMTK251,9600", "UART rate. The receiver switches straight away"),
+    ("BAUD_38400", "PMTK251,38400", None),
+    ("BAUD_57600", "PMTK251,57600", None),
+    ("BAUD_115200", "PMTK251,115200", None),
+    ("SBAS_ON", "PMTK313,1", "SBAS satellites, and use them for DGPS"),
+    ("DGPS_SBAS", "PMTK301,2", None),
+    ("OUTPUT_RMC", pmtk314(rmc=1), "sentences sent each fix"),
+    ("OUTPUT_RMC_GGA", pmtk314(rmc=1, gga=1), None),
+    ("OUTPUT_FIX", pmtk314(rmc=1, vtg=1, gga=1, gsa=1), "what MGOS_EV_GPS_FIX merges, without GSV"),
+    ("OUTPUT_SKY", pmtk314(rmc=1, vtg=1, gga=1, gsa=1, gsv=5), "and GSV every fifth fix"),
+    ("OUTPUT_DEFAULT", "PMTK314,-1", "the receiver's own default"),
+    ("QUERY_RELEASE", "PMTK605", "answered with PMTK705"),
+]
+
+UBX_CLASS_NAV = 0x01
+UBX_CLASS_CFG = 0x06
+UBX_CLASS_NMEA = 0xF0
+
+
+def cfg_rate(ms):
+    # measurement period, one fix per measurement, aligned to GPS time
+    return ubx(UBX_CLASS_CFG, 0x08, struct.pack("<HHH", ms, 1, 1))
+
+
+def cfg_msg(msg_class, msg_id, rate):
+    # rate per fix on the current port
+    return ubx(UBX_CLASS_CFG, 0x01, struct.pack("<BBB", msg_class, msg_id, rate))
+
+
+UBX = [
+    ("RATE_1HZ", cfg_rate(1000), "CFG-RATE, fixes per second"),
+    ("RATE_5HZ", cfg_rate(200), None),
+    ("RATE_10HZ", cfg_rate(100), None),
+    ("NAV_PVT_ON", cfg_msg(UBX_CLASS_NAV, 0x07, 1), "CFG-MSG, NAV-PVT every fix"),
+    ("NAV_PVT_OFF", cfg_msg(UBX_CLASS_NAV, 0x07, 0), None),
+    ("NAV_SAT_ON", cfg_msg(UBX_CLASS_NAV, 0x35, 5), "NAV-SAT every fifth fix"),
+    ("NAV_SAT_OFF", cfg_msg(UBX_CLASS_NAV, 0x35, 0), None),
+    ("NMEA_GSV_OFF", cfg_msg(UBX_CLASS_NMEA, 0x03, 0), "stop NMEA GSV, the bulk of the output"),
+    ("NMEA_GSV_ON", cfg_msg(UBX_CLASS_NMEA, 0x03, 1), None),
+    ("NMEA_GLL_OFF", cfg_msg(UBX_CLASS_NMEA, 0x01, 0), None),
+]
+
+
+def literal(data):
+    if data.startswith(b"$"):
+        return '"%s"' % data.decode("ascii").replace("\r", "\\r").replace("\n", "\\n")
+    # binary, every byte escaped so no escape runs into the next character
+    return '"%s"' % "".join("\\x%02X" % b for b in data)
+
+
+def define(name, data, comment):
+    lines = []
+    if comment:
+        lines.append("/* %s */" % comment)
+    lines.append("#define %s %s" % (name, literal(data)))
+    return "\n".join(lines)
+
+
+def main():
+    out = sys.stdout
+    out.write("""/*
+* Receiver commands as string literals, with their checksums worked out by
+* tools/gen_commands.py. Generated, edit the script rather than this file.
+*
+*   gps2_send_device_template(dev, GPS2_PMTK_UPDATE_10HZ);
+*   gps2_send_device_pmtk(dev, GPS2_PMTK_UPDATE_10HZ, cb, userdata);
+*
+* The PMTK ones can also go through the PMTK queue to wait for their
+* acknowledgement.
+*/
+
+#ifndef GPS2_COMMANDS_H
+#define GPS2_COMMANDS_H
+
+/* MediaTek */
+
+""")
+    out.write("\n".join(define("GPS2_PMTK_" + name, sentence(body), comment) for name, body, comment in PMTK))
+    out.write("\n\n/* u-blox */\n\n")
+    out.write("\n".join(define("GPS2_UBX_" + name, data, comment) for name, data, comment in UBX))
+    out.write("\n\n#endif /* GPS2_COMMANDS_H */\n")
+
+
+if __name__ == "__main__":
+    main()